@@ -16,11 +16,13 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#ifndef FENDERZ_HEADLESS_ONLY
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glx.h>
+#endif
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,30 +30,95 @@
 #include <time.h>
 #include <sys/time.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 const float GRAVITY = 9.81f;
-const float GROUND_Y = -2.0f;
+const float DEFAULT_GROUND_Y = -2.0f;
 const float CUBE_SIZE = 0.5f;
-const int NUM_CUBES = 100;
-const float BOUNCE_FACTOR = 1.0f;
-const float FRICTION_FACTOR = 0.9f;
+const int DEFAULT_NUM_CUBES = 100;
+const int MAX_NUM_CUBES = 16 * 1024 * 1024;
+const float DEFAULT_ARENA_HALF_WIDTH = 8.0f;
+const float DEFAULT_TERRAIN_HEIGHT = 3.0f;
+const float DEFAULT_CCD_THRESHOLD = 0.5f;
+const float CCD_TARGET_PENETRATION = 0.2f;
+const int CCD_TERRAIN_ITERATIONS = 12;
+/* Terrain samples inside a box kept as contacts per face, beyond its 8 vertices. */
+#define TERRAIN_FOOTPRINT_POINTS 24
+const int TERRAIN_CLOSEST_POINT_ITERATIONS = 3;
+const int DEFAULT_MAX_SUBSTEPS = 4;
+const float DEFAULT_SUBSTEP_SPEED = 12.0f;
+const int DEFAULT_SUBSTEP_CONTACTS = 50000;
+const int SUBSTEP_MERGE_STEPS = 60;
+const float BOUNDING_EXTENT_SCALE = 0.8660254f;
+const float CAPSULE_RADIUS_SCALE = 0.25f;
+/* Bounding extent over size per shape: a box's half diagonal, a sphere's radius,
+ * and a capsule's half length (its half segment plus radius). Passes over bodies
+ * of every shape use the largest, BOUNDING_EXTENT_SCALE. */
+static const float SHAPE_BOUNDING_SCALE[] = { 0.8660254f, 0.5f, 0.5f };
+const float ROUND_MANIFOLD_COSINE = 0.95f;
+const float AABB_TREE_MARGIN = 0.1f;
+const float AABB_TREE_DISPLACEMENT_SCALE = 4.0f;
+const float DEFAULT_RESTITUTION = 0.3f;
+const float DEFAULT_FRICTION = 0.6f;
+const int DEFAULT_SOLVER_ITERATIONS = 8;
+const float RESTITUTION_VELOCITY_THRESHOLD = 1.0f;
+const float BAUMGARTE_FACTOR = 0.2f;
+const float PENETRATION_SLOP = 0.005f;
+const float MAX_PENETRATION_CORRECTION_SPEED = 4.0f;
+/* Mass per unit volume, shared by every body; only mass ratios affect contacts. */
+const float BODY_DENSITY = 1.0f;
+/* Rolling and spinning resistance: the opposing angular impulse a contact may
+ * apply is this times the body's rolling radius times its normal impulse. Box
+ * contacts only resist spin about the normal, since boxes tip over their edges. */
+const float ROLLING_RESISTANCE = 0.05f;
 const float REST_THRESHOLD = 0.05f;
+const float TIME_TO_SLEEP = 0.5f;
 const float RESET_INTERVAL_SECONDS = 10.0f;
+const int MAX_RESPAWN_BATCH = 4096;
+const int DEFAULT_EMITTER_HEADROOM = 16384;
 const float AUTO_ROTATE_SPEED_Y = 100.0f;
 const float CAMERA_HEIGHT_OFFSET = 8.0f;
+const float PHYSICS_HZ = 240.0f;
+const int MAX_STEPS_PER_FRAME = 16;
+const int MAX_THREADS = 256;
+const int PARALLEL_GRAIN = 1024;
+const int TASK_SLICES_PER_THREAD = 4;
+const uint32_t DEFAULT_DETERMINISTIC_SEED = 0x5eed;
+const int REPLAY_CHECKPOINT_INTERVAL = 240;
+/* Added to the bodies' reach when sizing the ghost band along a slab border. */
+const float DOMAIN_GHOST_SLACK = 0.25f;
 
 const bool DEBUG_MODE = false;
 
+#ifndef FENDERZ_HEADLESS_ONLY
 Display* g_display = NULL;
 Window g_window;
 GLXContext g_glContext;
 Colormap g_colorMap;
 GLuint g_cube_texture_id;
+GLuint g_terrainList = 0;
 
 Cursor g_invisibleCursor;
 
+PFNGLXSWAPINTERVALSGIPROC glXSwapIntervalSGI = NULL;
+PFNGLXSWAPINTERVALMESAPROC glXSwapIntervalMESA = NULL;
+#endif
+
 float rotateX = 0.0f;
 float rotateY = 0.0f;
+float prevRotateY = 0.0f;
 
 struct timeval lastFrameTime_tv;
 
@@ -62,9 +129,42 @@ float fpsTimer = 0.0f;
 int frameCount = 0;
 
 float resetTimer = 0.0f;
-
-PFNGLXSWAPINTERVALSGIPROC glXSwapIntervalSGI = NULL;
-PFNGLXSWAPINTERVALMESAPROC glXSwapIntervalMESA = NULL;
+/* Every allocAligned and reserveArray growth. The headless report splits the
+ * count since the first periodic reset into the resets themselves, which reuse
+ * the world and never allocate, and the steps, whose scratch buffers may still
+ * grow when a pile reaches a new high-water mark. */
+_Atomic long long g_allocationCount = 0;
+int g_periodicResets = 0;
+long long g_allocationsAtFirstReset = 0;
+long long g_resetAllocations = 0;
+
+float physicsAccumulator = 0.0f;
+
+int g_numCubes = DEFAULT_NUM_CUBES;
+int g_numSpheres = 0;
+int g_numCapsules = 0;
+int g_maxCubes = 0;
+float g_cubeSizeMin = 0.5f;
+float g_cubeSizeMax = 0.5f;
+float g_restitution = DEFAULT_RESTITUTION;
+float g_friction = DEFAULT_FRICTION;
+float g_ccdThreshold = DEFAULT_CCD_THRESHOLD;
+int g_solverIterations = DEFAULT_SOLVER_ITERATIONS;
+float g_respawnRate = 0.0f;
+uint32_t g_seed = 0;
+uint32_t g_spawnSeed = 0;
+uint32_t g_spawnGeneration = 0;
+int g_threadCount = 0;
+
+bool g_headless = false;
+long g_headlessSteps = 0;
+double g_headlessSeconds = 0.0;
+
+bool g_deterministic = false;
+bool g_seedSet = false;
+long g_stepCount = 0;
+const char* g_recordPath = NULL;
+const char* g_replayPath = NULL;
 
 typedef struct {
     float x, y, z;
@@ -107,37 +207,1096 @@ Vec3 vec3_normalize(Vec3 v) {
     return vec3_create(0.0f, 0.0f, 0.0f);
 }
 
+#if defined(__AVX512F__)
+#define SIMD_WIDTH 16
+typedef __m512 vfloat;
+typedef __mmask16 vmask;
+static inline vfloat vf_set1(float x) { return _mm512_set1_ps(x); }
+static inline vfloat vf_load(const float* p) { return _mm512_load_ps(p); }
+static inline vfloat vf_loadu(const float* p) { return _mm512_loadu_ps(p); }
+static inline void vf_store(float* p, vfloat a) { _mm512_store_ps(p, a); }
+static inline vfloat vf_add(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+static inline vfloat vf_sub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+static inline vfloat vf_mul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+static inline vfloat vf_fmadd(vfloat a, vfloat b, vfloat c) { return _mm512_fmadd_ps(a, b, c); }
+static inline vfloat vf_div(vfloat a, vfloat b) { return _mm512_div_ps(a, b); }
+static inline vfloat vf_sqrt(vfloat a) { return _mm512_sqrt_ps(a); }
+static inline vfloat vf_abs(vfloat a) { return _mm512_abs_ps(a); }
+static inline vfloat vf_select(vmask m, vfloat a, vfloat b) { return _mm512_mask_blend_ps(m, b, a); }
+static inline vmask vf_lt(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+static inline vmask vf_le(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+static inline vmask vf_gt(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+static inline vmask vm_and(vmask a, vmask b) { return a & b; }
+static inline vmask vm_or(vmask a, vmask b) { return a | b; }
+static inline unsigned vm_bits(vmask m) { return (unsigned)m; }
+typedef __m512i vint;
+static inline vint vi_load(const int* p) { return _mm512_loadu_si512((const void*)p); }
+static inline vfloat vf_gather(const float* base, vint idx) { return _mm512_i32gather_ps(idx, base, 4); }
+static inline void vf_scatter(float* base, vint idx, vfloat a) { _mm512_i32scatter_ps(base, idx, a, 4); }
+#elif defined(__AVX2__)
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+typedef __m256 vmask;
+static inline vfloat vf_set1(float x) { return _mm256_set1_ps(x); }
+static inline vfloat vf_load(const float* p) { return _mm256_load_ps(p); }
+static inline vfloat vf_loadu(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vf_store(float* p, vfloat a) { _mm256_store_ps(p, a); }
+static inline vfloat vf_add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vf_sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat vf_mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vf_fmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+static inline vfloat vf_div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat vf_sqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+static inline vfloat vf_abs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline vfloat vf_select(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+static inline vmask vf_lt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vmask vf_le(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline vmask vf_gt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vmask vm_and(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+static inline vmask vm_or(vmask a, vmask b) { return _mm256_or_ps(a, b); }
+static inline unsigned vm_bits(vmask m) { return (unsigned)_mm256_movemask_ps(m); }
+typedef __m256i vint;
+static inline vint vi_load(const int* p) { return _mm256_loadu_si256((const __m256i*)p); }
+static inline vfloat vf_gather(const float* base, vint idx) { return _mm256_i32gather_ps(base, idx, 4); }
+static inline void vf_scatter(float* base, vint idx, vfloat a) {
+    int lanes[8] __attribute__((aligned(32)));
+    float values[8] __attribute__((aligned(32)));
+    _mm256_store_si256((__m256i*)lanes, idx);
+    _mm256_store_ps(values, a);
+    for (int l = 0; l < 8; ++l) base[lanes[l]] = values[l];
+}
+#else
+#define SIMD_WIDTH 1
+typedef float vfloat;
+typedef bool vmask;
+static inline vfloat vf_set1(float x) { return x; }
+static inline vfloat vf_load(const float* p) { return *p; }
+static inline vfloat vf_loadu(const float* p) { return *p; }
+static inline void vf_store(float* p, vfloat a) { *p = a; }
+static inline vfloat vf_add(vfloat a, vfloat b) { return a + b; }
+static inline vfloat vf_sub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat vf_mul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat vf_fmadd(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+static inline vfloat vf_div(vfloat a, vfloat b) { return a / b; }
+static inline vfloat vf_sqrt(vfloat a) { return sqrtf(a); }
+static inline vfloat vf_abs(vfloat a) { return fabsf(a); }
+static inline vfloat vf_select(vmask m, vfloat a, vfloat b) { return m ? a : b; }
+static inline vmask vf_lt(vfloat a, vfloat b) { return a < b; }
+static inline vmask vf_le(vfloat a, vfloat b) { return a <= b; }
+static inline vmask vf_gt(vfloat a, vfloat b) { return a > b; }
+static inline vmask vm_and(vmask a, vmask b) { return a && b; }
+static inline vmask vm_or(vmask a, vmask b) { return a || b; }
+static inline unsigned vm_bits(vmask m) { return m ? 1u : 0u; }
+typedef int vint;
+static inline vint vi_load(const int* p) { return *p; }
+static inline vfloat vf_gather(const float* base, vint idx) { return base[idx]; }
+static inline void vf_scatter(float* base, vint idx, vfloat a) { base[idx] = a; }
+#endif
+
+#define SIMD_ALIGNMENT 64
+
+/* Loads are unaligned because a shape batch can start anywhere in the arrays. */
+static inline vfloat streamLoad(const float* stream, const int* list, int base) {
+    return list != NULL ? vf_gather(stream, vi_load(list + base)) : vf_loadu(stream + base);
+}
+
+static inline void streamStore(float* stream, const int* list, int base, vfloat a) {
+    if (list != NULL) vf_scatter(stream, vi_load(list + base), a);
+    else vf_store(stream + base, a);
+}
+
+/* Bodies are kept sorted by shape, so each shape is one dense batch. */
+typedef enum {
+    SHAPE_BOX,
+    SHAPE_SPHERE,
+    SHAPE_CAPSULE,
+    SHAPE_COUNT
+} ShapeType;
+
+static const char* const SHAPE_NAMES[] = { "box", "sphere", "capsule" };
+
+typedef struct {
+    int count;
+    int capacity;
+    float* posX;
+    float* posY;
+    float* posZ;
+    float* velX;
+    float* velY;
+    float* velZ;
+    float* angVelX;
+    float* angVelY;
+    float* angVelZ;
+    float* quatW;
+    float* quatX;
+    float* quatY;
+    float* quatZ;
+    float* prevPosX;
+    float* prevPosY;
+    float* prevPosZ;
+    float* prevQuatW;
+    float* prevQuatX;
+    float* prevQuatY;
+    float* prevQuatZ;
+    float* sweepX;
+    float* sweepY;
+    float* sweepZ;
+    float* colorR;
+    float* colorG;
+    float* colorB;
+    float* size;
+    float* invMass;
+    float* invInertiaX;
+    float* invInertiaY;
+    float* invInertiaZ;
+    float* sleepTimer;
+    uint8_t* resting;
+    uint8_t* shape;
+    int shapeStart[SHAPE_COUNT + 1];
+    int* awake;
+    int awakeCount;
+    int awakeCapacity;
+    int awakeShapeStart[SHAPE_COUNT + 1];
+} World;
+
+World g_world;
+
+typedef struct {
+    int a, b;
+} BodyPair;
+
+typedef struct {
+    BodyPair* pairs;
+    int count;
+    int capacity;
+} PairList;
+
+PairList g_pairs;
+
+/* Pairs are grouped by the shapes of their bodies so each group runs through
+ * its own narrowphase kernel. Dense indices are shape-sorted and a < b, so the
+ * lower shape is always body a. */
+typedef enum {
+    PAIR_BOX_BOX,
+    PAIR_BOX_SPHERE,
+    PAIR_BOX_CAPSULE,
+    PAIR_SPHERE_SPHERE,
+    PAIR_SPHERE_CAPSULE,
+    PAIR_CAPSULE_CAPSULE,
+    PAIR_KIND_COUNT
+} PairKind;
+
+static const PairKind PAIR_KINDS[SHAPE_COUNT][SHAPE_COUNT] = {
+    { PAIR_BOX_BOX, PAIR_BOX_SPHERE, PAIR_BOX_CAPSULE },
+    { PAIR_BOX_SPHERE, PAIR_SPHERE_SPHERE, PAIR_SPHERE_CAPSULE },
+    { PAIR_BOX_CAPSULE, PAIR_SPHERE_CAPSULE, PAIR_CAPSULE_CAPSULE }
+};
+
+typedef struct {
+    int start[PAIR_KIND_COUNT + 1];
+    BodyPair* scratch;
+    int scratchCapacity;
+} PairGroups;
+
+PairGroups g_pairGroups;
+
+typedef struct {
+    Vec3 center;
+    Vec3 axis[3];
+    float extent[3];
+} Obb;
+
+/* Spheres and capsules are a core segment swept by a radius; a sphere's segment
+ * has no length and a capsule's runs along its local y axis. */
+typedef struct {
+    Vec3 center;
+    Vec3 axis;
+    float half;
+    float radius;
+} RoundShape;
+
+#define MAX_MANIFOLD_POINTS 4
+
 typedef struct {
     Vec3 position;
+    float depth;
+    int feature;
+} ContactPoint;
+
+typedef struct {
+    int a, b;
+    Vec3 normal;
+    int pointCount;
+    ContactPoint points[MAX_MANIFOLD_POINTS];
+} ContactManifold;
+
+typedef struct {
+    ContactManifold* manifolds;
+    int count;
+    int capacity;
+} ManifoldList;
+
+ManifoldList g_manifolds;
+
+typedef struct {
+    uint64_t key;
+    int a, b;
+    Vec3 normal;
+    Vec3 tangent1;
+    Vec3 tangent2;
+    Vec3 offsetA;
+    Vec3 offsetB;
+    float normalMass;
+    float tangentMass1;
+    float tangentMass2;
+    float bias;
+    float normalImpulse;
+    float tangentImpulse1;
+    float tangentImpulse2;
+    float rollingLimit;
+    bool rollingAboutNormal;
+    float spinMass;
+    Vec3 rollingImpulse;
+} ContactConstraint;
+
+typedef struct {
+    ContactConstraint* constraints;
+    int count;
+    int capacity;
+    float invDeltaTime;
+} ConstraintList;
+
+ConstraintList g_constraints;
+
+#define MAX_SOLVER_COLORS 64
+#define MAX_STATIC_PLANES 32
+#define MAX_STATIC_BOXES 256
+#define STATIC_BOX_FEATURE_BASE 4096
+#define STATIC_BOX_FEATURE_STRIDE 128
+
+/* Immovable geometry. Planes are half-spaces dot(n, p) >= offset kept in SoA form
+ * for the SIMD contact kernel; boxes carry a world AABB for the same kernel's
+ * bounds test. The ground and arena walls are ordinary planes. */
+typedef struct {
+    int planeCount;
+    float planeNX[MAX_STATIC_PLANES];
+    float planeNY[MAX_STATIC_PLANES];
+    float planeNZ[MAX_STATIC_PLANES];
+    float planeOffset[MAX_STATIC_PLANES];
+    int boxCount;
+    Obb boxes[MAX_STATIC_BOXES];
+    Vec3 boxHalfExtent[MAX_STATIC_BOXES];
+    float groundY;
+    float arenaHalfWidth;
+    const char* path;
+} StaticColliders;
+
+StaticColliders g_statics = { .groundY = DEFAULT_GROUND_Y, .arenaHalfWidth = DEFAULT_ARENA_HALF_WIDTH };
+
+#define TERRAIN_FEATURE_BASE 2048
+/* Terrain sample contacts follow the 8 box vertices, keyed by sample index. */
+#define TERRAIN_SAMPLE_FEATURES (STATIC_BOX_FEATURE_BASE - TERRAIN_FEATURE_BASE - 8)
+#define MAX_EMITTERS 64
+
+/* Static heightfield over the XZ plane, centered on the origin. Samples are world
+ * heights at grid vertices; vertex normals are precomputed so a contact needs one
+ * cell lookup and two bilinear blends. */
+typedef struct {
+    const char* path;
+    int width;
+    int depth;
+    float horizontalScale;
+    float heightScale;
+    float cellSize;
+    float invCellSize;
+    float originX;
+    float originZ;
+    float minY;
+    float maxY;
+    float* heights;
+    float* normalX;
+    float* normalY;
+    float* normalZ;
+} Heightfield;
+
+Heightfield g_terrain = { .heightScale = DEFAULT_TERRAIN_HEIGHT };
+
+typedef struct {
+    int first;
+    int count;
+} SolverBatch;
+
+/* Manifolds are greedily colored so that no two manifolds of one color share a
+ * dynamic body; each color is then a batch that can be solved without locks.
+ * Manifolds that find no free color land in a final batch solved serially. */
+typedef struct {
+    uint64_t* bodyColors;
+    int bodyCapacity;
+    int* manifoldColor;
+    int manifoldColorCapacity;
+    int* order;
+    int orderCapacity;
+    int* constraintStart;
+    int constraintStartCapacity;
+    const ManifoldList* manifolds;
+    SolverBatch batches[MAX_SOLVER_COLORS + 1];
+    int batchCount;
+} ConstraintColoring;
+
+ConstraintColoring g_coloring;
+
+/* Velocity and world-space inverse inertia of a body touched by this step's
+ * contacts, packed into one cache line so the solver reads a body with one load
+ * instead of one per stream. Gathered when the constraints are prepared and
+ * scattered back to the world before integration. */
+typedef struct {
     Vec3 velocity;
+    float invMass;
     Vec3 angularVelocity;
-    Vec3 rotation;
-    Vec3 color;
+    float invInertia[6];   /* symmetric: xx, yy, zz, xy, xz, yz */
+    float pad[3];
+} SolverBody;
+
+typedef struct {
+    SolverBody* bodies;
+    int capacity;
+} SolverBodies;
+
+SolverBodies g_solverBodies;
+
+typedef struct {
+    uint64_t key;
+    float normalImpulse;
+    float tangentImpulse1;
+    float tangentImpulse2;
+} CachedImpulse;
+
+typedef struct {
+    CachedImpulse* entries;
+    int count;
+    int capacity;
+    CachedImpulse* scratch;   /* merge target, swapped with entries */
+    int scratchCapacity;
+} ImpulseCache;
+
+ImpulseCache g_impulseCache;
+
+typedef struct {
+    int* parent;
+    float* sleepTimer;
+    int* slept;
+    int sleptCount;
+    int capacity;
+} IslandScratch;
+
+IslandScratch g_islands;
+
+/* Bodies in the order they fell asleep, for streaming respawn. Entries carry a
+ * ticket; a body that wakes and sleeps again gets a new one, which retires its
+ * older entry without having to search the ring. */
+typedef struct {
+    int* body;
+    uint32_t* ticket;
+    int head;
+    int count;
+    int capacity;
+    uint32_t* bodyTicket;
+    int bodyCapacity;
+    uint32_t nextTicket;
+    uint32_t respawnTotal;
+    float credit;
+} RespawnQueue;
+
+RespawnQueue g_respawnQueue;
+
+/* Stable reference to a body: the slot in the upper bits survives compaction of
+ * the dense arrays, and the generation turns stale once the body despawns. */
+typedef uint64_t BodyHandle;
+
+/* Free-list pool behind the dense world arrays. Slots map to dense indices and
+ * back; a free slot's slotDense entry links to the next free slot. */
+typedef struct {
+    int capacity;
+    int* slotDense;
+    uint32_t* slotGeneration;
+    int freeHead;
+    int* denseSlot;
+    uint32_t* spawnStep;
+    uint32_t* sleepStep;
+    uint8_t* doomed;
+    int* despawn;
+    int despawnCount;
+    int sortedCount;
+    int* remap;
+    int* moveSource;
+    int* moveTarget;
+    uint32_t* scratch;
+    uint32_t* globalId;
+    uint8_t* ghost;
+    uint32_t nextGlobalId;
+    long long spawnedTotal;
+    long long despawnedTotal;
+    long long droppedTotal;
+} BodyPool;
+
+BodyPool g_pool;
+
+typedef struct {
+    Vec3 center;
+    Vec3 halfExtent;
+    float rate;
+    Vec3 velocity;
+    float velocitySpread;
+    float credit;
+    ShapeType shape;
+} Emitter;
+
+typedef struct {
+    Emitter emitters[MAX_EMITTERS];
+    int count;
+    const char* path;
+    float quickRate;
+} EmitterSet;
+
+EmitterSet g_emitters;
+
+/* Zero disables a rule. */
+typedef struct {
+    float lifetime;
+    float restingTime;
+    float boundsHalfWidth;
+} DespawnRules;
+
+DespawnRules g_despawn;
+
+#define MAX_DOMAINS 64
+
+/* Ghosts within reach of the border are simulated as full bodies, so contacts
+ * across it are solved alike on both sides; the halo behind them is kinematic
+ * and only holds them up. */
+typedef enum {
+    DOMAIN_RECORD_GHOST,
+    DOMAIN_RECORD_HALO,
+    DOMAIN_RECORD_MIGRATE
+} DomainRecordKind;
+
+/* One body sent over a slab border. */
+typedef struct {
+    uint32_t id;
+    uint32_t age;
+    uint8_t kind;
+    uint8_t shape;
+    uint8_t resting;
     float size;
-    bool resting;
-} Cube;
+    float color[3];
+    float position[3];
+    float orientation[4];
+    float velocity[3];
+    float angularVelocity[3];
+    float sleepTimer;
+} DomainRecord;
+
+typedef struct {
+    DomainRecord* records;
+    uint32_t count;
+    int capacity;
+} DomainBuffer;
+
+typedef struct {
+    uint32_t id;
+    int body;
+} DomainGhost;
+
+/* Spatial decomposition of the arena into slabs along x, one process each.
+ * link[0] leads to the slab below, link[1] to the slab above; -1 at the ends. */
+typedef struct {
+    int count;
+    int rank;
+    pid_t children[MAX_DOMAINS];
+    int link[2];
+    float minX;
+    float maxX;
+    float ghostMargin;
+    DomainBuffer outbox[2];
+    DomainBuffer inbox[2];
+    DomainGhost* ghosts;
+    int ghostCount;
+    int ghostCapacity;
+    long long migratedIn;
+    long long migratedOut;
+    long long recordsReceived;
+} DomainSet;
+
+DomainSet g_domains = { .count = 1, .link = { -1, -1 } };
+
+/* Bodies binned by cell with a counting sort over a table of tableSize
+ * buckets, sized to the binned count so clearing it stays proportional. */
+typedef struct {
+    float cellSize;
+    int tableSize;
+    int capacity;
+    int count;
+    int* cellStart;
+    int* cellBodies;
+    float* cellPosX;
+    float* cellPosY;
+    float* cellPosZ;
+    float* cellExtent;
+    uint32_t* bodyBucket;
+    int* cellX;
+    int* cellY;
+    int* cellZ;
+} SpatialHash;
+
+/* Sleeping bodies chained per bucket over cells twice the largest extent any
+ * body can have. A body is linked as it falls asleep and unlinked as it wakes,
+ * moves or is despawned, so no step rebins them. */
+typedef struct {
+    float cellSize;
+    int tableSize;
+    int capacity;
+    int count;
+    int* bucketHead;
+    int* next;
+    int* prev;
+    int* cellX;
+    int* cellY;
+    int* cellZ;
+} SleepingHash;
+
+/* Awake bodies are binned every step. */
+SpatialHash g_spatialHash;
+SleepingHash g_sleepingHash;
+
+typedef struct {
+    float value;
+    uint32_t owner;
+} SapEndpoint;
+
+typedef struct {
+    SapEndpoint* endpoints;
+    int endpointCount;
+    int endpointCapacity;
+    int axis;
+    bool dirty;
+    int* active;
+    int activeCapacity;
+    int* activeSlot;
+    int activeSlotCapacity;
+    /* Sleeping bodies stay off the endpoint list: their lower endpoints are
+     * kept sorted, inserted as bodies fall asleep and removed as they wake,
+     * and searched from each awake body. */
+    SapEndpoint* sleepers;
+    int sleeperCount;
+    int sleeperCapacity;
+    float sleeperSpan;
+    /* Awake pairs overlapping on the sweep axis, kept across steps. Each
+     * endpoint swap adds or drops its pair through an open-addressed table
+     * from pair key to list slot; the list itself is unordered. */
+    BodyPair* overlaps;
+    int overlapCount;
+    int overlapCapacity;
+    uint64_t* overlapKeys;
+    int* overlapSlots;
+    int overlapTableSize;
+} SweepAndPrune;
+
+SweepAndPrune g_sweepAndPrune = { .dirty = true };
+
+typedef struct {
+    float minX, minY, minZ;
+    float maxX, maxY, maxZ;
+} Aabb;
+
+/* Bodies found moving fast enough to tunnel this step, plus running totals for
+ * the headless report. */
+typedef struct {
+    int body;
+    float toi;
+    Aabb swept;
+} FastBody;
+
+typedef struct {
+    FastBody* fast;
+    int fastCount;
+    int fastCapacity;
+    long long fastTotal;
+    long long clampedTotal;
+} ContinuousCollision;
+
+ContinuousCollision g_ccd;
+
+typedef struct {
+    Aabb box;
+    int parent;
+    int child1;
+    int child2;
+    int height;
+    int body;
+} TreeNode;
+
+typedef struct {
+    TreeNode* nodes;
+    int nodeCount;
+    int nodeCapacity;
+    int root;
+    int freeList;
+    int* bodyLeaf;
+    int bodyLeafCapacity;
+    int bodyCount;
+    bool dirty;
+    int* stack;
+    int stackCapacity;
+} AabbTree;
+
+AabbTree g_aabbTree = { .root = -1, .freeList = -1, .dirty = true };
+
+typedef enum {
+    RNG_STREAM_COLOR_R,
+    RNG_STREAM_COLOR_G,
+    RNG_STREAM_COLOR_B,
+    RNG_STREAM_DROP_HEIGHT,
+    RNG_STREAM_SIZE,
+    RNG_STREAM_SPAWN_SEED,
+    RNG_STREAM_EMIT_X,
+    RNG_STREAM_EMIT_Y,
+    RNG_STREAM_EMIT_Z,
+    RNG_STREAM_EMIT_VX,
+    RNG_STREAM_EMIT_VY,
+    RNG_STREAM_EMIT_VZ,
+    RNG_STREAM_SPAWN_X,
+    RNG_STREAM_SPAWN_Z,
+    RNG_STREAM_ORIENT_W,
+    RNG_STREAM_ORIENT_X,
+    RNG_STREAM_ORIENT_Y,
+    RNG_STREAM_ORIENT_Z
+} RandomStream;
+
+typedef enum {
+    BROADPHASE_GRID,
+    BROADPHASE_SAP,
+    BROADPHASE_TREE
+} BroadphaseType;
+
+static const char* const BROADPHASE_NAMES[] = { "grid", "sap", "tree" };
+
+BroadphaseType g_broadphase = BROADPHASE_GRID;
+
+typedef enum {
+    SUBSTEP_REASON_NONE,
+    SUBSTEP_REASON_SPEED,
+    SUBSTEP_REASON_CONTACTS,
+    SUBSTEP_REASON_COUNT
+} SubstepReason;
+
+static const char* const SUBSTEP_REASON_NAMES[] = { "none", "speed", "contacts" };
+
+/* Substep controller. The previous step's peak speed and contact count pick how
+ * many substeps the next step uses; splits take effect at once, merges only one
+ * level at a time after SUBSTEP_MERGE_STEPS calm steps. count and reason are the
+ * live state, the totals feed the headless report. */
+typedef struct {
+    int maxSubsteps;
+    float speedLimit;
+    int contactLimit;
+    int count;
+    SubstepReason reason;
+    float maxSpeed;
+    int contactCount;
+    int calmSteps;
+    int peak;
+    long long substepTotal;
+    long long splitSteps[SUBSTEP_REASON_COUNT];
+} SubstepControl;
+
+SubstepControl g_substeps = {
+    .maxSubsteps = DEFAULT_MAX_SUBSTEPS,
+    .speedLimit = DEFAULT_SUBSTEP_SPEED,
+    .contactLimit = DEFAULT_SUBSTEP_CONTACTS,
+    .count = 1,
+    .peak = 1
+};
+
+typedef void (*ParallelKernel)(int begin, int end, int slice, void* context);
+
+typedef struct {
+    ParallelKernel kernel;
+    void* context;
+    const int* itemCount;
+    int slice;
+    int rangeFirst;
+    int dependencies;
+    _Atomic int unresolved;
+    int firstEdge;
+} Task;
+
+typedef struct {
+    Task* tasks;
+    int count;
+    int capacity;
+    int* edgeTarget;
+    int* edgeNext;
+    int edgeCount;
+    int edgeCapacity;
+    int edgeTargetCapacity;
+    _Atomic int remaining;
+} TaskGraph;
 
-Cube* g_cubes = NULL;
+typedef struct {
+    _Atomic long top;
+    _Atomic long bottom;
+    _Atomic int* buffer;
+    long capacity;
+    uint32_t stealSeed;
+} WorkDeque;
+
+typedef struct {
+    pthread_t* threads;
+    int threadCount;
+    int sliceCount;
+    WorkDeque* deques;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned generation;
+    int pending;
+    bool shutdown;
+    TaskGraph* graph;
+    ManifoldList* staticManifolds;
+    ManifoldList* pairManifolds;
+    float* maxSpeedSq;
+} ThreadPool;
+
+ThreadPool g_threadPool = {
+    .threadCount = 1,
+    .sliceCount = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER
+};
+
+TaskGraph g_stepGraph;
+TaskGraph g_parallelForGraph;
+
+/* A range task handed to the next physics step by the windowed loop; the graph
+ * of that step's last substep runs it after integration and CCD, then clears it. */
+typedef struct {
+    ParallelKernel kernel;
+    void* context;
+    const int* itemCount;
+    bool armed;
+} StepFollowUp;
+
+StepFollowUp g_stepFollowUp;
+
+typedef struct {
+    long step;
+    uint64_t checksum;
+} ReplayCheckpoint;
+
+/* A recording holds the run configuration and a checksum of the world every
+ * REPLAY_CHECKPOINT_INTERVAL steps; replaying re-runs it headless and compares. */
+typedef struct {
+    FILE* file;
+    ReplayCheckpoint* checkpoints;
+    int count;
+    int capacity;
+    int next;
+    long endStep;
+    long divergedStep;
+    uint64_t expected;
+    uint64_t actual;
+} Replay;
+
+Replay g_replay;
+
+#ifndef FENDERZ_HEADLESS_ONLY
+/* Interpolated 3x4 model matrices (row-major, translation in the last column,
+ * cube scale folded in), one stream per element so a batch is a set of aligned
+ * stores. */
+typedef struct {
+    float* m[12];
+    int capacity;
+} RenderMatrices;
+
+RenderMatrices g_renderMatrices;
+
+/* Unit-size meshes for the round shapes; boxes keep the textured cube. */
+GLuint g_shapeLists[SHAPE_COUNT];
+#endif
+
+static inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Philox4x32-10 counter-based generator: output depends only on (counter, key),
+ * so any body, step and stream can be drawn independently on any thread. The
+ * counter is (index, step, stream, 0) and the key is (seed, PHILOX_KEY_HI). */
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_KEY_HI 0x66656e64u
+
+static inline uint32_t philox4x32(uint32_t seed, uint32_t index, uint32_t step, uint32_t stream) {
+    uint32_t c0 = index, c1 = step, c2 = stream, c3 = 0;
+    uint32_t k0 = seed, k1 = PHILOX_KEY_HI;
+    for (int round = 0; round < 10; ++round) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    return c0;
+}
 
-float rand_float(float min, float max) {
-    return min + (float)rand() / RAND_MAX * (max - min);
+/* Fills out[i - begin] for bodies [begin, end). The rounds run lane-parallel over
+ * SIMD_WIDTH counters at a time so the 32x32->64 multiplies vectorize. */
+void random_float_batch(uint32_t seed, uint32_t step, uint32_t stream, int begin, int end,
+                        float min, float max, float* out) {
+    const float scale = (1.0f / 16777216.0f) * (max - min);
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        uint32_t c0[SIMD_WIDTH], c1[SIMD_WIDTH], c2[SIMD_WIDTH], c3[SIMD_WIDTH];
+        for (int l = 0; l < SIMD_WIDTH; ++l) {
+            c0[l] = (uint32_t)(base + l);
+            c1[l] = step;
+            c2[l] = stream;
+            c3[l] = 0;
+        }
+        uint32_t k0 = seed, k1 = PHILOX_KEY_HI;
+        for (int round = 0; round < 10; ++round) {
+            for (int l = 0; l < SIMD_WIDTH; ++l) {
+                uint64_t p0 = (uint64_t)PHILOX_M0 * c0[l];
+                uint64_t p1 = (uint64_t)PHILOX_M1 * c2[l];
+                c0[l] = (uint32_t)(p1 >> 32) ^ c1[l] ^ k0;
+                c1[l] = (uint32_t)p1;
+                c2[l] = (uint32_t)(p0 >> 32) ^ c3[l] ^ k1;
+                c3[l] = (uint32_t)p0;
+            }
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        int lanes = end - base < SIMD_WIDTH ? end - base : SIMD_WIDTH;
+        for (int l = 0; l < lanes; ++l) {
+            out[base - begin + l] = min + (float)(c0[l] >> 8) * scale;
+        }
+    }
 }
 
+#ifndef FENDERZ_HEADLESS_ONLY
 void initX11OpenGL();
 void destroyX11OpenGL();
 void handleXEvents(XEvent* event, bool* quitFlag);
 void initOpenGL();
 void loadCubeTexture();
-void display();
+void buildTerrainMesh();
+void buildShapeMeshes();
+void display(float alpha, bool prepared);
+void reserveRenderMatrices();
+void prepareRenderMatrices(int begin, int end, int slice, void* context);
 void reshape(int width, int height);
+void drawCube(const GLfloat* model, const Vec3* color);
+void runWindowed();
+#endif
+void runHeadless();
+void parseArguments(int argc, char** argv);
 void resetCubes();
+void spawnCubes(int begin, int end, uint32_t step);
+void spawnCubesRange(int begin, int end, int slice, void* context);
+void recycleRestingBodies(int limit);
+void respawnQueueReserve(RespawnQueue* queue, int count);
+void bodyPoolReset(int count);
+BodyHandle bodyHandle(int i);
+int bodyFromHandle(BodyHandle handle);
+int spawnBodies(int count, ShapeType shape, uint32_t step);
+void despawnBody(int i);
+void compactBodies();
+void applyDespawnRules(float deltaTime);
+void runEmitters(float deltaTime);
+void buildEmitters();
+void startDomains();
+void claimDomainBodies();
+void exchangeDomainBodies();
+void reportDomains(double stepsPerSecond);
+void random_float_batch(uint32_t seed, uint32_t step, uint32_t stream, int begin, int end,
+                        float min, float max, float* out);
 void updatePhysics(float deltaTime);
-void drawCube(const Vec3* position, const Vec3* rotation, const Vec3* color, float size);
+void worldReserve(int capacity);
+void worldFree();
+void integrateVelocitiesRange(int begin, int end, int slice, void* context);
+void collectStaticContactsRange(int begin, int end, int slice, void* context);
+void findCollisionPairsTask(int begin, int end, int slice, void* context);
+void generatePairManifoldsRange(int begin, int end, int slice, void* context);
+void prepareContactsTask(int begin, int end, int slice, void* context);
+void storeContactImpulsesRange(int begin, int end, int slice, void* context);
+void mergeContactImpulsesTask(int begin, int end, int slice, void* context);
+void updateIslandsAndSleepTask(int begin, int end, int slice, void* context);
+void prepareBatchRange(int begin, int end, int slice, void* context);
+void warmStartBatchRange(int begin, int end, int slice, void* context);
+void solveBatchRange(int begin, int end, int slice, void* context);
+void solveAndStoreBatchRange(int begin, int end, int slice, void* context);
+void integrateCubesRange(int begin, int end, int slice, void* context);
+void storeRenderStateRange(int begin, int end, int slice, void* context);
+void continuousCollisionTask(int begin, int end, int slice, void* context);
+void collideStaticPlane(int body, int plane, const Obb* box, ManifoldList* out);
+void collideStaticBox(int body, int index, const Obb* box, ManifoldList* out);
+void buildStaticColliders();
+void loadTerrain();
+void collideTerrain(int body, const Obb* box, ManifoldList* out);
+void collideRoundPlane(int body, int plane, const RoundShape* round, ManifoldList* out);
+void collideRoundBox(int body, int index, const RoundShape* round, ManifoldList* out);
+void collideRoundTerrain(int body, const RoundShape* round, ManifoldList* out);
+void prepareContacts(const ManifoldList* manifolds, float deltaTime);
+int addSolverTasks(TaskGraph* graph, int after);
+void wakeBody(int i);
+void wakeAllBodies();
+void wakeTouchedBodies(const ManifoldList* manifolds);
+void updateIslandsAndSleep(const ManifoldList* manifolds);
+void settleSleptBodies();
+void shutdownSimulation();
+uint64_t worldChecksum();
+void loadReplay(const char* path);
+void openRecording(const char* path);
+void closeRecording();
+void replayCheckpoint();
+void threadPoolInit(int threadCount);
+void threadPoolShutdown();
+void parallelFor(int itemCount, ParallelKernel kernel, void* context);
+void taskGraphReset(TaskGraph* graph);
+int taskAdd(TaskGraph* graph, ParallelKernel kernel, void* context);
+int taskAddRange(TaskGraph* graph, ParallelKernel kernel, void* context, const int* itemCount);
+void taskDepend(TaskGraph* graph, int before, int after);
+void taskGraphRun(TaskGraph* graph);
+void findCollisionPairs(PairList* out, float deltaTime);
+void invalidateBroadphase();
+void findPairsSpatialHash(PairList* out);
+void findPairsSweepAndPrune(PairList* out);
+void findPairsAabbTree(PairList* out, float deltaTime);
+void computeBodyObb(int i, Obb* box);
+void computeBodyRound(int i, RoundShape* round);
+bool boxPlaneManifold(const Obb* box, Vec3 planeNormal, float planeOffset, ContactManifold* m);
+bool boxBoxManifold(const Obb* boxA, const Obb* boxB, ContactManifold* m);
+void generatePairManifolds(const PairList* pairs, ManifoldList* out);
+static void collideBoxPairs(const PairList* pairs, int begin, int end, ManifoldList* out);
+static void collidePairGroups(const PairList* pairs, int begin, int end, ManifoldList* out);
+static void awakeListPad(World* w);
 
 int main(int argc, char** argv) {
-    bool bQuit = false;
+    parseArguments(argc, argv);
+    buildStaticColliders();
+    loadTerrain();
+    buildEmitters();
+    startDomains();
+    worldReserve(g_maxCubes);
+    threadPoolInit(g_threadCount);
+    if (g_recordPath != NULL) {
+        openRecording(g_recordPath);
+    }
+
+    if (g_headless) {
+        runHeadless();
+    } else {
+#ifndef FENDERZ_HEADLESS_ONLY
+        runWindowed();
+#endif
+    }
+
+    return 0;
+}
+
+static double monotonicSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void runHeadless() {
+    const float fixedStep = 1.0f / PHYSICS_HZ;
+    long maxSteps = g_headlessSteps;
+    double maxSeconds = g_headlessSeconds;
+    if (maxSteps <= 0 && maxSeconds <= 0.0) {
+        maxSteps = (long)(RESET_INTERVAL_SECONDS * PHYSICS_HZ);
+    }
+
+    resetCubes();
+
+    long steps = 0;
+    double start = monotonicSeconds();
+    double elapsed = 0.0;
+    while (maxSteps <= 0 || steps < maxSteps) {
+        updatePhysics(fixedStep);
+        steps++;
+        if (maxSeconds > 0.0 && (steps & 15) == 0) {
+            elapsed = monotonicSeconds() - start;
+            if (elapsed >= maxSeconds) break;
+        }
+    }
+    elapsed = monotonicSeconds() - start;
+
+    double stepsPerSecond = elapsed > 0.0 ? (double)steps / elapsed : 0.0;
+    if (g_domains.count > 1) {
+        reportDomains(stepsPerSecond);
+        if (g_domains.rank > 0) {
+            shutdownSimulation();
+            return;
+        }
+    }
+    printf("Headless: %d cubes, %s broadphase, %d threads, %ld steps in %.3f s (%.1f simulated s)\n",
+           g_world.count, BROADPHASE_NAMES[g_broadphase], g_threadPool.threadCount, steps, elapsed, (double)steps * fixedStep);
+    printf("Awake at end: %d of %d\n", g_world.awakeCount, g_world.count);
+    if (g_respawnRate > 0.0f) {
+        printf("Respawned: %u cubes, %d queue entries\n", g_respawnQueue.respawnTotal, g_respawnQueue.count);
+    }
+    if (g_emitters.count > 0 || g_pool.despawnedTotal > 0) {
+        printf("Pool: %d of %d live, %lld spawned, %lld despawned, %lld dropped at capacity\n", g_world.count,
+               g_pool.capacity, g_pool.spawnedTotal, g_pool.despawnedTotal, g_pool.droppedTotal);
+    }
+    if (g_world.shapeStart[SHAPE_BOX + 1] < g_world.count) {
+        const int* start = g_world.shapeStart;
+        printf("Shapes: %d boxes, %d spheres, %d capsules\n", start[SHAPE_BOX + 1] - start[SHAPE_BOX],
+               start[SHAPE_SPHERE + 1] - start[SHAPE_SPHERE], start[SHAPE_CAPSULE + 1] - start[SHAPE_CAPSULE]);
+    }
+    if (g_periodicResets > 0) {
+        long long since = atomic_load_explicit(&g_allocationCount, memory_order_relaxed) - g_allocationsAtFirstReset;
+        printf("Resets: %d periodic with %lld allocations, %lld more in the steps since the first\n", g_periodicResets,
+               g_resetAllocations, since - g_resetAllocations);
+    }
+    printf("CCD: %lld fast body-steps, %lld clamped to time of impact\n", g_ccd.fastTotal, g_ccd.clampedTotal);
+    printf("Substeps: %lld total, peak %d, split %lld steps for speed and %lld for contacts, ending at %d (%s)\n",
+           g_substeps.substepTotal, g_substeps.peak, g_substeps.splitSteps[SUBSTEP_REASON_SPEED],
+           g_substeps.splitSteps[SUBSTEP_REASON_CONTACTS], g_substeps.count, SUBSTEP_REASON_NAMES[g_substeps.reason]);
+    printf("Seed: %u, state checksum: %016llx\n", g_seed, (unsigned long long)worldChecksum());
+    printf("Steps/sec: %.1f\n", stepsPerSecond);
+    printf("Cube-steps/sec: %.4g\n", stepsPerSecond * g_world.count);
+
+    bool diverged = false;
+    if (g_replayPath != NULL) {
+        Replay* replay = &g_replay;
+        if (replay->divergedStep >= 0) {
+            printf("Replay diverged at step %ld: expected %016llx, got %016llx\n", replay->divergedStep,
+                   (unsigned long long)replay->expected, (unsigned long long)replay->actual);
+            diverged = true;
+        } else {
+            printf("Replay matched %d checkpoints\n", replay->next);
+        }
+    }
+
+    shutdownSimulation();
+    if (diverged) exit(1);
+}
 
-    srand(time(NULL));
+#ifndef FENDERZ_HEADLESS_ONLY
+void runWindowed() {
+    bool bQuit = false;
 
     initX11OpenGL();
 
@@ -160,7 +1319,29 @@ int main(int argc, char** argv) {
                           (float)(currentTime_tv.tv_usec - lastFrameTime_tv.tv_usec) / 1000000.0f;
         lastFrameTime_tv = currentTime_tv;
 
-        updatePhysics(deltaTime);
+        /* Deterministic runs advance exactly one step per frame, independent of timing. */
+        const float fixedStep = 1.0f / PHYSICS_HZ;
+        physicsAccumulator += g_deterministic ? fixedStep : deltaTime;
+        int steps = 0;
+        while (physicsAccumulator >= fixedStep && steps < MAX_STEPS_PER_FRAME) {
+            physicsAccumulator -= fixedStep;
+            steps++;
+        }
+        if (physicsAccumulator >= fixedStep) {
+            physicsAccumulator = fmodf(physicsAccumulator, fixedStep);
+        }
+        /* The frame's alpha is known before its steps run, so the last one
+         * prepares the render matrices as a node of its own step graph. */
+        float alpha = physicsAccumulator / fixedStep;
+        reserveRenderMatrices();
+        for (int step = 0; step < steps; ++step) {
+            if (step == steps - 1) {
+                g_stepFollowUp.kernel = prepareRenderMatrices;
+                g_stepFollowUp.context = &alpha;
+                g_stepFollowUp.itemCount = &g_world.count;
+            }
+            updatePhysics(fixedStep);
+        }
 
         frameCount++;
         fpsTimer += deltaTime;
@@ -173,15 +1354,222 @@ int main(int argc, char** argv) {
             fpsTimer = 0.0f;
         }
 
-        display();
+        display(alpha, steps > 0);
         glXSwapBuffers(g_display, g_window);
     }
 
     destroyX11OpenGL();
+}
+#endif
 
-    return 0;
+static long parseIntArg(const char* text, const char* source, long min, long max) {
+    char* end = NULL;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, "Error: Invalid value '%s' for %s (expected %ld..%ld).\n", text, source, min, max);
+        exit(1);
+    }
+    return value;
+}
+
+static double parseFloatArg(const char* text, const char* source, double min, double max) {
+    char* end = NULL;
+    double value = strtod(text, &end);
+    if (end == text || *end != '\0' || !(value >= min && value <= max)) {
+        fprintf(stderr, "Error: Invalid value '%s' for %s (expected %g..%g).\n", text, source, min, max);
+        exit(1);
+    }
+    return value;
+}
+
+static int parseEnumArg(const char* text, const char* source, const char* const* names, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(text, names[i]) == 0) return i;
+    }
+    fprintf(stderr, "Error: Invalid value '%s' for %s (expected", text, source);
+    for (int i = 0; i < count; ++i) {
+        fprintf(stderr, "%s%s", i > 0 ? ", " : " ", names[i]);
+    }
+    fprintf(stderr, ").\n");
+    exit(1);
 }
 
+static const char* optionValue(int argc, char** argv, int* i, const char* name) {
+    size_t len = strlen(name);
+    if (strncmp(argv[*i], name, len) != 0) return NULL;
+    if (argv[*i][len] == '=') return argv[*i] + len + 1;
+    if (argv[*i][len] == '\0' && *i + 1 < argc) return argv[++*i];
+    return NULL;
+}
+
+static void parseTerrainSize(const char* text, const char* source) {
+    int width = 0, depth = 0;
+    char trailing;
+    int fields = sscanf(text, "%dx%d%c", &width, &depth, &trailing);
+    if (fields == 1) depth = width;
+    if ((fields != 1 && fields != 2) || width < 2 || depth < 2 || width > 65536 || depth > 65536) {
+        fprintf(stderr, "Error: Invalid value '%s' for %s (expected N or WxH, 2..65536).\n", text, source);
+        exit(1);
+    }
+    g_terrain.width = width;
+    g_terrain.depth = depth;
+}
+
+static void printUsage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --cubes N       number of cubes (default %d, env FENDERZ_CUBES)\n"
+            "  --spheres N     number of spheres (default 0)\n"
+            "  --capsules N    number of capsules (default 0)\n"
+            "  --max-cubes N   pool capacity (default: cubes, plus %d when emitters are set)\n"
+            "  --emit R        emit R cubes per second over the arena\n"
+            "  --emitters F    emitters from file F: emitter [shape] cx cy cz hx hy hz rate [vx vy vz [spread]]\n"
+            "  --lifetime T    despawn cubes T seconds after they spawn, 0 keeps them\n"
+            "  --despawn-resting T  despawn cubes asleep for T seconds, 0 keeps them\n"
+            "  --despawn-bounds W   despawn cubes beyond W in x or z, or W below the ground\n"
+            "  --headless      run the simulation without a window\n"
+            "  --steps N       headless: stop after N physics steps\n"
+            "  --seconds T     headless: stop after T wall-clock seconds\n"
+            "  --broadphase B  pair finder: grid, sap or tree (default grid)\n"
+            "  --size-min S    smallest cube edge length (default 0.5)\n"
+            "  --size-max S    largest cube edge length (default 0.5)\n"
+            "  --iterations N  contact solver iterations (default %d)\n"
+            "  --restitution E bounciness of contacts, 0..1 (default %.2f)\n"
+            "  --friction U    Coulomb friction coefficient (default %.2f)\n"
+            "  --respawn-rate R  recycle up to R of the longest-sleeping cubes per second instead of resetting all\n"
+            "  --ccd K         sweep bodies moving over K half sizes per step, 0 disables (default %.1f)\n"
+            "  --max-substeps N      most substeps one step may split into, 1 disables (default %d)\n"
+            "  --substep-speed V     add a substep per V m/s of peak body speed, 0 ignores speed (default %.0f)\n"
+            "  --substep-contacts N  add a substep per N contact points, 0 ignores contacts (default %d)\n"
+            "  --threads N     physics worker threads (default: online CPUs)\n"
+            "  --domains N     headless: split the arena into N slabs along x, one process each\n"
+            "  --arena W       half width of the walled arena, 0 for no walls (default %.0f)\n"
+            "  --ground Y      height of the ground plane (default %.0f)\n"
+            "  --colliders F   extra static planes and boxes from file F\n"
+            "  --terrain F     heightfield from raw 16-bit little-endian samples in F\n"
+            "  --terrain-size WxH  sample grid of the terrain (default: square from file size)\n"
+            "  --terrain-scale S   terrain width in world units (default: arena width)\n"
+            "  --terrain-height H  height of the largest sample above the ground (default 3)\n"
+            "  --seed N        seed for spawning (default: time, or fixed when deterministic)\n"
+            "  --deterministic fixed seed and one physics step per frame; needs --steps when headless\n"
+            "  --record FILE   write the run configuration and state checksums to FILE\n"
+            "  --replay FILE   re-run a recording headless and verify its checksums\n",
+            program, DEFAULT_NUM_CUBES, DEFAULT_EMITTER_HEADROOM, DEFAULT_SOLVER_ITERATIONS, DEFAULT_RESTITUTION, DEFAULT_FRICTION,
+            DEFAULT_CCD_THRESHOLD, DEFAULT_MAX_SUBSTEPS, DEFAULT_SUBSTEP_SPEED, DEFAULT_SUBSTEP_CONTACTS, DEFAULT_ARENA_HALF_WIDTH, DEFAULT_GROUND_Y);
+}
+
+void parseArguments(int argc, char** argv) {
+    const char* envCubes = getenv("FENDERZ_CUBES");
+    if (envCubes != NULL && *envCubes != '\0') {
+        g_numCubes = (int)parseIntArg(envCubes, "FENDERZ_CUBES", 0, MAX_NUM_CUBES);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        const char* value;
+        if (strcmp(argv[i], "--headless") == 0) {
+            g_headless = true;
+        } else if ((value = optionValue(argc, argv, &i, "--cubes")) != NULL) {
+            g_numCubes = (int)parseIntArg(value, "--cubes", 0, MAX_NUM_CUBES);
+        } else if ((value = optionValue(argc, argv, &i, "--spheres")) != NULL) {
+            g_numSpheres = (int)parseIntArg(value, "--spheres", 0, MAX_NUM_CUBES);
+        } else if ((value = optionValue(argc, argv, &i, "--capsules")) != NULL) {
+            g_numCapsules = (int)parseIntArg(value, "--capsules", 0, MAX_NUM_CUBES);
+        } else if ((value = optionValue(argc, argv, &i, "--max-cubes")) != NULL) {
+            g_maxCubes = (int)parseIntArg(value, "--max-cubes", 1, MAX_NUM_CUBES);
+        } else if ((value = optionValue(argc, argv, &i, "--emitters")) != NULL) {
+            g_emitters.path = value;
+        } else if ((value = optionValue(argc, argv, &i, "--emit")) != NULL) {
+            g_emitters.quickRate = (float)parseFloatArg(value, "--emit", 0.0, 1e7);
+        } else if ((value = optionValue(argc, argv, &i, "--lifetime")) != NULL) {
+            g_despawn.lifetime = (float)parseFloatArg(value, "--lifetime", 0.0, 1e9);
+        } else if ((value = optionValue(argc, argv, &i, "--despawn-resting")) != NULL) {
+            g_despawn.restingTime = (float)parseFloatArg(value, "--despawn-resting", 0.0, 1e9);
+        } else if ((value = optionValue(argc, argv, &i, "--despawn-bounds")) != NULL) {
+            g_despawn.boundsHalfWidth = (float)parseFloatArg(value, "--despawn-bounds", 0.0, 1e9);
+        } else if ((value = optionValue(argc, argv, &i, "--steps")) != NULL) {
+            g_headlessSteps = parseIntArg(value, "--steps", 1, 0x7fffffffL);
+        } else if ((value = optionValue(argc, argv, &i, "--seconds")) != NULL) {
+            g_headlessSeconds = parseFloatArg(value, "--seconds", 0.001, 1e9);
+        } else if ((value = optionValue(argc, argv, &i, "--broadphase")) != NULL) {
+            g_broadphase = (BroadphaseType)parseEnumArg(value, "--broadphase", BROADPHASE_NAMES,
+                                                        sizeof(BROADPHASE_NAMES) / sizeof(BROADPHASE_NAMES[0]));
+        } else if ((value = optionValue(argc, argv, &i, "--size-min")) != NULL) {
+            g_cubeSizeMin = (float)parseFloatArg(value, "--size-min", 0.01, 8.0);
+        } else if ((value = optionValue(argc, argv, &i, "--size-max")) != NULL) {
+            g_cubeSizeMax = (float)parseFloatArg(value, "--size-max", 0.01, 8.0);
+        } else if ((value = optionValue(argc, argv, &i, "--iterations")) != NULL) {
+            g_solverIterations = (int)parseIntArg(value, "--iterations", 1, 256);
+        } else if ((value = optionValue(argc, argv, &i, "--restitution")) != NULL) {
+            g_restitution = (float)parseFloatArg(value, "--restitution", 0.0, 1.0);
+        } else if ((value = optionValue(argc, argv, &i, "--respawn-rate")) != NULL) {
+            g_respawnRate = (float)parseFloatArg(value, "--respawn-rate", 0.0, 1e7);
+        } else if ((value = optionValue(argc, argv, &i, "--max-substeps")) != NULL) {
+            g_substeps.maxSubsteps = (int)parseIntArg(value, "--max-substeps", 1, 64);
+        } else if ((value = optionValue(argc, argv, &i, "--substep-speed")) != NULL) {
+            g_substeps.speedLimit = (float)parseFloatArg(value, "--substep-speed", 0.0, 1e6);
+        } else if ((value = optionValue(argc, argv, &i, "--substep-contacts")) != NULL) {
+            g_substeps.contactLimit = (int)parseIntArg(value, "--substep-contacts", 0, 1 << 30);
+        } else if ((value = optionValue(argc, argv, &i, "--ccd")) != NULL) {
+            g_ccdThreshold = (float)parseFloatArg(value, "--ccd", 0.0, 1e6);
+        } else if ((value = optionValue(argc, argv, &i, "--friction")) != NULL) {
+            g_friction = (float)parseFloatArg(value, "--friction", 0.0, 10.0);
+        } else if ((value = optionValue(argc, argv, &i, "--threads")) != NULL) {
+            g_threadCount = (int)parseIntArg(value, "--threads", 1, MAX_THREADS);
+        } else if ((value = optionValue(argc, argv, &i, "--domains")) != NULL) {
+            g_domains.count = (int)parseIntArg(value, "--domains", 1, MAX_DOMAINS);
+        } else if ((value = optionValue(argc, argv, &i, "--arena")) != NULL) {
+            g_statics.arenaHalfWidth = (float)parseFloatArg(value, "--arena", 0.0, 1e6);
+        } else if ((value = optionValue(argc, argv, &i, "--ground")) != NULL) {
+            g_statics.groundY = (float)parseFloatArg(value, "--ground", -1e6, 1e6);
+        } else if ((value = optionValue(argc, argv, &i, "--colliders")) != NULL) {
+            g_statics.path = value;
+        } else if ((value = optionValue(argc, argv, &i, "--terrain-size")) != NULL) {
+            parseTerrainSize(value, "--terrain-size");
+        } else if ((value = optionValue(argc, argv, &i, "--terrain-scale")) != NULL) {
+            g_terrain.horizontalScale = (float)parseFloatArg(value, "--terrain-scale", 0.01, 1e6);
+        } else if ((value = optionValue(argc, argv, &i, "--terrain-height")) != NULL) {
+            g_terrain.heightScale = (float)parseFloatArg(value, "--terrain-height", 0.0, 1e6);
+        } else if ((value = optionValue(argc, argv, &i, "--terrain")) != NULL) {
+            g_terrain.path = value;
+        } else if ((value = optionValue(argc, argv, &i, "--seed")) != NULL) {
+            g_seed = (uint32_t)parseIntArg(value, "--seed", 0, 0xffffffffL);
+            g_seedSet = true;
+        } else if (strcmp(argv[i], "--deterministic") == 0) {
+            g_deterministic = true;
+        } else if ((value = optionValue(argc, argv, &i, "--record")) != NULL) {
+            g_recordPath = value;
+        } else if ((value = optionValue(argc, argv, &i, "--replay")) != NULL) {
+            g_replayPath = value;
+        } else {
+            printUsage(argv[0]);
+            exit(1);
+        }
+    }
+
+#ifdef FENDERZ_HEADLESS_ONLY
+    g_headless = true;
+#endif
+    if (g_replayPath != NULL) {
+        loadReplay(g_replayPath);
+    }
+    if (!g_seedSet) {
+        g_seed = g_deterministic ? DEFAULT_DETERMINISTIC_SEED : (uint32_t)time(NULL);
+    }
+    if (g_deterministic && g_headless && g_headlessSeconds > 0.0) {
+        fprintf(stderr, "Error: --seconds depends on wall-clock time; use --steps with --deterministic.\n");
+        exit(1);
+    }
+
+    if (g_cubeSizeMax < g_cubeSizeMin) {
+        g_cubeSizeMax = g_cubeSizeMin;
+    }
+    if ((long)g_numCubes + g_numSpheres + g_numCapsules > MAX_NUM_CUBES) {
+        fprintf(stderr, "Error: At most %d bodies are supported.\n", MAX_NUM_CUBES);
+        exit(1);
+    }
+}
+
+#ifndef FENDERZ_HEADLESS_ONLY
 void handleXEvents(XEvent* event, bool* quitFlag) {
     switch (event->type) {
         case Expose:
@@ -363,14 +1751,21 @@ void destroyX11OpenGL() {
             printf("X11 window and OpenGL context destroyed. Mouse cursor unhidden.\n");
         }
     }
-    if (g_cubes != NULL) {
-        free(g_cubes);
-        g_cubes = NULL;
+    shutdownSimulation();
+    for (int e = 0; e < 12; ++e) {
+        free(g_renderMatrices.m[e]);
     }
+    memset(&g_renderMatrices, 0, sizeof(g_renderMatrices));
 
     if (g_cube_texture_id != 0) {
         glDeleteTextures(1, &g_cube_texture_id);
     }
+    if (g_terrainList != 0) {
+        glDeleteLists(g_terrainList, 1);
+    }
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        if (g_shapeLists[s] != 0) glDeleteLists(g_shapeLists[s], 1);
+    }
 }
 
 void loadCubeTexture() {
@@ -426,192 +1821,5305 @@ void initOpenGL() {
     glShadeModel(GL_SMOOTH);
 
     loadCubeTexture();
+    buildTerrainMesh();
+    buildShapeMeshes();
 
     resetCubes();
 }
 
-void resetCubes() {
-    if (g_cubes != NULL) {
-        free(g_cubes);
+#endif
+
+static void* allocAligned(size_t bytes) {
+    size_t rounded = (bytes + SIMD_ALIGNMENT - 1) & ~(size_t)(SIMD_ALIGNMENT - 1);
+    void* p = aligned_alloc(SIMD_ALIGNMENT, rounded > 0 ? rounded : SIMD_ALIGNMENT);
+    atomic_fetch_add_explicit(&g_allocationCount, 1, memory_order_relaxed);
+    if (p == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    memset(p, 0, rounded);
+    return p;
+}
+
+static void growStream(void** stream, size_t elementSize, int oldCapacity, int newCapacity) {
+    void* p = allocAligned(elementSize * (size_t)newCapacity);
+    if (*stream != NULL) {
+        memcpy(p, *stream, elementSize * (size_t)oldCapacity);
+        free(*stream);
     }
-    g_cubes = (Cube*)malloc(sizeof(Cube) * NUM_CUBES);
-    if (g_cubes == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory for cubes.\n");
+    *stream = p;
+}
+
+static void reserveArray(void** array, size_t elementSize, int* capacity, int needed) {
+    if (needed <= *capacity) return;
+    int newCapacity = *capacity > 0 ? *capacity : 1024;
+    while (newCapacity < needed) newCapacity *= 2;
+    void* p = realloc(*array, elementSize * (size_t)newCapacity);
+    atomic_fetch_add_explicit(&g_allocationCount, 1, memory_order_relaxed);
+    if (p == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
         exit(1);
     }
+    *array = p;
+    *capacity = newCapacity;
+}
+
+static void pairListPush(PairList* list, int a, int b) {
+    reserveArray((void**)&list->pairs, sizeof(BodyPair), &list->capacity, list->count + 1);
+    list->pairs[list->count].a = a;
+    list->pairs[list->count].b = b;
+    list->count++;
+}
+
+static inline void pushBodyPair(PairList* list, int a, int b) {
+    if (a < b) pairListPush(list, a, b);
+    else pairListPush(list, b, a);
+}
 
-    for (int i = 0; i < NUM_CUBES; ++i) {
-        Cube* newCube = &g_cubes[i];
-        newCube->size = CUBE_SIZE;
-        newCube->velocity = vec3_create(0.0f, 0.0f, 0.0f);
-        newCube->angularVelocity = vec3_create(0.0f, 0.0f, 0.0f);
-        newCube->rotation = vec3_create(0.0f, 0.0f, 0.0f);
-        newCube->resting = false;
-        newCube->color = vec3_create(rand_float(0.0f, 1.0f), rand_float(0.0f, 1.0f), rand_float(0.0f, 1.0f));
+static ContactManifold* manifoldListPush(ManifoldList* list) {
+    reserveArray((void**)&list->manifolds, sizeof(ContactManifold), &list->capacity, list->count + 1);
+    return &list->manifolds[list->count++];
+}
 
-        float x_offset = (i % 10 - 5.0f) * (CUBE_SIZE * 2.0f);
-        float z_offset = ((i / 10) % 10 - 5.0f) * (CUBE_SIZE * 2.0f);
-        float y_offset = (i / 100) * (CUBE_SIZE * 2.0f) + rand_float(5.0f, 15.0f);
+#define WORLD_FLOAT_STREAMS(w) \
+    &(w)->posX, &(w)->posY, &(w)->posZ, \
+    &(w)->velX, &(w)->velY, &(w)->velZ, \
+    &(w)->angVelX, &(w)->angVelY, &(w)->angVelZ, \
+    &(w)->quatW, &(w)->quatX, &(w)->quatY, &(w)->quatZ, \
+    &(w)->prevPosX, &(w)->prevPosY, &(w)->prevPosZ, \
+    &(w)->prevQuatW, &(w)->prevQuatX, &(w)->prevQuatY, &(w)->prevQuatZ, \
+    &(w)->sweepX, &(w)->sweepY, &(w)->sweepZ, \
+    &(w)->colorR, &(w)->colorG, &(w)->colorB, \
+    &(w)->size, &(w)->invMass, &(w)->invInertiaX, &(w)->invInertiaY, &(w)->invInertiaZ, \
+    &(w)->sleepTimer
+
+void worldReserve(int capacity) {
+    World* w = &g_world;
+    int lanes = SIMD_ALIGNMENT / (int)sizeof(float);
+    capacity = (capacity + lanes - 1) / lanes * lanes;
+    if (capacity <= w->capacity) return;
+
+    /* One spare vector past the end, since a batch's last load may start at any
+     * body rather than on a vector boundary. */
+    float** streams[] = { WORLD_FLOAT_STREAMS(w) };
+    for (size_t s = 0; s < sizeof(streams) / sizeof(streams[0]); ++s) {
+        growStream((void**)streams[s], sizeof(float), w->capacity, capacity + lanes);
+    }
+    growStream((void**)&w->resting, sizeof(uint8_t), w->capacity, capacity);
+    growStream((void**)&w->shape, sizeof(uint8_t), w->capacity, capacity);
+    w->capacity = capacity;
+}
 
-        newCube->position = vec3_create(x_offset, y_offset, z_offset);
+void worldFree() {
+    World* w = &g_world;
+    float** streams[] = { WORLD_FLOAT_STREAMS(w) };
+    for (size_t s = 0; s < sizeof(streams) / sizeof(streams[0]); ++s) {
+        free(*streams[s]);
+        *streams[s] = NULL;
     }
+    free(w->resting);
+    w->resting = NULL;
+    free(w->shape);
+    w->shape = NULL;
+    free(w->awake);
+    w->awake = NULL;
+    w->awakeCount = 0;
+    w->awakeCapacity = 0;
+    w->count = 0;
+    w->capacity = 0;
+}
+
+void resetCubes() {
+    World* w = &g_world;
+    worldReserve(g_maxCubes);
+    w->count = g_numCubes + g_numSpheres + g_numCapsules;
+    w->shapeStart[SHAPE_BOX] = 0;
+    w->shapeStart[SHAPE_SPHERE] = g_numCubes;
+    w->shapeStart[SHAPE_CAPSULE] = g_numCubes + g_numSpheres;
+    w->shapeStart[SHAPE_COUNT] = w->count;
+    bodyPoolReset(w->count);
+    g_spawnSeed = philox4x32(g_seed, 0, g_spawnGeneration++, RNG_STREAM_SPAWN_SEED);
+
+    parallelFor(w->count, spawnCubesRange, NULL);
+    wakeAllBodies();
+    if (g_respawnRate > 0.0f) respawnQueueReserve(&g_respawnQueue, g_maxCubes);
+
     secondTimer = 0.0f;
     secondsCount = 0;
     fpsTimer = 0.0f;
     frameCount = 0;
     resetTimer = 0.0f;
+    invalidateBroadphase();
+    claimDomainBodies();
     if (DEBUG_MODE) {
-        printf("Cubes reset.\n");
+        printf("Cubes reset (%d).\n", w->count);
     }
 }
 
-void updatePhysics(float deltaTime) {
-    secondTimer += deltaTime;
-    if (secondTimer >= 1.0f) {
-        secondsCount++;
-        if (DEBUG_MODE) {
-            printf("Seconds: %d\n", secondsCount);
-        }
-        secondTimer = 0.0f;
+/* Mass from BODY_DENSITY and the principal moments of inertia in the body frame,
+ * where a capsule's segment runs along local y. Stored inverted for the solver. */
+static void computeBodyMass(int i) {
+    World* w = &g_world;
+    const float pi = 3.14159265f;
+    float size = w->size[i];
+    float mass, inertiaXZ, inertiaY;
+    if (w->shape[i] == SHAPE_SPHERE) {
+        float r = size * 0.5f;
+        mass = BODY_DENSITY * (4.0f / 3.0f) * pi * r * r * r;
+        inertiaXZ = inertiaY = 0.4f * mass * r * r;
+    } else if (w->shape[i] == SHAPE_CAPSULE) {
+        /* A cylinder plus two hemispherical caps, each cap's moment shifted by
+         * the parallel axis theorem out to the end of the segment. */
+        float r = size * CAPSULE_RADIUS_SCALE;
+        float h = 2.0f * size * CAPSULE_RADIUS_SCALE;
+        float cylinder = BODY_DENSITY * pi * r * r * h;
+        float caps = BODY_DENSITY * (4.0f / 3.0f) * pi * r * r * r;
+        mass = cylinder + caps;
+        inertiaY = cylinder * r * r * 0.5f + caps * 0.4f * r * r;
+        inertiaXZ = cylinder * (h * h / 12.0f + r * r * 0.25f) +
+                    caps * (0.4f * r * r + h * h * 0.25f + 0.375f * h * r);
+    } else {
+        mass = BODY_DENSITY * size * size * size;
+        inertiaXZ = inertiaY = mass * size * size / 6.0f;
+    }
+    w->invMass[i] = 1.0f / mass;
+    w->invInertiaX[i] = 1.0f / inertiaXZ;
+    w->invInertiaY[i] = 1.0f / inertiaY;
+    w->invInertiaZ[i] = 1.0f / inertiaXZ;
+}
+
+void spawnCubesRange(int begin, int end, int slice, void* context) {
+    const int* shapeStart = g_world.shapeStart;
+    for (int i = begin; i < end; ++i) {
+        g_world.shape[i] = (uint8_t)(i < shapeStart[SHAPE_SPHERE] ? SHAPE_BOX :
+                                     (i < shapeStart[SHAPE_CAPSULE] ? SHAPE_SPHERE : SHAPE_CAPSULE));
     }
+    spawnCubes(begin, end, 0);
+}
 
-    resetTimer += deltaTime;
-    if (resetTimer >= RESET_INTERVAL_SECONDS) {
-        if (DEBUG_MODE) {
-            printf("Resetting cubes due to timer.\n");
+/* step selects fresh random draws for bodies that are respawned individually;
+ * a full reset uses step 0. Bodies keep the shape already stored for them; boxes
+ * start axis aligned and spheres and capsules at a random orientation. */
+void spawnCubes(int begin, int end, uint32_t step) {
+    World* w = &g_world;
+    float spacing = fmaxf(CUBE_SIZE, g_cubeSizeMax) * 2.0f;
+    float spawnWidth = g_statics.arenaHalfWidth > 0.0f ? g_statics.arenaHalfWidth : DEFAULT_ARENA_HALF_WIDTH;
+    int maxSide = (int)(2.0f * spawnWidth / spacing);
+    int side = (int)ceilf(sqrtf((float)w->count));
+    if (side > maxSide) side = maxSide;
+    if (side < 1) side = 1;
+    int perLayer = side * side;
+
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_SIZE, begin, end, g_cubeSizeMin, g_cubeSizeMax, w->size + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_COLOR_R, begin, end, 0.0f, 1.0f, w->colorR + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_COLOR_G, begin, end, 0.0f, 1.0f, w->colorG + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_COLOR_B, begin, end, 0.0f, 1.0f, w->colorB + begin);
+    float floorY = g_terrain.heights != NULL ? fmaxf(g_statics.groundY, g_terrain.maxY) : g_statics.groundY;
+    float dropBase = floorY - DEFAULT_GROUND_Y;
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_DROP_HEIGHT, begin, end, -0.5f, 0.5f, w->posY + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_SPAWN_X, begin, end, -0.5f, 0.5f, w->posX + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_SPAWN_Z, begin, end, -0.5f, 0.5f, w->posZ + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_ORIENT_W, begin, end, -1.0f, 1.0f, w->quatW + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_ORIENT_X, begin, end, -1.0f, 1.0f, w->quatX + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_ORIENT_Y, begin, end, -1.0f, 1.0f, w->quatY + begin);
+    random_float_batch(g_spawnSeed, step, RNG_STREAM_ORIENT_Z, begin, end, -1.0f, 1.0f, w->quatZ + begin);
+
+    for (int i = begin; i < end; ++i) {
+        w->velX[i] = w->velY[i] = w->velZ[i] = 0.0f;
+        w->angVelX[i] = w->angVelY[i] = w->angVelZ[i] = 0.0f;
+        float lengthSq = w->quatW[i] * w->quatW[i] + w->quatX[i] * w->quatX[i] +
+                         w->quatY[i] * w->quatY[i] + w->quatZ[i] * w->quatZ[i];
+        if (w->shape[i] == SHAPE_BOX || lengthSq < 1e-6f) {
+            w->quatW[i] = 1.0f;
+            w->quatX[i] = w->quatY[i] = w->quatZ[i] = 0.0f;
+        } else {
+            float invLength = 1.0f / sqrtf(lengthSq);
+            w->quatW[i] *= invLength;
+            w->quatX[i] *= invLength;
+            w->quatY[i] *= invLength;
+            w->quatZ[i] *= invLength;
         }
-        resetCubes();
+        w->resting[i] = 0;
+        w->sleepTimer[i] = 0.0f;
+        computeBodyMass(i);
+
+        int slot = i % perLayer;
+        int layer = i / perLayer;
+        /* Each body is jittered around its grid point by at most the room its
+         * bounding sphere leaves in a spacing-wide cell, so neighbours in a
+         * layer or a column never spawn overlapping. */
+        float jitter = spacing - 2.0f * BOUNDING_EXTENT_SCALE * w->size[i];
+        w->posX[i] = (slot % side - side * 0.5f) * spacing + w->posX[i] * jitter;
+        w->posZ[i] = (slot / side - side * 0.5f) * spacing + w->posZ[i] * jitter;
+        w->posY[i] = dropBase + 5.0f + layer * spacing + w->posY[i] * jitter;
+
+        w->prevPosX[i] = w->sweepX[i] = w->posX[i];
+        w->prevPosY[i] = w->sweepY[i] = w->posY[i];
+        w->prevPosZ[i] = w->sweepZ[i] = w->posZ[i];
+        w->prevQuatW[i] = w->quatW[i];
+        w->prevQuatX[i] = w->quatX[i];
+        w->prevQuatY[i] = w->quatY[i];
+        w->prevQuatZ[i] = w->quatZ[i];
     }
+}
 
-    rotateY += AUTO_ROTATE_SPEED_Y * deltaTime;
-    rotateY = fmodf(rotateY, 360.0f);
+/* Splits itemCount into cache-line aligned ranges, one per task slice. Small
+ * phases use fewer slices so that a slice always carries PARALLEL_GRAIN items. */
+static void parallelSlice(int itemCount, int slice, int sliceCount, int* begin, int* end) {
+    const int lineItems = SIMD_ALIGNMENT / (int)sizeof(float);
+    int used = itemCount / PARALLEL_GRAIN;
+    if (used < 1) used = 1;
+    if (used > sliceCount) used = sliceCount;
+    long lines = (itemCount + lineItems - 1) / lineItems;
+    *begin = slice < used ? (int)(lines * slice / used) * lineItems : itemCount;
+    *end = slice < used ? (int)(lines * (slice + 1) / used) * lineItems : itemCount;
+    if (*end > itemCount) *end = itemCount;
+    if (*begin > itemCount) *begin = itemCount;
+}
 
-    for (int i = 0; i < NUM_CUBES; ++i) {
-        Cube* cube = &g_cubes[i];
+/* Chase-Lev work-stealing deque: the owning worker pushes and pops at the bottom,
+ * thieves take from the top. Capacity is fixed for the duration of a graph run. */
+static bool dequePush(WorkDeque* d, int task) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t >= d->capacity) return false;
+    atomic_store_explicit(&d->buffer[b & (d->capacity - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
 
-        cube->velocity.y -= GRAVITY * deltaTime;
+static int dequePop(WorkDeque* d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return -1;
+    }
+    int task = atomic_load_explicit(&d->buffer[b & (d->capacity - 1)], memory_order_relaxed);
+    if (t == b) {
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            task = -1;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
 
-        cube->position.x += cube->velocity.x * deltaTime;
-        cube->position.y += cube->velocity.y * deltaTime;
-        cube->position.z += cube->velocity.z * deltaTime;
+static int dequeSteal(WorkDeque* d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) return -1;
+    int task = atomic_load_explicit(&d->buffer[t & (d->capacity - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+    return task;
+}
 
-        cube->rotation.x += cube->angularVelocity.x * deltaTime;
-        cube->rotation.y += cube->angularVelocity.y * deltaTime;
-        cube->rotation.z += cube->angularVelocity.z * deltaTime;
+static void dequeReserve(WorkDeque* d, int tasks) {
+    if (d->capacity >= tasks) return;
+    long capacity = d->capacity > 0 ? d->capacity : 256;
+    while (capacity < tasks) capacity *= 2;
+    free(d->buffer);
+    d->buffer = (_Atomic int*)allocAligned(sizeof(int) * (size_t)capacity);
+    d->capacity = capacity;
+}
 
-        cube->rotation.x = fmodf(cube->rotation.x, 360.0f);
-        cube->rotation.y = fmodf(cube->rotation.y, 360.0f);
-        cube->rotation.z = fmodf(cube->rotation.z, 360.0f);
+void taskGraphReset(TaskGraph* graph) {
+    graph->count = 0;
+    graph->edgeCount = 0;
+}
 
-        float halfSize = cube->size / 2.0f;
-        float cube_bottom = cube->position.y - halfSize;
+static int taskPush(TaskGraph* graph, ParallelKernel kernel, void* context, const int* itemCount, int slice) {
+    reserveArray((void**)&graph->tasks, sizeof(Task), &graph->capacity, graph->count + 1);
+    int id = graph->count++;
+    Task* task = &graph->tasks[id];
+    task->kernel = kernel;
+    task->context = context;
+    task->itemCount = itemCount;
+    task->slice = slice;
+    task->rangeFirst = -1;
+    task->dependencies = 0;
+    task->firstEdge = -1;
+    return id;
+}
 
-        if (cube_bottom < GROUND_Y) {
-            cube->position.y = GROUND_Y + halfSize;
+static void taskEdge(TaskGraph* graph, int before, int after) {
+    reserveArray((void**)&graph->edgeTarget, sizeof(int), &graph->edgeTargetCapacity, graph->edgeCount + 1);
+    reserveArray((void**)&graph->edgeNext, sizeof(int), &graph->edgeCapacity, graph->edgeCount + 1);
+    int edge = graph->edgeCount++;
+    graph->edgeTarget[edge] = after;
+    graph->edgeNext[edge] = graph->tasks[before].firstEdge;
+    graph->tasks[before].firstEdge = edge;
+    graph->tasks[after].dependencies++;
+}
 
-            Vec3 normal = vec3_create(0.0f, 1.0f, 0.0f);
-            Vec3 random_perturb = vec3_create(rand_float(-0.5f, 0.5f), 0.0f, rand_float(-0.5f, 0.5f));
-            Vec3 bounce_direction = vec3_normalize(vec3_add(normal, random_perturb));
+int taskAdd(TaskGraph* graph, ParallelKernel kernel, void* context) {
+    return taskPush(graph, kernel, context, NULL, 0);
+}
 
-            float normal_speed = vec3_dot(cube->velocity, normal);
-            Vec3 new_normal_velocity = vec3_mul_scalar(bounce_direction, (-normal_speed * BOUNCE_FACTOR));
+/* Adds one task per slice over [0, *itemCount) plus a join task, whose id is the
+ * handle for the whole range. The count is read when the slices run, so it may be
+ * produced by an earlier task in the same graph. */
+int taskAddRange(TaskGraph* graph, ParallelKernel kernel, void* context, const int* itemCount) {
+    int sliceCount = g_threadPool.sliceCount;
+    int first = graph->count;
+    for (int slice = 0; slice < sliceCount; ++slice) {
+        taskPush(graph, kernel, context, itemCount, slice);
+    }
+    int join = taskPush(graph, NULL, NULL, NULL, 0);
+    graph->tasks[join].rangeFirst = first;
+    for (int slice = 0; slice < sliceCount; ++slice) {
+        taskEdge(graph, first + slice, join);
+    }
+    return join;
+}
 
-            Vec3 tangential_velocity = vec3_sub(cube->velocity, vec3_mul_scalar(normal, normal_speed));
-            tangential_velocity = vec3_mul_scalar(tangential_velocity, FRICTION_FACTOR);
+void taskDepend(TaskGraph* graph, int before, int after) {
+    int first = graph->tasks[after].rangeFirst;
+    if (first < 0) {
+        taskEdge(graph, before, after);
+        return;
+    }
+    for (int task = first; task < after; ++task) {
+        taskEdge(graph, before, task);
+    }
+}
 
-            cube->velocity = vec3_add(new_normal_velocity, tangential_velocity);
+static void taskExecute(TaskGraph* graph, int id, int worker) {
+    Task* task = &graph->tasks[id];
+    if (task->kernel != NULL) {
+        if (task->itemCount != NULL) {
+            int begin, end;
+            parallelSlice(*task->itemCount, task->slice, g_threadPool.sliceCount, &begin, &end);
+            if (begin < end) task->kernel(begin, end, task->slice, task->context);
+        } else {
+            task->kernel(0, 1, 0, task->context);
+        }
+    }
 
-            if (fabsf(normal_speed) > REST_THRESHOLD) {
-                cube->angularVelocity = vec3_create(rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f));
-            }
+    WorkDeque* own = &g_threadPool.deques[worker];
+    for (int edge = task->firstEdge; edge != -1; edge = graph->edgeNext[edge]) {
+        int next = graph->edgeTarget[edge];
+        if (atomic_fetch_sub_explicit(&graph->tasks[next].unresolved, 1, memory_order_acq_rel) == 1) {
+            if (!dequePush(own, next)) taskExecute(graph, next, worker);
         }
+    }
+    atomic_fetch_sub_explicit(&graph->remaining, 1, memory_order_release);
+}
 
-        float bound = 8.0f;
-        if (cube->position.x - halfSize < -bound) {
-            cube->position.x = -bound + halfSize;
-            Vec3 normal = vec3_create(1.0f, 0.0f, 0.0f);
-            Vec3 random_perturb = vec3_create(0.0f, rand_float(-0.5f, 0.5f), rand_float(-0.5f, 0.5f));
-            Vec3 bounce_direction = vec3_normalize(vec3_add(normal, random_perturb));
+static void taskGraphWork(TaskGraph* graph, int worker) {
+    ThreadPool* pool = &g_threadPool;
+    WorkDeque* own = &pool->deques[worker];
+    int idle = 0;
+
+    while (atomic_load_explicit(&graph->remaining, memory_order_acquire) > 0) {
+        int task = dequePop(own);
+        if (task < 0 && pool->threadCount > 1) {
+            own->stealSeed = hash_u32(own->stealSeed + 1u);
+            int victim = (int)(own->stealSeed % (uint32_t)pool->threadCount);
+            if (victim != worker) task = dequeSteal(&pool->deques[victim]);
+        }
+        if (task >= 0) {
+            taskExecute(graph, task, worker);
+            idle = 0;
+        } else if (++idle > 64) {
+            sched_yield();
+        }
+    }
+}
 
-            float normal_speed = vec3_dot(cube->velocity, normal);
-            Vec3 new_normal_velocity = vec3_mul_scalar(bounce_direction, (-normal_speed * BOUNCE_FACTOR));
-            Vec3 tangential_velocity = vec3_sub(cube->velocity, vec3_mul_scalar(normal, normal_speed));
-            tangential_velocity = vec3_mul_scalar(tangential_velocity, FRICTION_FACTOR);
-            cube->velocity = vec3_add(new_normal_velocity, tangential_velocity);
+static void* threadPoolWorker(void* argument) {
+    ThreadPool* pool = &g_threadPool;
+    int worker = (int)(intptr_t)argument;
+    unsigned seen = 0;
 
-            if (fabsf(normal_speed) > REST_THRESHOLD) {
-                cube->angularVelocity = vec3_create(rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f));
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        TaskGraph* graph = pool->graph;
+        pthread_mutex_unlock(&pool->lock);
+
+        taskGraphWork(graph, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->finished);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* Runs every task of the graph respecting its dependencies. The calling thread is
+ * worker 0; the call returns once all tasks are done and every worker is idle. */
+void taskGraphRun(TaskGraph* graph) {
+    ThreadPool* pool = &g_threadPool;
+    if (graph->count == 0) return;
+
+    for (int t = 0; t < pool->threadCount; ++t) {
+        dequeReserve(&pool->deques[t], graph->count);
+    }
+    for (int id = 0; id < graph->count; ++id) {
+        atomic_store_explicit(&graph->tasks[id].unresolved, graph->tasks[id].dependencies, memory_order_relaxed);
+    }
+    atomic_store_explicit(&graph->remaining, graph->count, memory_order_relaxed);
+    for (int id = graph->count - 1; id >= 0; --id) {
+        if (graph->tasks[id].dependencies == 0) dequePush(&pool->deques[0], id);
+    }
+
+    if (pool->threadCount == 1) {
+        taskGraphWork(graph, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->graph = graph;
+    pool->pending = pool->threadCount - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    taskGraphWork(graph, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadPoolInit(int threadCount) {
+    ThreadPool* pool = &g_threadPool;
+    if (threadCount <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = online > 0 ? (int)online : 1;
+    }
+    if (threadCount > MAX_THREADS) threadCount = MAX_THREADS;
+
+    pool->threadCount = threadCount;
+    pool->sliceCount = threadCount > 1 ? threadCount * TASK_SLICES_PER_THREAD : 1;
+    pool->staticManifolds = (ManifoldList*)calloc((size_t)pool->sliceCount, sizeof(ManifoldList));
+    pool->pairManifolds = (ManifoldList*)calloc((size_t)pool->sliceCount, sizeof(ManifoldList));
+    pool->maxSpeedSq = (float*)calloc((size_t)pool->sliceCount, sizeof(float));
+    pool->deques = (WorkDeque*)calloc((size_t)threadCount, sizeof(WorkDeque));
+    pool->threads = (pthread_t*)calloc((size_t)threadCount, sizeof(pthread_t));
+    if (pool->staticManifolds == NULL || pool->pairManifolds == NULL || pool->maxSpeedSq == NULL || pool->deques == NULL || pool->threads == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    for (int t = 0; t < threadCount; ++t) {
+        pool->deques[t].stealSeed = (uint32_t)t * 0x9e3779b9u;
+    }
+
+    for (int t = 1; t < threadCount; ++t) {
+        if (pthread_create(&pool->threads[t], NULL, threadPoolWorker, (void*)(intptr_t)t) != 0) {
+            fprintf(stderr, "Error: Could not start physics worker thread.\n");
+            exit(1);
+        }
+    }
+}
+
+static void taskGraphFree(TaskGraph* graph) {
+    free(graph->tasks);
+    free(graph->edgeTarget);
+    free(graph->edgeNext);
+    memset(graph, 0, sizeof(*graph));
+}
+
+void threadPoolShutdown() {
+    ThreadPool* pool = &g_threadPool;
+    if (pool->threads == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 1; t < pool->threadCount; ++t) {
+        pthread_join(pool->threads[t], NULL);
+    }
+
+    for (int s = 0; s < pool->sliceCount; ++s) {
+        free(pool->staticManifolds[s].manifolds);
+        free(pool->pairManifolds[s].manifolds);
+    }
+    for (int t = 0; t < pool->threadCount; ++t) {
+        free(pool->deques[t].buffer);
+    }
+    free(pool->staticManifolds);
+    free(pool->pairManifolds);
+    free(pool->maxSpeedSq);
+    free(pool->deques);
+    free(pool->threads);
+    pool->staticManifolds = NULL;
+    pool->pairManifolds = NULL;
+    pool->maxSpeedSq = NULL;
+    pool->deques = NULL;
+    pool->threads = NULL;
+    pool->threadCount = 1;
+    pool->sliceCount = 1;
+    pool->shutdown = false;
+    taskGraphFree(&g_stepGraph);
+    taskGraphFree(&g_parallelForGraph);
+}
+
+/* Runs kernel over [0, itemCount) as a one-phase graph and returns when it is done.
+ * Must not be called from inside a task. */
+void parallelFor(int itemCount, ParallelKernel kernel, void* context) {
+    if (g_threadPool.threadCount == 1 || itemCount < PARALLEL_GRAIN * 2) {
+        if (itemCount > 0) kernel(0, itemCount, 0, context);
+        return;
+    }
+    taskGraphReset(&g_parallelForGraph);
+    taskAddRange(&g_parallelForGraph, kernel, context, &itemCount);
+    taskGraphRun(&g_parallelForGraph);
+}
+
+static void mergeSliceManifolds(ManifoldList* slices, ManifoldList* out) {
+    for (int s = 0; s < g_threadPool.sliceCount; ++s) {
+        const ManifoldList* local = &slices[s];
+        reserveArray((void**)&out->manifolds, sizeof(ContactManifold), &out->capacity, out->count + local->count);
+        memcpy(out->manifolds + out->count, local->manifolds, sizeof(ContactManifold) * (size_t)local->count);
+        out->count += local->count;
+    }
+}
+
+/* Picks the substep count for the coming step from what the last one measured. */
+static int chooseSubsteps() {
+    SubstepControl* control = &g_substeps;
+    int bySpeed = 1, byContacts = 1;
+    if (control->speedLimit > 0.0f) bySpeed = (int)ceilf(control->maxSpeed / control->speedLimit);
+    if (control->contactLimit > 0) byContacts = (control->contactCount + control->contactLimit - 1) / control->contactLimit;
+    int desired = bySpeed > byContacts ? bySpeed : byContacts;
+    if (desired < 1) desired = 1;
+    if (desired > control->maxSubsteps) desired = control->maxSubsteps;
+
+    int previous = control->count;
+    if (desired >= control->count) {
+        control->count = desired;
+        control->calmSteps = 0;
+    } else if (++control->calmSteps >= SUBSTEP_MERGE_STEPS) {
+        control->count--;
+        control->calmSteps = 0;
+    }
+    if (desired > 1) {
+        control->reason = bySpeed >= byContacts ? SUBSTEP_REASON_SPEED : SUBSTEP_REASON_CONTACTS;
+    } else if (control->count == 1) {
+        control->reason = SUBSTEP_REASON_NONE;
+    }
+    if (DEBUG_MODE && control->count != previous) {
+        printf("Substeps: %d -> %d (%s).\n", previous, control->count, SUBSTEP_REASON_NAMES[control->reason]);
+    }
+    return control->count;
+}
+
+/* Static contacts run one kernel per shape, so the awake list is partitioned by
+ * shape before each step. With every body awake the list is not used and the
+ * dense shape batches are the groups. */
+static void groupAwakeByShape() {
+    World* w = &g_world;
+    if (w->awakeCount == w->count) {
+        for (int s = 0; s <= SHAPE_COUNT; ++s) {
+            w->awakeShapeStart[s] = w->shapeStart[s];
+        }
+        return;
+    }
+    int boxEnd = 0, next = 0, capsuleStart = w->awakeCount;
+    while (next < capsuleStart) {
+        int body = w->awake[next];
+        if (w->shape[body] == SHAPE_BOX) {
+            w->awake[next++] = w->awake[boxEnd];
+            w->awake[boxEnd++] = body;
+        } else if (w->shape[body] == SHAPE_SPHERE) {
+            next++;
+        } else {
+            w->awake[next] = w->awake[--capsuleStart];
+            w->awake[capsuleStart] = body;
+        }
+    }
+    w->awakeShapeStart[SHAPE_BOX] = 0;
+    w->awakeShapeStart[SHAPE_SPHERE] = boxEnd;
+    w->awakeShapeStart[SHAPE_CAPSULE] = capsuleStart;
+    w->awakeShapeStart[SHAPE_COUNT] = w->awakeCount;
+    awakeListPad(w);
+}
+
+void stepPhysics(float deltaTime) {
+    ThreadPool* pool = &g_threadPool;
+    groupAwakeByShape();
+    for (int s = 0; s < pool->sliceCount; ++s) {
+        pool->staticManifolds[s].count = 0;
+        pool->pairManifolds[s].count = 0;
+        pool->maxSpeedSq[s] = 0.0f;
+    }
+
+    /* Boundary contacts only read positions, so they overlap with gravity and the
+     * broadphase; the tree broadphase fattens by velocity and must follow gravity. */
+    TaskGraph* graph = &g_stepGraph;
+    taskGraphReset(graph);
+    int gravity = taskAddRange(graph, integrateVelocitiesRange, &deltaTime, &g_world.awakeCount);
+    int planes = taskAddRange(graph, collectStaticContactsRange, NULL, &g_world.awakeCount);
+    int broadphase = taskAdd(graph, findCollisionPairsTask, &deltaTime);
+    int narrowphase = taskAddRange(graph, generatePairManifoldsRange, NULL, &g_pairs.count);
+    int prepare = taskAdd(graph, prepareContactsTask, &deltaTime);
+    taskDepend(graph, gravity, broadphase);
+    taskDepend(graph, broadphase, narrowphase);
+    taskDepend(graph, gravity, prepare);
+    taskDepend(graph, planes, prepare);
+    taskDepend(graph, narrowphase, prepare);
+    taskGraphRun(graph);
+
+    /* The solver batches depend on the coloring, so they form a second graph. */
+    taskGraphReset(graph);
+    int solved = addSolverTasks(graph, -1);
+    int integrate = taskAddRange(graph, integrateCubesRange, &deltaTime, &g_world.awakeCount);
+    if (solved >= 0) taskDepend(graph, solved, integrate);
+    int moved = integrate;
+    if (g_ccdThreshold > 0.0f) {
+        moved = taskAdd(graph, continuousCollisionTask, &deltaTime);
+        taskDepend(graph, integrate, moved);
+    }
+    /* Caching the impulses needs only the solver and the sleep pass only the
+     * moved bodies, so both run alongside the render follow-up. Bodies put to
+     * sleep keep their step-start pose until the graph is done, so the
+     * follow-up never reads a pose the sleep pass writes. */
+    int store = taskAddRange(graph, storeContactImpulsesRange, NULL, &g_constraints.count);
+    if (solved >= 0) taskDepend(graph, solved, store);
+    int merge = taskAdd(graph, mergeContactImpulsesTask, NULL);
+    taskDepend(graph, store, merge);
+    int islands = taskAdd(graph, updateIslandsAndSleepTask, NULL);
+    taskDepend(graph, moved, islands);
+    StepFollowUp* followUp = &g_stepFollowUp;
+    if (followUp->armed) {
+        int task = taskAddRange(graph, followUp->kernel, followUp->context, followUp->itemCount);
+        taskDepend(graph, moved, task);
+    }
+    taskGraphRun(graph);
+    if (followUp->armed) {
+        followUp->kernel = NULL;
+        followUp->armed = false;
+    }
+    settleSleptBodies();
+}
+
+void updatePhysics(float deltaTime) {
+    secondTimer += deltaTime;
+    if (secondTimer >= 1.0f) {
+        secondsCount++;
+        if (DEBUG_MODE) {
+            printf("Seconds: %d\n", secondsCount);
+        }
+        secondTimer = 0.0f;
+    }
+
+    resetTimer += deltaTime;
+    if (g_respawnRate > 0.0f) {
+        g_respawnQueue.credit += g_respawnRate * deltaTime;
+        int due = (int)g_respawnQueue.credit;
+        g_respawnQueue.credit -= (float)due;
+        recycleRestingBodies(due);
+    } else if (g_emitters.count == 0 && resetTimer >= RESET_INTERVAL_SECONDS) {
+        if (DEBUG_MODE) {
+            printf("Resetting cubes due to timer.\n");
+        }
+        long long allocations = atomic_load_explicit(&g_allocationCount, memory_order_relaxed);
+        if (g_periodicResets++ == 0) g_allocationsAtFirstReset = allocations;
+        resetCubes();
+        g_resetAllocations += atomic_load_explicit(&g_allocationCount, memory_order_relaxed) - allocations;
+    }
+
+    prevRotateY = rotateY;
+    rotateY += AUTO_ROTATE_SPEED_Y * deltaTime;
+    rotateY = fmodf(rotateY, 360.0f);
+
+    applyDespawnRules(deltaTime);
+    runEmitters(deltaTime);
+    exchangeDomainBodies();
+    compactBodies();
+
+    parallelFor(g_world.awakeCount, storeRenderStateRange, NULL);
+
+    SubstepControl* control = &g_substeps;
+    int substeps = chooseSubsteps();
+    float maxSpeedSq = 0.0f;
+    int contactCount = 0;
+    for (int substep = 0; substep < substeps; ++substep) {
+        g_stepFollowUp.armed = g_stepFollowUp.kernel != NULL && substep == substeps - 1;
+        stepPhysics(deltaTime / (float)substeps);
+        for (int s = 0; s < g_threadPool.sliceCount; ++s) {
+            maxSpeedSq = fmaxf(maxSpeedSq, g_threadPool.maxSpeedSq[s]);
+        }
+        if (g_constraints.count > contactCount) contactCount = g_constraints.count;
+    }
+    control->maxSpeed = sqrtf(maxSpeedSq);
+    control->contactCount = contactCount;
+    control->substepTotal += substeps;
+    control->splitSteps[substeps > 1 ? control->reason : SUBSTEP_REASON_NONE]++;
+    if (substeps > control->peak) control->peak = substeps;
+
+    g_stepCount++;
+    replayCheckpoint();
+}
+
+static inline const int* awakeStreamList(const World* w) {
+    return w->awakeCount == w->count ? NULL : w->awake;
+}
+
+static inline int awakeBody(const World* w, const int* list, int k) {
+    return list != NULL ? list[k] : k;
+}
+
+void integrateVelocitiesRange(int begin, int end, int slice, void* context) {
+    World* w = &g_world;
+    const int* list = awakeStreamList(w);
+    const vfloat gravityStep = vf_set1(GRAVITY * *(const float*)context);
+    const vfloat zero = vf_set1(0.0f);
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        /* Massless bodies, such as kinematic ghosts, are left where they are put. */
+        vfloat gravity = vf_select(vf_gt(streamLoad(w->invMass, list, base), zero), gravityStep, zero);
+        streamStore(w->velY, list, base, vf_sub(streamLoad(w->velY, list, base), gravity));
+    }
+}
+
+/* Bounding-extent tests of one batch against every static box's world AABB and
+ * the terrain's bounds; returns the lanes that hit anything. */
+static unsigned staticBoundsBits(vfloat px, vfloat py, vfloat pz, vfloat reach, unsigned laneMask,
+                                 unsigned* boxBits, unsigned* terrainBits) {
+    const StaticColliders* statics = &g_statics;
+    const Heightfield* terrain = &g_terrain;
+    unsigned anyHit = 0;
+    for (int k = 0; k < statics->boxCount; ++k) {
+        const Obb* box = &statics->boxes[k];
+        const Vec3* halfExtent = &statics->boxHalfExtent[k];
+        vmask near = vf_lt(vf_abs(vf_sub(px, vf_set1(box->center.x))), vf_add(reach, vf_set1(halfExtent->x)));
+        near = vm_and(near, vf_lt(vf_abs(vf_sub(py, vf_set1(box->center.y))), vf_add(reach, vf_set1(halfExtent->y))));
+        near = vm_and(near, vf_lt(vf_abs(vf_sub(pz, vf_set1(box->center.z))), vf_add(reach, vf_set1(halfExtent->z))));
+        boxBits[k] = vm_bits(near) & laneMask;
+        anyHit |= boxBits[k];
+    }
+
+    *terrainBits = 0;
+    if (terrain->heights != NULL) {
+        vfloat maxX = vf_set1(terrain->originX + terrain->cellSize * (float)(terrain->width - 1));
+        vfloat maxZ = vf_set1(terrain->originZ + terrain->cellSize * (float)(terrain->depth - 1));
+        vmask over = vf_lt(vf_sub(py, reach), vf_set1(terrain->maxY));
+        over = vm_and(over, vf_gt(vf_add(px, reach), vf_set1(terrain->originX)));
+        over = vm_and(over, vf_lt(vf_sub(px, reach), maxX));
+        over = vm_and(over, vf_gt(vf_add(pz, reach), vf_set1(terrain->originZ)));
+        over = vm_and(over, vf_lt(vf_sub(pz, reach), maxZ));
+        *terrainBits = vm_bits(over) & laneMask;
+        anyHit |= *terrainBits;
+    }
+    return anyHit;
+}
+
+/* Exact OBB-vs-plane test for a whole batch: the box support distance along each
+ * plane normal is computed from the quaternion with no branches, and only lanes
+ * that actually penetrate fall through to manifold generation. Static boxes get
+ * a bounding-extent test against their world AABB in the same pass. */
+static void collectBoxStaticContacts(int begin, int end, ManifoldList* out) {
+    World* w = &g_world;
+    const StaticColliders* statics = &g_statics;
+    const int* list = awakeStreamList(w);
+    const vfloat zero = vf_set1(0.0f);
+    const vfloat one = vf_set1(1.0f);
+    const vfloat two = vf_set1(2.0f);
+    const vfloat half = vf_set1(0.5f);
+    const vfloat boundingScale = vf_set1(SHAPE_BOUNDING_SCALE[SHAPE_BOX]);
+    unsigned planeBits[MAX_STATIC_PLANES];
+    unsigned boxBits[MAX_STATIC_BOXES];
+
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        vfloat px = streamLoad(w->posX, list, base);
+        vfloat py = streamLoad(w->posY, list, base);
+        vfloat pz = streamLoad(w->posZ, list, base);
+        vfloat size = streamLoad(w->size, list, base);
+        vfloat qw = streamLoad(w->quatW, list, base);
+        vfloat qx = streamLoad(w->quatX, list, base);
+        vfloat qy = streamLoad(w->quatY, list, base);
+        vfloat qz = streamLoad(w->quatZ, list, base);
+
+        vfloat xx = vf_mul(qx, qx), yy = vf_mul(qy, qy), zz = vf_mul(qz, qz);
+        vfloat xy = vf_mul(qx, qy), xz = vf_mul(qx, qz), yz = vf_mul(qy, qz);
+        vfloat wx = vf_mul(qw, qx), wy = vf_mul(qw, qy), wz = vf_mul(qw, qz);
+        vfloat r00 = vf_sub(one, vf_mul(two, vf_add(yy, zz)));
+        vfloat r01 = vf_mul(two, vf_sub(xy, wz));
+        vfloat r02 = vf_mul(two, vf_add(xz, wy));
+        vfloat r10 = vf_mul(two, vf_add(xy, wz));
+        vfloat r11 = vf_sub(one, vf_mul(two, vf_add(xx, zz)));
+        vfloat r12 = vf_mul(two, vf_sub(yz, wx));
+        vfloat r20 = vf_mul(two, vf_sub(xz, wy));
+        vfloat r21 = vf_mul(two, vf_add(yz, wx));
+        vfloat r22 = vf_sub(one, vf_mul(two, vf_add(xx, yy)));
+        vfloat extent = vf_mul(size, half);
+
+        int lanes = end - base < SIMD_WIDTH ? end - base : SIMD_WIDTH;
+        unsigned laneMask = 0xffffffffu >> (32 - lanes);
+        unsigned anyHit = 0;
+        for (int p = 0; p < statics->planeCount; ++p) {
+            vfloat nx = vf_set1(statics->planeNX[p]);
+            vfloat ny = vf_set1(statics->planeNY[p]);
+            vfloat nz = vf_set1(statics->planeNZ[p]);
+            vfloat d0 = vf_fmadd(nx, r00, vf_fmadd(ny, r10, vf_mul(nz, r20)));
+            vfloat d1 = vf_fmadd(nx, r01, vf_fmadd(ny, r11, vf_mul(nz, r21)));
+            vfloat d2 = vf_fmadd(nx, r02, vf_fmadd(ny, r12, vf_mul(nz, r22)));
+            vfloat radius = vf_mul(extent, vf_add(vf_abs(d0), vf_add(vf_abs(d1), vf_abs(d2))));
+            vfloat distance = vf_fmadd(nx, px, vf_fmadd(ny, py, vf_mul(nz, pz)));
+            distance = vf_sub(vf_sub(distance, vf_set1(statics->planeOffset[p])), radius);
+            planeBits[p] = vm_bits(vf_lt(distance, zero)) & laneMask;
+            anyHit |= planeBits[p];
+        }
+
+        unsigned terrainBits;
+        anyHit |= staticBoundsBits(px, py, pz, vf_mul(size, boundingScale), laneMask, boxBits, &terrainBits);
+
+        while (anyHit) {
+            int lane = __builtin_ctz(anyHit);
+            anyHit &= anyHit - 1;
+            int body = awakeBody(w, list, base + lane);
+            Obb box;
+            computeBodyObb(body, &box);
+            if (terrainBits >> lane & 1u) collideTerrain(body, &box, out);
+            for (int p = 0; p < statics->planeCount; ++p) {
+                if (planeBits[p] >> lane & 1u) collideStaticPlane(body, p, &box, out);
+            }
+            for (int k = 0; k < statics->boxCount; ++k) {
+                if (boxBits[k] >> lane & 1u) collideStaticBox(body, k, &box, out);
+            }
+        }
+    }
+}
+
+/* Spheres and capsules against the planes: the support distance is the radius,
+ * plus the capsule's half segment projected on the normal. Inlined once per
+ * shape, so the sphere batch never touches the quaternion streams. */
+static inline void collectRoundStaticContacts(int begin, int end, ShapeType shape, ManifoldList* out) {
+    World* w = &g_world;
+    const StaticColliders* statics = &g_statics;
+    const int* list = awakeStreamList(w);
+    const vfloat zero = vf_set1(0.0f);
+    const vfloat one = vf_set1(1.0f);
+    const vfloat two = vf_set1(2.0f);
+    const vfloat boundingScale = vf_set1(SHAPE_BOUNDING_SCALE[shape]);
+    unsigned planeBits[MAX_STATIC_PLANES];
+    unsigned boxBits[MAX_STATIC_BOXES];
+
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        vfloat px = streamLoad(w->posX, list, base);
+        vfloat py = streamLoad(w->posY, list, base);
+        vfloat pz = streamLoad(w->posZ, list, base);
+        vfloat size = streamLoad(w->size, list, base);
+        vfloat radius = vf_mul(size, vf_set1(0.5f));
+        vfloat segmentHalf = zero, ax = zero, ay = zero, az = zero;
+        if (shape == SHAPE_CAPSULE) {
+            vfloat qw = streamLoad(w->quatW, list, base);
+            vfloat qx = streamLoad(w->quatX, list, base);
+            vfloat qy = streamLoad(w->quatY, list, base);
+            vfloat qz = streamLoad(w->quatZ, list, base);
+            ax = vf_mul(two, vf_sub(vf_mul(qx, qy), vf_mul(qw, qz)));
+            ay = vf_sub(one, vf_mul(two, vf_add(vf_mul(qx, qx), vf_mul(qz, qz))));
+            az = vf_mul(two, vf_add(vf_mul(qy, qz), vf_mul(qw, qx)));
+            radius = vf_mul(size, vf_set1(CAPSULE_RADIUS_SCALE));
+            segmentHalf = radius;
+        }
+
+        int lanes = end - base < SIMD_WIDTH ? end - base : SIMD_WIDTH;
+        unsigned laneMask = 0xffffffffu >> (32 - lanes);
+        unsigned anyHit = 0;
+        for (int p = 0; p < statics->planeCount; ++p) {
+            vfloat nx = vf_set1(statics->planeNX[p]);
+            vfloat ny = vf_set1(statics->planeNY[p]);
+            vfloat nz = vf_set1(statics->planeNZ[p]);
+            vfloat support = radius;
+            if (shape == SHAPE_CAPSULE) {
+                vfloat along = vf_fmadd(nx, ax, vf_fmadd(ny, ay, vf_mul(nz, az)));
+                support = vf_fmadd(vf_abs(along), segmentHalf, radius);
+            }
+            vfloat distance = vf_fmadd(nx, px, vf_fmadd(ny, py, vf_mul(nz, pz)));
+            distance = vf_sub(vf_sub(distance, vf_set1(statics->planeOffset[p])), support);
+            planeBits[p] = vm_bits(vf_lt(distance, zero)) & laneMask;
+            anyHit |= planeBits[p];
+        }
+
+        unsigned terrainBits;
+        anyHit |= staticBoundsBits(px, py, pz, vf_mul(size, boundingScale), laneMask, boxBits, &terrainBits);
+
+        while (anyHit) {
+            int lane = __builtin_ctz(anyHit);
+            anyHit &= anyHit - 1;
+            int body = awakeBody(w, list, base + lane);
+            RoundShape round;
+            computeBodyRound(body, &round);
+            if (terrainBits >> lane & 1u) collideRoundTerrain(body, &round, out);
+            for (int p = 0; p < statics->planeCount; ++p) {
+                if (planeBits[p] >> lane & 1u) collideRoundPlane(body, p, &round, out);
+            }
+            for (int k = 0; k < statics->boxCount; ++k) {
+                if (boxBits[k] >> lane & 1u) collideRoundBox(body, k, &round, out);
+            }
+        }
+    }
+}
+
+/* The awake list is grouped by shape, so a slice runs each shape's kernel over
+ * its part of that shape's group. */
+void collectStaticContactsRange(int begin, int end, int slice, void* context) {
+    const int* start = g_world.awakeShapeStart;
+    ManifoldList* out = &g_threadPool.staticManifolds[slice];
+    int lo = begin > start[SHAPE_BOX] ? begin : start[SHAPE_BOX];
+    int hi = end < start[SHAPE_BOX + 1] ? end : start[SHAPE_BOX + 1];
+    if (lo < hi) collectBoxStaticContacts(lo, hi, out);
+    lo = begin > start[SHAPE_SPHERE] ? begin : start[SHAPE_SPHERE];
+    hi = end < start[SHAPE_SPHERE + 1] ? end : start[SHAPE_SPHERE + 1];
+    if (lo < hi) collectRoundStaticContacts(lo, hi, SHAPE_SPHERE, out);
+    lo = begin > start[SHAPE_CAPSULE] ? begin : start[SHAPE_CAPSULE];
+    hi = end < start[SHAPE_CAPSULE + 1] ? end : start[SHAPE_CAPSULE + 1];
+    if (lo < hi) collectRoundStaticContacts(lo, hi, SHAPE_CAPSULE, out);
+}
+
+void findCollisionPairsTask(int begin, int end, int slice, void* context) {
+    findCollisionPairs(&g_pairs, *(const float*)context);
+}
+
+void generatePairManifoldsRange(int begin, int end, int slice, void* context) {
+    collidePairGroups(&g_pairs, begin, end, &g_threadPool.pairManifolds[slice]);
+}
+
+void prepareContactsTask(int begin, int end, int slice, void* context) {
+    g_manifolds.count = 0;
+    mergeSliceManifolds(g_threadPool.staticManifolds, &g_manifolds);
+    mergeSliceManifolds(g_threadPool.pairManifolds, &g_manifolds);
+    wakeTouchedBodies(&g_manifolds);
+    prepareContacts(&g_manifolds, *(const float*)context);
+}
+
+void updateIslandsAndSleepTask(int begin, int end, int slice, void* context) {
+    updateIslandsAndSleep(&g_manifolds);
+}
+
+/* Keeps the awake bodies' pose at the start of the fixed step, which rendering
+ * interpolates from across all of the step's substeps. */
+void storeRenderStateRange(int begin, int end, int slice, void* context) {
+    World* w = &g_world;
+    const int* list = awakeStreamList(w);
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        streamStore(w->prevPosX, list, base, streamLoad(w->posX, list, base));
+        streamStore(w->prevPosY, list, base, streamLoad(w->posY, list, base));
+        streamStore(w->prevPosZ, list, base, streamLoad(w->posZ, list, base));
+        streamStore(w->prevQuatW, list, base, streamLoad(w->quatW, list, base));
+        streamStore(w->prevQuatX, list, base, streamLoad(w->quatX, list, base));
+        streamStore(w->prevQuatY, list, base, streamLoad(w->quatY, list, base));
+        streamStore(w->prevQuatZ, list, base, streamLoad(w->quatZ, list, base));
+    }
+}
+
+/* Orientation integrates as q += dt/2 * (0, w) * q with w in rad/s, followed by
+ * renormalization; positions use symplectic Euler. */
+void integrateCubesRange(int begin, int end, int slice, void* context) {
+    World* w = &g_world;
+    const int* list = awakeStreamList(w);
+    const vfloat dt = vf_set1(*(const float*)context);
+    const vfloat halfDt = vf_set1(0.5f * *(const float*)context);
+    const vfloat one = vf_set1(1.0f);
+    const vfloat restSpeedSq = vf_set1(REST_THRESHOLD * REST_THRESHOLD);
+    const vfloat half = vf_set1(0.5f);
+    const vfloat zero = vf_set1(0.0f);
+    vfloat maxSpeedSq = zero;
+
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        vfloat px = streamLoad(w->posX, list, base);
+        vfloat py = streamLoad(w->posY, list, base);
+        vfloat pz = streamLoad(w->posZ, list, base);
+        vfloat qw = streamLoad(w->quatW, list, base);
+        vfloat qx = streamLoad(w->quatX, list, base);
+        vfloat qy = streamLoad(w->quatY, list, base);
+        vfloat qz = streamLoad(w->quatZ, list, base);
+        streamStore(w->sweepX, list, base, px);
+        streamStore(w->sweepY, list, base, py);
+        streamStore(w->sweepZ, list, base, pz);
+
+        vfloat vx = streamLoad(w->velX, list, base);
+        vfloat vy = streamLoad(w->velY, list, base);
+        vfloat vz = streamLoad(w->velZ, list, base);
+        vfloat ax = streamLoad(w->angVelX, list, base);
+        vfloat ay = streamLoad(w->angVelY, list, base);
+        vfloat az = streamLoad(w->angVelZ, list, base);
+
+        px = vf_fmadd(vx, dt, px);
+        py = vf_fmadd(vy, dt, py);
+        pz = vf_fmadd(vz, dt, pz);
+
+        vfloat hx = vf_mul(ax, halfDt);
+        vfloat hy = vf_mul(ay, halfDt);
+        vfloat hz = vf_mul(az, halfDt);
+        vfloat nw = vf_sub(qw, vf_fmadd(hx, qx, vf_fmadd(hy, qy, vf_mul(hz, qz))));
+        vfloat nx = vf_add(qx, vf_sub(vf_fmadd(hx, qw, vf_mul(hy, qz)), vf_mul(hz, qy)));
+        vfloat ny = vf_add(qy, vf_sub(vf_fmadd(hy, qw, vf_mul(hz, qx)), vf_mul(hx, qz)));
+        vfloat nz = vf_add(qz, vf_sub(vf_fmadd(hz, qw, vf_mul(hx, qy)), vf_mul(hy, qx)));
+        vfloat lengthSq = vf_fmadd(nw, nw, vf_fmadd(nx, nx, vf_fmadd(ny, ny, vf_mul(nz, nz))));
+        vfloat invLength = vf_div(one, vf_sqrt(lengthSq));
+
+        streamStore(w->posX, list, base, px);
+        streamStore(w->posY, list, base, py);
+        streamStore(w->posZ, list, base, pz);
+        streamStore(w->quatW, list, base, vf_mul(nw, invLength));
+        streamStore(w->quatX, list, base, vf_mul(nx, invLength));
+        streamStore(w->quatY, list, base, vf_mul(ny, invLength));
+        streamStore(w->quatZ, list, base, vf_mul(nz, invLength));
+
+        vfloat speedSq = vf_fmadd(vx, vx, vf_fmadd(vy, vy, vf_mul(vz, vz)));
+        /* Spin is judged by the speed it gives the body's surface, so a large
+         * body turning slowly is as restless as a small one turning fast. */
+        vfloat spinSq = vf_fmadd(ax, ax, vf_fmadd(ay, ay, vf_mul(az, az)));
+        vfloat reach = vf_mul(streamLoad(w->size, list, base), half);
+        vfloat surfaceSpeedSq = vf_mul(spinSq, vf_mul(reach, reach));
+        vmask slow = vm_and(vf_lt(speedSq, restSpeedSq), vf_lt(surfaceSpeedSq, restSpeedSq));
+        vfloat timer = vf_add(streamLoad(w->sleepTimer, list, base), dt);
+        streamStore(w->sleepTimer, list, base, vf_select(slow, timer, zero));
+        if (end - base >= SIMD_WIDTH) {
+            maxSpeedSq = vf_select(vf_gt(speedSq, maxSpeedSq), speedSq, maxSpeedSq);
+        } else {
+            float tail[SIMD_WIDTH] __attribute__((aligned(SIMD_ALIGNMENT)));
+            vf_store(tail, speedSq);
+            for (int l = 0; l < end - base; ++l) {
+                g_threadPool.maxSpeedSq[slice] = fmaxf(g_threadPool.maxSpeedSq[slice], tail[l]);
+            }
+        }
+    }
+
+    /* Per-slice peak speed for the substep controller; max is order-free, so the
+     * result does not depend on how slices were scheduled. */
+    float lanes[SIMD_WIDTH] __attribute__((aligned(SIMD_ALIGNMENT)));
+    vf_store(lanes, maxSpeedSq);
+    for (int l = 0; l < SIMD_WIDTH; ++l) {
+        g_threadPool.maxSpeedSq[slice] = fmaxf(g_threadPool.maxSpeedSq[slice], lanes[l]);
+    }
+}
+
+void collideStaticPlane(int body, int plane, const Obb* box, ManifoldList* out) {
+    const StaticColliders* statics = &g_statics;
+    Vec3 normal = vec3_create(statics->planeNX[plane], statics->planeNY[plane], statics->planeNZ[plane]);
+    ContactManifold m;
+    if (!boxPlaneManifold(box, normal, statics->planeOffset[plane], &m)) return;
+    m.a = body;
+    m.b = -1;
+    for (int k = 0; k < m.pointCount; ++k) {
+        m.points[k].feature += plane * 8;
+    }
+    *manifoldListPush(out) = m;
+}
+
+void collideStaticBox(int body, int index, const Obb* box, ManifoldList* out) {
+    ContactManifold m;
+    if (!boxBoxManifold(box, &g_statics.boxes[index], &m)) return;
+    m.a = body;
+    m.b = -1;
+    for (int k = 0; k < m.pointCount; ++k) {
+        m.points[k].feature += STATIC_BOX_FEATURE_BASE + index * STATIC_BOX_FEATURE_STRIDE;
+    }
+    *manifoldListPush(out) = m;
+}
+
+static void addStaticPlane(Vec3 normal, float offset) {
+    StaticColliders* statics = &g_statics;
+    if (statics->planeCount >= MAX_STATIC_PLANES) {
+        fprintf(stderr, "Error: Too many static planes (max %d).\n", MAX_STATIC_PLANES);
+        exit(1);
+    }
+    normal = vec3_normalize(normal);
+    statics->planeNX[statics->planeCount] = normal.x;
+    statics->planeNY[statics->planeCount] = normal.y;
+    statics->planeNZ[statics->planeCount] = normal.z;
+    statics->planeOffset[statics->planeCount] = offset;
+    statics->planeCount++;
+}
+
+static void addStaticBox(Vec3 center, Vec3 halfExtent, float yawDegrees) {
+    StaticColliders* statics = &g_statics;
+    if (statics->boxCount >= MAX_STATIC_BOXES) {
+        fprintf(stderr, "Error: Too many static boxes (max %d).\n", MAX_STATIC_BOXES);
+        exit(1);
+    }
+    float yaw = yawDegrees * 3.14159265358979f / 180.0f;
+    float c = cosf(yaw), sn = sinf(yaw);
+    Obb* box = &statics->boxes[statics->boxCount];
+    box->center = center;
+    box->axis[0] = vec3_create(c, 0.0f, -sn);
+    box->axis[1] = vec3_create(0.0f, 1.0f, 0.0f);
+    box->axis[2] = vec3_create(sn, 0.0f, c);
+    box->extent[0] = halfExtent.x;
+    box->extent[1] = halfExtent.y;
+    box->extent[2] = halfExtent.z;
+    statics->boxHalfExtent[statics->boxCount] = vec3_create(fabsf(c) * halfExtent.x + fabsf(sn) * halfExtent.z,
+                                                            halfExtent.y,
+                                                            fabsf(sn) * halfExtent.x + fabsf(c) * halfExtent.z);
+    statics->boxCount++;
+}
+
+/* Collider files hold one collider per line:
+ *   plane nx ny nz offset
+ *   box cx cy cz hx hy hz [yaw_degrees]
+ * Blank lines and lines starting with '#' are ignored. */
+static void loadStaticColliders(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open collider file '%s'.\n", path);
+        exit(1);
+    }
+    char line[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        float v[7];
+        char kind[16];
+        if (sscanf(line, "%15s", kind) != 1 || kind[0] == '#') continue;
+        if (strcmp(kind, "plane") == 0 && sscanf(line, "%*s %f %f %f %f", &v[0], &v[1], &v[2], &v[3]) == 4) {
+            addStaticPlane(vec3_create(v[0], v[1], v[2]), v[3]);
+        } else if (strcmp(kind, "box") == 0 &&
+                   sscanf(line, "%*s %f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 6) {
+            if (sscanf(line, "%*s %*f %*f %*f %*f %*f %*f %f", &v[6]) != 1) v[6] = 0.0f;
+            addStaticBox(vec3_create(v[0], v[1], v[2]), vec3_create(v[3], v[4], v[5]), v[6]);
+        } else {
+            fprintf(stderr, "Error: %s:%d: expected 'plane nx ny nz offset' or 'box cx cy cz hx hy hz [yaw]'.\n",
+                    path, lineNumber);
+            exit(1);
+        }
+    }
+    fclose(file);
+}
+
+void buildStaticColliders() {
+    StaticColliders* statics = &g_statics;
+    statics->planeCount = 0;
+    statics->boxCount = 0;
+    addStaticPlane(vec3_create(0.0f, 1.0f, 0.0f), statics->groundY);
+    if (statics->arenaHalfWidth > 0.0f) {
+        float bound = statics->arenaHalfWidth;
+        addStaticPlane(vec3_create(1.0f, 0.0f, 0.0f), -bound);
+        addStaticPlane(vec3_create(-1.0f, 0.0f, 0.0f), -bound);
+        addStaticPlane(vec3_create(0.0f, 0.0f, 1.0f), -bound);
+        addStaticPlane(vec3_create(0.0f, 0.0f, -1.0f), -bound);
+    }
+    if (statics->path != NULL) {
+        loadStaticColliders(statics->path);
+    }
+}
+
+static inline float bodyBoundingExtent(int i) {
+    return g_world.size[i] * SHAPE_BOUNDING_SCALE[g_world.shape[i]];
+}
+
+static inline uint32_t cellHash(int x, int y, int z) {
+    return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+}
+
+static inline uint32_t spatialHashBucket(const SpatialHash* grid, int x, int y, int z) {
+    return cellHash(x, y, z) & (uint32_t)(grid->tableSize - 1);
+}
+
+static inline uint32_t sleepingHashBucket(const SleepingHash* grid, int x, int y, int z) {
+    return cellHash(x, y, z) & (uint32_t)(grid->tableSize - 1);
+}
+
+static void spatialHashFree(SpatialHash* grid) {
+    free(grid->cellStart);
+    free(grid->cellBodies);
+    free(grid->cellPosX);
+    free(grid->cellPosY);
+    free(grid->cellPosZ);
+    free(grid->cellExtent);
+    free(grid->bodyBucket);
+    free(grid->cellX);
+    free(grid->cellY);
+    free(grid->cellZ);
+    memset(grid, 0, sizeof(*grid));
+}
+
+static void spatialHashReserve(SpatialHash* grid, int count) {
+    if (count <= grid->capacity) return;
+    int capacity = grid->capacity > 0 ? grid->capacity : 1024;
+    while (capacity < count) capacity *= 2;
+
+    spatialHashFree(grid);
+    grid->cellStart = (int*)allocAligned(sizeof(int) * (size_t)(capacity * 2 + 1));
+    grid->cellBodies = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->cellPosX = (float*)allocAligned(sizeof(float) * (size_t)capacity);
+    grid->cellPosY = (float*)allocAligned(sizeof(float) * (size_t)capacity);
+    grid->cellPosZ = (float*)allocAligned(sizeof(float) * (size_t)capacity);
+    grid->cellExtent = (float*)allocAligned(sizeof(float) * (size_t)capacity);
+    grid->bodyBucket = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)capacity);
+    grid->cellX = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->cellY = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->cellZ = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->capacity = capacity;
+}
+
+static void sleepingHashFree(SleepingHash* grid) {
+    free(grid->bucketHead);
+    free(grid->next);
+    free(grid->prev);
+    free(grid->cellX);
+    free(grid->cellY);
+    free(grid->cellZ);
+    memset(grid, 0, sizeof(*grid));
+}
+
+/* Empties the grid; the cell size follows the current size range. */
+static void sleepingHashClear(SleepingHash* grid) {
+    grid->cellSize = 2.0f * BOUNDING_EXTENT_SCALE * g_cubeSizeMax;
+    grid->count = 0;
+    if (grid->tableSize > 0) memset(grid->bucketHead, 0xff, sizeof(int) * (size_t)grid->tableSize);
+}
+
+static void sleepingHashReserve(SleepingHash* grid, int count) {
+    if (count <= grid->capacity) return;
+    int capacity = grid->capacity > 0 ? grid->capacity : 1024;
+    while (capacity < count) capacity *= 2;
+
+    sleepingHashFree(grid);
+    grid->tableSize = capacity * 2;
+    grid->bucketHead = (int*)allocAligned(sizeof(int) * (size_t)grid->tableSize);
+    grid->next = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->prev = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->cellX = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->cellY = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->cellZ = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+    grid->capacity = capacity;
+    sleepingHashClear(grid);
+}
+
+static void sleepingHashInsert(SleepingHash* grid, int i) {
+    const World* w = &g_world;
+    float invCellSize = 1.0f / grid->cellSize;
+    grid->cellX[i] = (int)floorf(w->posX[i] * invCellSize);
+    grid->cellY[i] = (int)floorf(w->posY[i] * invCellSize);
+    grid->cellZ[i] = (int)floorf(w->posZ[i] * invCellSize);
+    uint32_t bucket = sleepingHashBucket(grid, grid->cellX[i], grid->cellY[i], grid->cellZ[i]);
+    int head = grid->bucketHead[bucket];
+    grid->prev[i] = -1;
+    grid->next[i] = head;
+    if (head >= 0) grid->prev[head] = i;
+    grid->bucketHead[bucket] = i;
+    grid->count++;
+}
+
+/* The body's stored cell finds its bucket, so this holds before and after its
+ * other streams change. */
+static void sleepingHashRemove(SleepingHash* grid, int i) {
+    int next = grid->next[i], prev = grid->prev[i];
+    if (prev >= 0) {
+        grid->next[prev] = next;
+    } else {
+        grid->bucketHead[sleepingHashBucket(grid, grid->cellX[i], grid->cellY[i], grid->cellZ[i])] = next;
+    }
+    if (next >= 0) grid->prev[next] = prev;
+    grid->count--;
+}
+
+/* Bins the listed bodies in cells twice the largest extent among them. */
+static void spatialHashBin(SpatialHash* grid, const int* bodies, int count) {
+    World* w = &g_world;
+    float maxExtent = 0.0f;
+    for (int k = 0; k < count; ++k) {
+        float e = bodyBoundingExtent(bodies[k]);
+        if (e > maxExtent) maxExtent = e;
+    }
+    grid->cellSize = maxExtent * 2.0f;
+    grid->count = grid->cellSize > 0.0f ? count : 0;
+    if (grid->count == 0) return;
+    float invCellSize = 1.0f / grid->cellSize;
+
+    grid->tableSize = 16;
+    while (grid->tableSize < count * 2) grid->tableSize *= 2;
+    memset(grid->cellStart, 0, sizeof(int) * (size_t)(grid->tableSize + 1));
+    for (int k = 0; k < count; ++k) {
+        int i = bodies[k];
+        int cx = (int)floorf(w->posX[i] * invCellSize);
+        int cy = (int)floorf(w->posY[i] * invCellSize);
+        int cz = (int)floorf(w->posZ[i] * invCellSize);
+        uint32_t bucket = spatialHashBucket(grid, cx, cy, cz);
+        grid->bodyBucket[k] = bucket;
+        grid->cellStart[bucket + 1]++;
+    }
+    for (int b = 0; b < grid->tableSize; ++b) {
+        grid->cellStart[b + 1] += grid->cellStart[b];
+    }
+    for (int k = 0; k < count; ++k) {
+        int i = bodies[k];
+        int slot = grid->cellStart[grid->bodyBucket[k]]++;
+        grid->cellBodies[slot] = i;
+        grid->cellPosX[slot] = w->posX[i];
+        grid->cellPosY[slot] = w->posY[i];
+        grid->cellPosZ[slot] = w->posZ[i];
+        grid->cellExtent[slot] = bodyBoundingExtent(i);
+        grid->cellX[slot] = (int)floorf(w->posX[i] * invCellSize);
+        grid->cellY[slot] = (int)floorf(w->posY[i] * invCellSize);
+        grid->cellZ[slot] = (int)floorf(w->posZ[i] * invCellSize);
+    }
+    for (int b = grid->tableSize; b > 0; --b) {
+        grid->cellStart[b] = grid->cellStart[b - 1];
+    }
+    grid->cellStart[0] = 0;
+}
+
+/* Awake pairs come from the half neighbourhood of each awake cell; each awake
+ * body then looks up the sleeping grid over every cell its reach to the
+ * largest possible sleeper spans. Sleeping bodies are never visited on their
+ * own. */
+void findPairsSpatialHash(PairList* out) {
+    World* w = &g_world;
+    SpatialHash* grid = &g_spatialHash;
+    const SleepingHash* sleeping = &g_sleepingHash;
+    out->count = 0;
+
+    spatialHashReserve(grid, w->awakeCount);
+    spatialHashBin(grid, w->awake, w->awakeCount);
+
+    static const int halfNeighbourhood[14][3] = {
+        { 0, 0, 0 }, { 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+        { -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 }, { -1, 0, 1 }, { 0, 0, 1 },
+        { 1, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+    };
+
+    for (int s = 0; s < grid->count; ++s) {
+        float xs = grid->cellPosX[s];
+        float ys = grid->cellPosY[s];
+        float zs = grid->cellPosZ[s];
+        float es = grid->cellExtent[s];
+
+        for (int n = 0; n < 14; ++n) {
+            int nx = grid->cellX[s] + halfNeighbourhood[n][0];
+            int ny = grid->cellY[s] + halfNeighbourhood[n][1];
+            int nz = grid->cellZ[s] + halfNeighbourhood[n][2];
+            uint32_t bucket = spatialHashBucket(grid, nx, ny, nz);
+            int first = n == 0 ? s + 1 : grid->cellStart[bucket];
+
+            for (int t = first; t < grid->cellStart[bucket + 1]; ++t) {
+                if (grid->cellX[t] != nx || grid->cellY[t] != ny || grid->cellZ[t] != nz) continue;
+                float reach = es + grid->cellExtent[t];
+                if (fabsf(xs - grid->cellPosX[t]) > reach ||
+                    fabsf(ys - grid->cellPosY[t]) > reach ||
+                    fabsf(zs - grid->cellPosZ[t]) > reach) {
+                    continue;
+                }
+                int a = grid->cellBodies[s];
+                int b = grid->cellBodies[t];
+                pushBodyPair(out, a, b);
+            }
+        }
+    }
+
+    if (sleeping->count == 0) return;
+    float invSleepingCell = 1.0f / sleeping->cellSize;
+    float sleepingExtent = sleeping->cellSize * 0.5f;
+    for (int s = 0; s < grid->count; ++s) {
+        float xs = grid->cellPosX[s];
+        float ys = grid->cellPosY[s];
+        float zs = grid->cellPosZ[s];
+        float es = grid->cellExtent[s];
+        float span = es + sleepingExtent;
+        int x0 = (int)floorf((xs - span) * invSleepingCell), x1 = (int)floorf((xs + span) * invSleepingCell);
+        int y0 = (int)floorf((ys - span) * invSleepingCell), y1 = (int)floorf((ys + span) * invSleepingCell);
+        int z0 = (int)floorf((zs - span) * invSleepingCell), z1 = (int)floorf((zs + span) * invSleepingCell);
+
+        for (int nz = z0; nz <= z1; ++nz) {
+            for (int ny = y0; ny <= y1; ++ny) {
+                for (int nx = x0; nx <= x1; ++nx) {
+                    uint32_t bucket = sleepingHashBucket(sleeping, nx, ny, nz);
+                    for (int t = sleeping->bucketHead[bucket]; t >= 0; t = sleeping->next[t]) {
+                        if (sleeping->cellX[t] != nx || sleeping->cellY[t] != ny || sleeping->cellZ[t] != nz) continue;
+                        float reach = es + bodyBoundingExtent(t);
+                        if (fabsf(xs - w->posX[t]) > reach ||
+                            fabsf(ys - w->posY[t]) > reach ||
+                            fabsf(zs - w->posZ[t]) > reach) {
+                            continue;
+                        }
+                        pushBodyPair(out, grid->cellBodies[s], t);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Stable counting sort of the pairs by kind, so each narrowphase kernel gets one
+ * contiguous group and the broadphase order survives within it. A scene with a
+ * single shape is already one group. */
+static void groupPairsByShape(PairList* pairs) {
+    const World* w = &g_world;
+    PairGroups* groups = &g_pairGroups;
+    int shapes = 0;
+    int onlyShape = SHAPE_BOX;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        if (w->shapeStart[s + 1] == w->shapeStart[s]) continue;
+        shapes++;
+        onlyShape = s;
+    }
+    if (shapes <= 1) {
+        PairKind kind = PAIR_KINDS[onlyShape][onlyShape];
+        for (int k = 0; k <= PAIR_KIND_COUNT; ++k) {
+            groups->start[k] = k <= (int)kind ? 0 : pairs->count;
+        }
+        return;
+    }
+
+    int cursor[PAIR_KIND_COUNT] = { 0 };
+    for (int p = 0; p < pairs->count; ++p) {
+        cursor[PAIR_KINDS[w->shape[pairs->pairs[p].a]][w->shape[pairs->pairs[p].b]]]++;
+    }
+    groups->start[0] = 0;
+    for (int k = 0; k < PAIR_KIND_COUNT; ++k) {
+        groups->start[k + 1] = groups->start[k] + cursor[k];
+        cursor[k] = groups->start[k];
+    }
+    reserveArray((void**)&groups->scratch, sizeof(BodyPair), &groups->scratchCapacity, pairs->count);
+    for (int p = 0; p < pairs->count; ++p) {
+        BodyPair pair = pairs->pairs[p];
+        groups->scratch[cursor[PAIR_KINDS[w->shape[pair.a]][w->shape[pair.b]]]++] = pair;
+    }
+    BodyPair* sorted = groups->scratch;
+    int sortedCapacity = groups->scratchCapacity;
+    groups->scratch = pairs->pairs;
+    groups->scratchCapacity = pairs->capacity;
+    pairs->pairs = sorted;
+    pairs->capacity = sortedCapacity;
+}
+
+void findCollisionPairs(PairList* out, float deltaTime) {
+    switch (g_broadphase) {
+        case BROADPHASE_SAP:
+            findPairsSweepAndPrune(out);
+            break;
+        case BROADPHASE_TREE:
+            findPairsAabbTree(out, deltaTime);
+            break;
+        case BROADPHASE_GRID:
+        default:
+            findPairsSpatialHash(out);
+            break;
+    }
+    groupPairsByShape(out);
+}
+
+void invalidateBroadphase() {
+    const World* w = &g_world;
+    sleepingHashClear(&g_sleepingHash);
+    for (int i = 0; i < w->count; ++i) {
+        if (w->resting[i]) sleepingHashInsert(&g_sleepingHash, i);
+    }
+    g_sweepAndPrune.dirty = true;
+    g_aabbTree.dirty = true;
+}
+
+static inline const float* worldAxis(int axis) {
+    return axis == 0 ? g_world.posX : (axis == 1 ? g_world.posY : g_world.posZ);
+}
+
+static int compareSapEndpoints(const void* a, const void* b) {
+    float va = ((const SapEndpoint*)a)->value;
+    float vb = ((const SapEndpoint*)b)->value;
+    if (va < vb) return -1;
+    if (va > vb) return 1;
+    return (int)(((const SapEndpoint*)a)->owner & 1u) - (int)(((const SapEndpoint*)b)->owner & 1u);
+}
+
+static inline uint64_t overlapKey(int a, int b) {
+    return ((uint64_t)(uint32_t)(a < b ? a : b) + 1) << 32 | (uint32_t)(a < b ? b : a);
+}
+
+static inline uint32_t overlapTableHome(const SweepAndPrune* sap, uint64_t key) {
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (uint32_t)(sap->overlapTableSize - 1);
+}
+
+/* Linear probing from the key's home entry; returns the entry holding the key,
+ * or the empty entry where it would go. */
+static int overlapTableFind(const SweepAndPrune* sap, uint64_t key) {
+    uint32_t mask = (uint32_t)sap->overlapTableSize - 1;
+    uint32_t t = overlapTableHome(sap, key);
+    while (sap->overlapKeys[t] != 0 && sap->overlapKeys[t] != key) t = (t + 1) & mask;
+    return (int)t;
+}
+
+/* Refills the table from the overlap list, growing it to keep the load under a
+ * half for count pairs. */
+static void overlapTableRebuild(SweepAndPrune* sap, int count) {
+    if (count * 2 > sap->overlapTableSize) {
+        int size = sap->overlapTableSize > 0 ? sap->overlapTableSize : 1024;
+        while (size < count * 2) size *= 2;
+        free(sap->overlapKeys);
+        free(sap->overlapSlots);
+        sap->overlapKeys = (uint64_t*)allocAligned(sizeof(uint64_t) * (size_t)size);
+        sap->overlapSlots = (int*)allocAligned(sizeof(int) * (size_t)size);
+        sap->overlapTableSize = size;
+    }
+    memset(sap->overlapKeys, 0, sizeof(uint64_t) * (size_t)sap->overlapTableSize);
+    for (int k = 0; k < sap->overlapCount; ++k) {
+        int t = overlapTableFind(sap, overlapKey(sap->overlaps[k].a, sap->overlaps[k].b));
+        sap->overlapKeys[t] = overlapKey(sap->overlaps[k].a, sap->overlaps[k].b);
+        sap->overlapSlots[t] = k;
+    }
+}
+
+static void overlapSetAdd(SweepAndPrune* sap, int a, int b) {
+    if ((sap->overlapCount + 1) * 2 > sap->overlapTableSize) overlapTableRebuild(sap, sap->overlapCount + 1);
+    uint64_t key = overlapKey(a, b);
+    int t = overlapTableFind(sap, key);
+    if (sap->overlapKeys[t] != 0) return;
+    reserveArray((void**)&sap->overlaps, sizeof(BodyPair), &sap->overlapCapacity, sap->overlapCount + 1);
+    sap->overlaps[sap->overlapCount].a = a < b ? a : b;
+    sap->overlaps[sap->overlapCount].b = a < b ? b : a;
+    sap->overlapKeys[t] = key;
+    sap->overlapSlots[t] = sap->overlapCount++;
+}
+
+/* The last pair in the list fills the hole, and the entries probed past the
+ * removed one shift back so no lookup stops early. */
+static void overlapSetRemove(SweepAndPrune* sap, int a, int b) {
+    if (sap->overlapCount == 0) return;
+    int t = overlapTableFind(sap, overlapKey(a, b));
+    if (sap->overlapKeys[t] == 0) return;
+    int slot = sap->overlapSlots[t];
+    BodyPair last = sap->overlaps[--sap->overlapCount];
+    if (slot != sap->overlapCount) {
+        sap->overlaps[slot] = last;
+        sap->overlapSlots[overlapTableFind(sap, overlapKey(last.a, last.b))] = slot;
+    }
+
+    uint32_t mask = (uint32_t)sap->overlapTableSize - 1;
+    uint32_t hole = (uint32_t)t;
+    for (uint32_t u = (hole + 1) & mask; sap->overlapKeys[u] != 0; u = (u + 1) & mask) {
+        uint32_t home = overlapTableHome(sap, sap->overlapKeys[u]);
+        if (((u - home) & mask) < ((u - hole) & mask)) continue;
+        sap->overlapKeys[hole] = sap->overlapKeys[u];
+        sap->overlapSlots[hole] = sap->overlapSlots[u];
+        hole = u;
+    }
+    sap->overlapKeys[hole] = 0;
+}
+
+/* Stored and looked up through this one expression, so a multiply-add fused in
+ * one place and not in another cannot lose a sleeper. */
+static inline float sapSleeperValue(const SweepAndPrune* sap, int body) {
+    return fmaf(-g_world.size[body], SHAPE_BOUNDING_SCALE[g_world.shape[body]], worldAxis(sap->axis)[body]);
+}
+
+static void sapRebuild(SweepAndPrune* sap) {
+    World* w = &g_world;
+    int count = w->count;
+
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    double meanSq[3] = { 0.0, 0.0, 0.0 };
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* p = worldAxis(axis);
+        for (int i = 0; i < count; ++i) {
+            mean[axis] += p[i];
+            meanSq[axis] += (double)p[i] * p[i];
+        }
+    }
+    sap->axis = 0;
+    double bestVariance = -1.0;
+    for (int axis = 0; axis < 3; ++axis) {
+        double m = count > 0 ? mean[axis] / count : 0.0;
+        double variance = count > 0 ? meanSq[axis] / count - m * m : 0.0;
+        if (variance > bestVariance) {
+            bestVariance = variance;
+            sap->axis = axis;
+        }
+    }
+
+    reserveArray((void**)&sap->endpoints, sizeof(SapEndpoint), &sap->endpointCapacity, w->awakeCount * 2);
+    sap->endpointCount = w->awakeCount * 2;
+    const float* p = worldAxis(sap->axis);
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = w->awake[k];
+        float e = bodyBoundingExtent(i);
+        sap->endpoints[2 * k].value = p[i] - e;
+        sap->endpoints[2 * k].owner = (uint32_t)i << 1;
+        sap->endpoints[2 * k + 1].value = p[i] + e;
+        sap->endpoints[2 * k + 1].owner = ((uint32_t)i << 1) | 1u;
+    }
+    qsort(sap->endpoints, (size_t)sap->endpointCount, sizeof(SapEndpoint), compareSapEndpoints);
+
+    reserveArray((void**)&sap->active, sizeof(int), &sap->activeCapacity, count);
+    reserveArray((void**)&sap->activeSlot, sizeof(int), &sap->activeSlotCapacity, count);
+    sap->overlapCount = 0;
+    int activeCount = 0;
+    for (int k = 0; k < sap->endpointCount; ++k) {
+        uint32_t owner = sap->endpoints[k].owner;
+        int body = (int)(owner >> 1);
+        if (owner & 1u) {
+            int slot = sap->activeSlot[body];
+            int last = sap->active[--activeCount];
+            sap->active[slot] = last;
+            sap->activeSlot[last] = slot;
+            continue;
+        }
+        reserveArray((void**)&sap->overlaps, sizeof(BodyPair), &sap->overlapCapacity, sap->overlapCount + activeCount);
+        for (int a = 0; a < activeCount; ++a) {
+            int other = sap->active[a];
+            sap->overlaps[sap->overlapCount].a = body < other ? body : other;
+            sap->overlaps[sap->overlapCount++].b = body < other ? other : body;
+        }
+        sap->activeSlot[body] = activeCount;
+        sap->active[activeCount++] = body;
+    }
+    overlapTableRebuild(sap, sap->overlapCount);
+
+    reserveArray((void**)&sap->sleepers, sizeof(SapEndpoint), &sap->sleeperCapacity, count - w->awakeCount);
+    sap->sleeperCount = 0;
+    sap->sleeperSpan = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        if (!w->resting[i]) continue;
+        float e = bodyBoundingExtent(i);
+        sap->sleepers[sap->sleeperCount].value = sapSleeperValue(sap, i);
+        sap->sleepers[sap->sleeperCount++].owner = (uint32_t)i << 1;
+        sap->sleeperSpan = fmaxf(sap->sleeperSpan, 2.0f * e);
+    }
+    qsort(sap->sleepers, (size_t)sap->sleeperCount, sizeof(SapEndpoint), compareSapEndpoints);
+    sap->dirty = false;
+}
+
+static void sapUpdate(SweepAndPrune* sap) {
+    const float* p = worldAxis(sap->axis);
+    SapEndpoint* ep = sap->endpoints;
+    int n = sap->endpointCount;
+
+    for (int k = 0; k < n; ++k) {
+        int body = (int)(ep[k].owner >> 1);
+        float e = bodyBoundingExtent(body);
+        ep[k].value = (ep[k].owner & 1u) ? p[body] + e : p[body] - e;
+    }
+
+    for (int k = 1; k < n; ++k) {
+        SapEndpoint key = ep[k];
+        int j = k - 1;
+        while (j >= 0 && (ep[j].value > key.value ||
+                          (ep[j].value == key.value && (ep[j].owner & 1u) > (key.owner & 1u)))) {
+            /* A lower endpoint passing an upper one starts an overlap; an
+             * upper one passing a lower one ends it. */
+            if ((ep[j].owner & 1u) != (key.owner & 1u)) {
+                int a = (int)(key.owner >> 1), b = (int)(ep[j].owner >> 1);
+                if (key.owner & 1u) overlapSetRemove(sap, a, b);
+                else overlapSetAdd(sap, a, b);
+            }
+            ep[j + 1] = ep[j];
+            --j;
+        }
+        ep[j + 1] = key;
+    }
+}
+
+/* First sleeper whose lower endpoint is not below value. */
+static int sapSleeperLowerBound(const SweepAndPrune* sap, float value) {
+    int lo = 0, hi = sap->sleeperCount;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (sap->sleepers[mid].value < value) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* A sleeping body holds still, so its lower endpoint is found again by value
+ * when it wakes, moves or is despawned. */
+static void sapInsertSleeper(SweepAndPrune* sap, int body) {
+    float value = sapSleeperValue(sap, body);
+    int t = sapSleeperLowerBound(sap, value);
+    reserveArray((void**)&sap->sleepers, sizeof(SapEndpoint), &sap->sleeperCapacity, sap->sleeperCount + 1);
+    memmove(sap->sleepers + t + 1, sap->sleepers + t, sizeof(SapEndpoint) * (size_t)(sap->sleeperCount - t));
+    sap->sleepers[t].value = value;
+    sap->sleepers[t].owner = (uint32_t)body << 1;
+    sap->sleeperCount++;
+    sap->sleeperSpan = fmaxf(sap->sleeperSpan, 2.0f * bodyBoundingExtent(body));
+}
+
+static void sapRemoveSleeper(SweepAndPrune* sap, int body) {
+    float value = sapSleeperValue(sap, body);
+    int t = sapSleeperLowerBound(sap, value);
+    while (t < sap->sleeperCount && sap->sleepers[t].value == value && sap->sleepers[t].owner != (uint32_t)body << 1) t++;
+    if (t == sap->sleeperCount || sap->sleepers[t].owner != (uint32_t)body << 1) {
+        fprintf(stderr, "Error: Sweep and prune lost track of a sleeping body.\n");
+        exit(1);
+    }
+    sap->sleeperCount--;
+    memmove(sap->sleepers + t, sap->sleepers + t + 1, sizeof(SapEndpoint) * (size_t)(sap->sleeperCount - t));
+}
+
+/* A woken body leaves the sleepers and its endpoints are appended for the
+ * incremental pass to sort into place, as a spawned body's are. */
+static void sapWakeBody(int body) {
+    SweepAndPrune* sap = &g_sweepAndPrune;
+    if (sap->dirty) return;
+    sapRemoveSleeper(sap, body);
+    sap->endpoints[sap->endpointCount].value = 0.0f;
+    sap->endpoints[sap->endpointCount++].owner = (uint32_t)body << 1;
+    sap->endpoints[sap->endpointCount].value = 0.0f;
+    sap->endpoints[sap->endpointCount++].owner = ((uint32_t)body << 1) | 1u;
+}
+
+/* After a sleep pass: the endpoints of bodies now resting are dropped, keeping
+ * the rest in order, each such body joins the sleepers, and the overlaps it
+ * was part of are removed. */
+static void sapSleepBodies() {
+    const World* w = &g_world;
+    SweepAndPrune* sap = &g_sweepAndPrune;
+    if (sap->dirty) return;
+    int kept = 0;
+    for (int k = 0; k < sap->endpointCount; ++k) {
+        uint32_t owner = sap->endpoints[k].owner;
+        int body = (int)(owner >> 1);
+        if (!w->resting[body]) {
+            sap->endpoints[kept++] = sap->endpoints[k];
+        } else if (!(owner & 1u)) {
+            sapInsertSleeper(sap, body);
+        }
+    }
+    sap->endpointCount = kept;
+    for (int k = 0; k < sap->overlapCount;) {
+        BodyPair pair = sap->overlaps[k];
+        if (w->resting[pair.a] || w->resting[pair.b]) overlapSetRemove(sap, pair.a, pair.b);
+        else ++k;
+    }
+}
+
+/* Sleepers whose lower endpoint lies within the widest sleeping interval below
+ * the body's own lower endpoint, up to its upper one. */
+static void sapQuerySleepers(const SweepAndPrune* sap, int body, float lower, PairList* out) {
+    const float* pa = worldAxis(sap->axis);
+    const float* pb = worldAxis((sap->axis + 1) % 3);
+    const float* pc = worldAxis((sap->axis + 2) % 3);
+    float e = bodyBoundingExtent(body);
+    int first = sapSleeperLowerBound(sap, lower - sap->sleeperSpan);
+    for (int t = first; t < sap->sleeperCount && sap->sleepers[t].value <= lower + 2.0f * e; ++t) {
+        int other = (int)(sap->sleepers[t].owner >> 1);
+        float reach = e + bodyBoundingExtent(other);
+        if (fabsf(pa[body] - pa[other]) > reach || fabsf(pb[body] - pb[other]) > reach ||
+            fabsf(pc[body] - pc[other]) > reach) {
+            continue;
+        }
+        pushBodyPair(out, body, other);
+    }
+}
+
+/* Awake pairs come from the persistent overlap set, checked on the other two
+ * axes; each awake body also searches the sorted sleepers, so sleeping bodies
+ * are never visited on their own. Only an invalidation rebuilds the lists. */
+void findPairsSweepAndPrune(PairList* out) {
+    World* w = &g_world;
+    SweepAndPrune* sap = &g_sweepAndPrune;
+    out->count = 0;
+
+    if (sap->dirty) {
+        sapRebuild(sap);
+    } else {
+        sapUpdate(sap);
+    }
+
+    const float* pb = worldAxis((sap->axis + 1) % 3);
+    const float* pc = worldAxis((sap->axis + 2) % 3);
+    for (int k = 0; k < sap->overlapCount; ++k) {
+        int a = sap->overlaps[k].a;
+        int b = sap->overlaps[k].b;
+        float reach = bodyBoundingExtent(a) + bodyBoundingExtent(b);
+        if (fabsf(pb[a] - pb[b]) > reach || fabsf(pc[a] - pc[b]) > reach) continue;
+        pushBodyPair(out, a, b);
+    }
+
+    if (sap->sleeperCount == 0) return;
+    const float* pa = worldAxis(sap->axis);
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = w->awake[k];
+        sapQuerySleepers(sap, i, pa[i] - bodyBoundingExtent(i), out);
+    }
+}
+
+static inline float aabbSurfaceArea(const Aabb* a) {
+    float dx = a->maxX - a->minX;
+    float dy = a->maxY - a->minY;
+    float dz = a->maxZ - a->minZ;
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline Aabb aabbUnion(const Aabb* a, const Aabb* b) {
+    Aabb u = {
+        fminf(a->minX, b->minX), fminf(a->minY, b->minY), fminf(a->minZ, b->minZ),
+        fmaxf(a->maxX, b->maxX), fmaxf(a->maxY, b->maxY), fmaxf(a->maxZ, b->maxZ)
+    };
+    return u;
+}
+
+static inline bool aabbOverlaps(const Aabb* a, const Aabb* b) {
+    return a->minX <= b->maxX && a->maxX >= b->minX &&
+           a->minY <= b->maxY && a->maxY >= b->minY &&
+           a->minZ <= b->maxZ && a->maxZ >= b->minZ;
+}
+
+static inline bool aabbContains(const Aabb* outer, const Aabb* inner) {
+    return outer->minX <= inner->minX && outer->minY <= inner->minY && outer->minZ <= inner->minZ &&
+           outer->maxX >= inner->maxX && outer->maxY >= inner->maxY && outer->maxZ >= inner->maxZ;
+}
+
+static inline Aabb bodyAabb(int i) {
+    World* w = &g_world;
+    float e = bodyBoundingExtent(i);
+    Aabb box = {
+        w->posX[i] - e, w->posY[i] - e, w->posZ[i] - e,
+        w->posX[i] + e, w->posY[i] + e, w->posZ[i] + e
+    };
+    return box;
+}
+
+static Aabb fattenBodyAabb(int i, float deltaTime) {
+    World* w = &g_world;
+    Aabb box = bodyAabb(i);
+    box.minX -= AABB_TREE_MARGIN;
+    box.minY -= AABB_TREE_MARGIN;
+    box.minZ -= AABB_TREE_MARGIN;
+    box.maxX += AABB_TREE_MARGIN;
+    box.maxY += AABB_TREE_MARGIN;
+    box.maxZ += AABB_TREE_MARGIN;
+
+    float dx = w->velX[i] * deltaTime * AABB_TREE_DISPLACEMENT_SCALE;
+    float dy = w->velY[i] * deltaTime * AABB_TREE_DISPLACEMENT_SCALE;
+    float dz = w->velZ[i] * deltaTime * AABB_TREE_DISPLACEMENT_SCALE;
+    if (dx < 0.0f) box.minX += dx; else box.maxX += dx;
+    if (dy < 0.0f) box.minY += dy; else box.maxY += dy;
+    if (dz < 0.0f) box.minZ += dz; else box.maxZ += dz;
+    return box;
+}
+
+static int treeAllocateNode(AabbTree* tree) {
+    if (tree->freeList == -1) {
+        reserveArray((void**)&tree->nodes, sizeof(TreeNode), &tree->nodeCapacity, tree->nodeCount + 1);
+        tree->nodes[tree->nodeCount].parent = tree->freeList;
+        tree->freeList = tree->nodeCount++;
+    }
+    int node = tree->freeList;
+    tree->freeList = tree->nodes[node].parent;
+    tree->nodes[node].parent = -1;
+    tree->nodes[node].child1 = -1;
+    tree->nodes[node].child2 = -1;
+    tree->nodes[node].height = 0;
+    tree->nodes[node].body = -1;
+    return node;
+}
+
+static void treeFreeNode(AabbTree* tree, int node) {
+    tree->nodes[node].parent = tree->freeList;
+    tree->nodes[node].height = -1;
+    tree->freeList = node;
+}
+
+static int treeBalance(AabbTree* tree, int iA) {
+    TreeNode* n = tree->nodes;
+    TreeNode* A = &n[iA];
+    if (A->child1 == -1 || A->height < 2) return iA;
+
+    int iB = A->child1;
+    int iC = A->child2;
+    TreeNode* B = &n[iB];
+    TreeNode* C = &n[iC];
+    int balance = C->height - B->height;
+
+    if (balance > 1) {
+        int iF = C->child1;
+        int iG = C->child2;
+        TreeNode* F = &n[iF];
+        TreeNode* G = &n[iG];
+
+        C->child1 = iA;
+        C->parent = A->parent;
+        A->parent = iC;
+        if (C->parent != -1) {
+            if (n[C->parent].child1 == iA) n[C->parent].child1 = iC;
+            else n[C->parent].child2 = iC;
+        } else {
+            tree->root = iC;
+        }
+
+        if (F->height > G->height) {
+            C->child2 = iF;
+            A->child2 = iG;
+            G->parent = iA;
+            A->box = aabbUnion(&B->box, &G->box);
+            C->box = aabbUnion(&A->box, &F->box);
+            A->height = 1 + (B->height > G->height ? B->height : G->height);
+            C->height = 1 + (A->height > F->height ? A->height : F->height);
+        } else {
+            C->child2 = iG;
+            A->child2 = iF;
+            F->parent = iA;
+            A->box = aabbUnion(&B->box, &F->box);
+            C->box = aabbUnion(&A->box, &G->box);
+            A->height = 1 + (B->height > F->height ? B->height : F->height);
+            C->height = 1 + (A->height > G->height ? A->height : G->height);
+        }
+        return iC;
+    }
+
+    if (balance < -1) {
+        int iD = B->child1;
+        int iE = B->child2;
+        TreeNode* D = &n[iD];
+        TreeNode* E = &n[iE];
+
+        B->child1 = iA;
+        B->parent = A->parent;
+        A->parent = iB;
+        if (B->parent != -1) {
+            if (n[B->parent].child1 == iA) n[B->parent].child1 = iB;
+            else n[B->parent].child2 = iB;
+        } else {
+            tree->root = iB;
+        }
+
+        if (D->height > E->height) {
+            B->child2 = iD;
+            A->child1 = iE;
+            E->parent = iA;
+            A->box = aabbUnion(&C->box, &E->box);
+            B->box = aabbUnion(&A->box, &D->box);
+            A->height = 1 + (C->height > E->height ? C->height : E->height);
+            B->height = 1 + (A->height > D->height ? A->height : D->height);
+        } else {
+            B->child2 = iE;
+            A->child1 = iD;
+            D->parent = iA;
+            A->box = aabbUnion(&C->box, &D->box);
+            B->box = aabbUnion(&A->box, &E->box);
+            A->height = 1 + (C->height > D->height ? C->height : D->height);
+            B->height = 1 + (A->height > E->height ? A->height : E->height);
+        }
+        return iB;
+    }
+
+    return iA;
+}
+
+static void treeRefitUpwards(AabbTree* tree, int index) {
+    while (index != -1) {
+        index = treeBalance(tree, index);
+        TreeNode* node = &tree->nodes[index];
+        const TreeNode* c1 = &tree->nodes[node->child1];
+        const TreeNode* c2 = &tree->nodes[node->child2];
+        node->height = 1 + (c1->height > c2->height ? c1->height : c2->height);
+        node->box = aabbUnion(&c1->box, &c2->box);
+        index = node->parent;
+    }
+}
+
+static void treeInsertLeaf(AabbTree* tree, int leaf) {
+    TreeNode* n = tree->nodes;
+    if (tree->root == -1) {
+        tree->root = leaf;
+        n[leaf].parent = -1;
+        return;
+    }
+
+    Aabb leafBox = n[leaf].box;
+    int index = tree->root;
+    while (n[index].child1 != -1) {
+        int child1 = n[index].child1;
+        int child2 = n[index].child2;
+        float area = aabbSurfaceArea(&n[index].box);
+        Aabb combined = aabbUnion(&n[index].box, &leafBox);
+        float combinedArea = aabbSurfaceArea(&combined);
+        float cost = 2.0f * combinedArea;
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        float childCost[2];
+        int children[2] = { child1, child2 };
+        for (int c = 0; c < 2; ++c) {
+            Aabb merged = aabbUnion(&leafBox, &n[children[c]].box);
+            float mergedArea = aabbSurfaceArea(&merged);
+            if (n[children[c]].child1 == -1) {
+                childCost[c] = mergedArea + inheritanceCost;
+            } else {
+                childCost[c] = mergedArea - aabbSurfaceArea(&n[children[c]].box) + inheritanceCost;
+            }
+        }
+
+        if (cost < childCost[0] && cost < childCost[1]) break;
+        index = childCost[0] < childCost[1] ? child1 : child2;
+    }
+
+    int sibling = index;
+    int oldParent = n[sibling].parent;
+    int newParent = treeAllocateNode(tree);
+    n = tree->nodes;
+    n[newParent].parent = oldParent;
+    n[newParent].box = aabbUnion(&leafBox, &n[sibling].box);
+    n[newParent].height = n[sibling].height + 1;
+    n[newParent].child1 = sibling;
+    n[newParent].child2 = leaf;
+    n[sibling].parent = newParent;
+    n[leaf].parent = newParent;
+
+    if (oldParent != -1) {
+        if (n[oldParent].child1 == sibling) n[oldParent].child1 = newParent;
+        else n[oldParent].child2 = newParent;
+    } else {
+        tree->root = newParent;
+    }
+
+    treeRefitUpwards(tree, n[leaf].parent);
+}
+
+static void treeRemoveLeaf(AabbTree* tree, int leaf) {
+    TreeNode* n = tree->nodes;
+    if (leaf == tree->root) {
+        tree->root = -1;
+        return;
+    }
+
+    int parent = n[leaf].parent;
+    int grandParent = n[parent].parent;
+    int sibling = n[parent].child1 == leaf ? n[parent].child2 : n[parent].child1;
+
+    if (grandParent != -1) {
+        if (n[grandParent].child1 == parent) n[grandParent].child1 = sibling;
+        else n[grandParent].child2 = sibling;
+        n[sibling].parent = grandParent;
+        treeFreeNode(tree, parent);
+        treeRefitUpwards(tree, grandParent);
+    } else {
+        tree->root = sibling;
+        n[sibling].parent = -1;
+        treeFreeNode(tree, parent);
+    }
+}
+
+static void treeInsertBody(AabbTree* tree, int body, float deltaTime) {
+    int leaf = treeAllocateNode(tree);
+    tree->nodes[leaf].box = fattenBodyAabb(body, deltaTime);
+    tree->nodes[leaf].body = body;
+    tree->bodyLeaf[body] = leaf;
+    treeInsertLeaf(tree, leaf);
+}
+
+static void treeRebuild(AabbTree* tree, float deltaTime) {
+    int count = g_world.count;
+    tree->nodeCount = 0;
+    tree->root = -1;
+    tree->freeList = -1;
+    reserveArray((void**)&tree->nodes, sizeof(TreeNode), &tree->nodeCapacity, count * 2);
+    reserveArray((void**)&tree->bodyLeaf, sizeof(int), &tree->bodyLeafCapacity, count);
+    for (int i = 0; i < count; ++i) {
+        treeInsertBody(tree, i, deltaTime);
+    }
+    tree->bodyCount = count;
+    tree->dirty = false;
+}
+
+static void treeRefit(AabbTree* tree, float deltaTime) {
+    for (int k = 0; k < g_world.awakeCount; ++k) {
+        int i = g_world.awake[k];
+        int leaf = tree->bodyLeaf[i];
+        Aabb tight = bodyAabb(i);
+        if (aabbContains(&tree->nodes[leaf].box, &tight)) continue;
+
+        treeRemoveLeaf(tree, leaf);
+        tree->nodes[leaf].box = fattenBodyAabb(i, deltaTime);
+        treeInsertLeaf(tree, leaf);
+    }
+}
+
+typedef void (*TreeQueryCallback)(int body, void* context);
+
+void treeQuery(AabbTree* tree, const Aabb* box, TreeQueryCallback callback, void* context) {
+    if (tree->root == -1) return;
+    reserveArray((void**)&tree->stack, sizeof(int), &tree->stackCapacity, tree->nodes[tree->root].height + 2);
+    int top = 0;
+    tree->stack[top++] = tree->root;
+    while (top > 0) {
+        const TreeNode* node = &tree->nodes[tree->stack[--top]];
+        if (!aabbOverlaps(&node->box, box)) continue;
+        if (node->child1 == -1) {
+            callback(node->body, context);
+        } else {
+            reserveArray((void**)&tree->stack, sizeof(int), &tree->stackCapacity, top + 2);
+            tree->stack[top++] = node->child1;
+            tree->stack[top++] = node->child2;
+        }
+    }
+}
+
+typedef struct {
+    PairList* out;
+    int body;
+    Aabb box;
+} TreePairQuery;
+
+static void collectTreePair(int other, void* context) {
+    TreePairQuery* query = (TreePairQuery*)context;
+    if (other == query->body) return;
+    if (!g_world.resting[other] && other < query->body) return;
+    Aabb otherBox = bodyAabb(other);
+    if (!aabbOverlaps(&query->box, &otherBox)) return;
+    pushBodyPair(query->out, query->body, other);
+}
+
+void findPairsAabbTree(PairList* out, float deltaTime) {
+    AabbTree* tree = &g_aabbTree;
+    out->count = 0;
+
+    if (tree->dirty || tree->bodyCount != g_world.count) {
+        treeRebuild(tree, deltaTime);
+    } else {
+        treeRefit(tree, deltaTime);
+    }
+
+    TreePairQuery query;
+    query.out = out;
+    for (int k = 0; k < g_world.awakeCount; ++k) {
+        int i = g_world.awake[k];
+        query.body = i;
+        query.box = bodyAabb(i);
+        treeQuery(tree, &query.box, collectTreePair, &query);
+    }
+}
+
+static void bodyRotationMatrix(int i, float m[9]) {
+    World* w = &g_world;
+    float qw = w->quatW[i], qx = w->quatX[i], qy = w->quatY[i], qz = w->quatZ[i];
+
+    m[0] = 1.0f - 2.0f * (qy * qy + qz * qz);
+    m[1] = 2.0f * (qx * qy - qw * qz);
+    m[2] = 2.0f * (qx * qz + qw * qy);
+    m[3] = 2.0f * (qx * qy + qw * qz);
+    m[4] = 1.0f - 2.0f * (qx * qx + qz * qz);
+    m[5] = 2.0f * (qy * qz - qw * qx);
+    m[6] = 2.0f * (qx * qz - qw * qy);
+    m[7] = 2.0f * (qy * qz + qw * qx);
+    m[8] = 1.0f - 2.0f * (qx * qx + qy * qy);
+}
+
+void computeBodyObb(int i, Obb* box) {
+    World* w = &g_world;
+    float m[9];
+    bodyRotationMatrix(i, m);
+    box->center = vec3_create(w->posX[i], w->posY[i], w->posZ[i]);
+    for (int k = 0; k < 3; ++k) {
+        box->axis[k] = vec3_create(m[k], m[3 + k], m[6 + k]);
+        box->extent[k] = w->size[i] * 0.5f;
+    }
+}
+
+void computeBodyRound(int i, RoundShape* round) {
+    World* w = &g_world;
+    round->center = vec3_create(w->posX[i], w->posY[i], w->posZ[i]);
+    if (w->shape[i] == SHAPE_CAPSULE) {
+        float m[9];
+        bodyRotationMatrix(i, m);
+        round->axis = vec3_create(m[1], m[4], m[7]);
+        round->half = w->size[i] * CAPSULE_RADIUS_SCALE;
+        round->radius = w->size[i] * CAPSULE_RADIUS_SCALE;
+    } else {
+        round->axis = vec3_create(0.0f, 1.0f, 0.0f);
+        round->half = 0.0f;
+        round->radius = w->size[i] * 0.5f;
+    }
+}
+
+static inline int roundEndpoints(const RoundShape* round, Vec3 points[2]) {
+    if (round->half == 0.0f) {
+        points[0] = round->center;
+        return 1;
+    }
+    points[0] = vec3_sub(round->center, vec3_mul_scalar(round->axis, round->half));
+    points[1] = vec3_add(round->center, vec3_mul_scalar(round->axis, round->half));
+    return 2;
+}
+
+static inline Vec3 obbClosestPoint(const Obb* box, Vec3 p) {
+    Vec3 d = vec3_sub(p, box->center);
+    Vec3 closest = box->center;
+    for (int k = 0; k < 3; ++k) {
+        float t = fmaxf(-box->extent[k], fminf(box->extent[k], vec3_dot(d, box->axis[k])));
+        closest = vec3_add(closest, vec3_mul_scalar(box->axis[k], t));
+    }
+    return closest;
+}
+
+/* Sphere against an oriented box, with the normal pointing from the sphere into
+ * the box. A center inside the box is pushed out through the nearest face. */
+static bool sphereObbContact(Vec3 center, float radius, const Obb* box, Vec3* normal, ContactPoint* point) {
+    Vec3 d = vec3_sub(center, box->center);
+    Vec3 closest = box->center;
+    bool inside = true;
+    float shallowest = 3.4e38f;
+    int face = 0;
+    float faceSign = 1.0f;
+    for (int k = 0; k < 3; ++k) {
+        float t = vec3_dot(d, box->axis[k]);
+        float clamped = fmaxf(-box->extent[k], fminf(box->extent[k], t));
+        if (clamped != t) inside = false;
+        closest = vec3_add(closest, vec3_mul_scalar(box->axis[k], clamped));
+        float gap = box->extent[k] - fabsf(t);
+        if (gap < shallowest) {
+            shallowest = gap;
+            face = k;
+            faceSign = t < 0.0f ? -1.0f : 1.0f;
+        }
+    }
+
+    if (inside) {
+        *normal = vec3_mul_scalar(box->axis[face], -faceSign);
+        point->position = center;
+        point->depth = shallowest + radius;
+    } else {
+        Vec3 delta = vec3_sub(closest, center);
+        float distanceSq = vec3_dot(delta, delta);
+        if (distanceSq >= radius * radius) return false;
+        float distance = sqrtf(distanceSq);
+        *normal = vec3_mul_scalar(delta, 1.0f / distance);
+        point->position = vec3_mul_scalar(vec3_add(vec3_add(center, vec3_mul_scalar(*normal, radius)), closest), 0.5f);
+        point->depth = radius - distance;
+    }
+    point->feature = 0;
+    return true;
+}
+
+/* Round shape against an oriented box, normal from the round shape into the box.
+ * Each capsule end and the point of the core segment nearest the box are tested
+ * as spheres; the deepest sets the normal and the others stay if they push the
+ * same way, so a capsule lying on a face gets a two-point manifold. */
+static bool roundObbManifold(const RoundShape* round, const Obb* box, ContactManifold* m) {
+    Vec3 candidates[3];
+    int count = roundEndpoints(round, candidates);
+    if (count == 2) {
+        float t = vec3_dot(vec3_sub(box->center, round->center), round->axis);
+        for (int iteration = 0; iteration < 2; ++iteration) {
+            t = fmaxf(-round->half, fminf(round->half, t));
+            Vec3 nearest = obbClosestPoint(box, vec3_add(round->center, vec3_mul_scalar(round->axis, t)));
+            t = vec3_dot(vec3_sub(nearest, round->center), round->axis);
+        }
+        if (fabsf(t) < round->half) candidates[count++] = vec3_add(round->center, vec3_mul_scalar(round->axis, t));
+    }
+
+    ContactPoint points[3];
+    Vec3 normals[3];
+    int hits = 0;
+    int deepest = 0;
+    for (int k = 0; k < count; ++k) {
+        if (!sphereObbContact(candidates[k], round->radius, box, &normals[hits], &points[hits])) continue;
+        points[hits].feature = k;
+        if (points[hits].depth > points[deepest].depth) deepest = hits;
+        hits++;
+    }
+    if (hits == 0) return false;
+
+    m->normal = normals[deepest];
+    m->pointCount = 0;
+    for (int k = 0; k < hits; ++k) {
+        if (vec3_dot(normals[k], m->normal) > ROUND_MANIFOLD_COSINE) m->points[m->pointCount++] = points[k];
+    }
+    return true;
+}
+
+static void sortContactsByDepth(ContactPoint* points, int count) {
+    for (int k = 1; k < count; ++k) {
+        ContactPoint key = points[k];
+        int j = k - 1;
+        while (j >= 0 && points[j].depth < key.depth) {
+            points[j + 1] = points[j];
+            --j;
+        }
+        points[j + 1] = key;
+    }
+}
+
+static int reduceContacts(ContactPoint* points, int count, Vec3 normal) {
+    if (count <= MAX_MANIFOLD_POINTS) return count;
+
+    ContactPoint kept[MAX_MANIFOLD_POINTS];
+    int deepest = 0;
+    for (int k = 1; k < count; ++k) {
+        if (points[k].depth > points[deepest].depth) deepest = k;
+    }
+    kept[0] = points[deepest];
+
+    int farthest = 0;
+    float best = -1.0f;
+    for (int k = 0; k < count; ++k) {
+        Vec3 d = vec3_sub(points[k].position, kept[0].position);
+        float distSq = vec3_dot(d, d);
+        if (distSq > best) {
+            best = distSq;
+            farthest = k;
+        }
+    }
+    kept[1] = points[farthest];
+
+    int positive = 0, negative = 0;
+    float maxArea = 0.0f, minArea = 0.0f;
+    Vec3 edge = vec3_sub(kept[1].position, kept[0].position);
+    for (int k = 0; k < count; ++k) {
+        Vec3 d = vec3_sub(points[k].position, kept[0].position);
+        float area = vec3_dot(vec3_cross(edge, d), normal);
+        if (area > maxArea) {
+            maxArea = area;
+            positive = k;
+        }
+        if (area < minArea) {
+            minArea = area;
+            negative = k;
+        }
+    }
+    kept[2] = points[positive];
+    kept[3] = points[negative];
+
+    for (int k = 0; k < MAX_MANIFOLD_POINTS; ++k) {
+        points[k] = kept[k];
+    }
+    return MAX_MANIFOLD_POINTS;
+}
+
+bool boxPlaneManifold(const Obb* box, Vec3 planeNormal, float planeOffset, ContactManifold* m) {
+    ContactPoint points[8];
+    int count = 0;
+    for (int v = 0; v < 8; ++v) {
+        Vec3 p = box->center;
+        for (int k = 0; k < 3; ++k) {
+            float sign = (v >> k) & 1 ? 1.0f : -1.0f;
+            p = vec3_add(p, vec3_mul_scalar(box->axis[k], sign * box->extent[k]));
+        }
+        float distance = vec3_dot(planeNormal, p) - planeOffset;
+        if (distance < 0.0f) {
+            points[count].position = p;
+            points[count].depth = -distance;
+            points[count].feature = v;
+            count++;
+        }
+    }
+    if (count == 0) return false;
+
+    sortContactsByDepth(points, count);
+    if (count > MAX_MANIFOLD_POINTS) count = MAX_MANIFOLD_POINTS;
+    m->normal = vec3_mul_scalar(planeNormal, -1.0f);
+    m->pointCount = count;
+    for (int k = 0; k < count; ++k) {
+        m->points[k] = points[k];
+    }
+    return true;
+}
+
+static inline int terrainIndex(const Heightfield* terrain, int x, int z) {
+    return z * terrain->width + x;
+}
+
+/* Bilinear height and vertex-normal blend at (x, z). The cell is found with one
+ * multiply and a floor, so the cost does not depend on the terrain resolution. */
+static bool terrainSample(const Heightfield* terrain, float x, float z, float* height, Vec3* normal) {
+    float fx = (x - terrain->originX) * terrain->invCellSize;
+    float fz = (z - terrain->originZ) * terrain->invCellSize;
+    if (fx < 0.0f || fz < 0.0f || fx > (float)(terrain->width - 1) || fz > (float)(terrain->depth - 1)) return false;
+    int cx = (int)fx < terrain->width - 2 ? (int)fx : terrain->width - 2;
+    int cz = (int)fz < terrain->depth - 2 ? (int)fz : terrain->depth - 2;
+    float tx = fx - (float)cx;
+    float tz = fz - (float)cz;
+    int i00 = terrainIndex(terrain, cx, cz);
+    int i10 = i00 + 1;
+    int i01 = i00 + terrain->width;
+    int i11 = i01 + 1;
+    float w00 = (1.0f - tx) * (1.0f - tz), w10 = tx * (1.0f - tz);
+    float w01 = (1.0f - tx) * tz, w11 = tx * tz;
+    *height = terrain->heights[i00] * w00 + terrain->heights[i10] * w10 +
+              terrain->heights[i01] * w01 + terrain->heights[i11] * w11;
+    *normal = vec3_normalize(vec3_create(
+        terrain->normalX[i00] * w00 + terrain->normalX[i10] * w10 + terrain->normalX[i01] * w01 + terrain->normalX[i11] * w11,
+        terrain->normalY[i00] * w00 + terrain->normalY[i10] * w10 + terrain->normalY[i01] * w01 + terrain->normalY[i11] * w11,
+        terrain->normalZ[i00] * w00 + terrain->normalZ[i10] * w10 + terrain->normalZ[i01] * w01 + terrain->normalZ[i11] * w11));
+    return true;
+}
+
+/* Terrain samples inside a box, for bumps narrower than a face that its
+ * vertices step over. A sample pushes the box out through the face nearest to
+ * it, so a spike beside a box shoves it sideways instead of lifting it over;
+ * each face collects its samples into one manifold. Samples whose height along
+ * normal is at most above are already held off by the vertex contacts. */
+static void collideTerrainSamples(int body, const Obb* box, Vec3 normal, float above, ManifoldList* out) {
+    const Heightfield* terrain = &g_terrain;
+    float reachX = 0.0f, reachY = 0.0f, reachZ = 0.0f;
+    for (int k = 0; k < 3; ++k) {
+        reachX += box->extent[k] * fabsf(box->axis[k].x);
+        reachY += box->extent[k] * fabsf(box->axis[k].y);
+        reachZ += box->extent[k] * fabsf(box->axis[k].z);
+    }
+    float bottom = box->center.y - reachY;
+    int x0 = (int)ceilf((box->center.x - reachX - terrain->originX) * terrain->invCellSize);
+    int x1 = (int)floorf((box->center.x + reachX - terrain->originX) * terrain->invCellSize);
+    int z0 = (int)ceilf((box->center.z - reachZ - terrain->originZ) * terrain->invCellSize);
+    int z1 = (int)floorf((box->center.z + reachZ - terrain->originZ) * terrain->invCellSize);
+    if (x0 < 0) x0 = 0;
+    if (z0 < 0) z0 = 0;
+    if (x1 > terrain->width - 1) x1 = terrain->width - 1;
+    if (z1 > terrain->depth - 1) z1 = terrain->depth - 1;
+
+    ContactPoint points[6][TERRAIN_FOOTPRINT_POINTS];
+    int counts[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int z = z0; z <= z1; ++z) {
+        for (int x = x0; x <= x1; ++x) {
+            int index = terrainIndex(terrain, x, z);
+            if (terrain->heights[index] <= bottom) continue;
+            Vec3 p = vec3_create(terrain->originX + (float)x * terrain->cellSize, terrain->heights[index],
+                                 terrain->originZ + (float)z * terrain->cellSize);
+            if (vec3_dot(normal, p) <= above) continue;
+            Vec3 d = vec3_sub(p, box->center);
+            int face = -1;
+            float depth = INFINITY;
+            for (int k = 0; k < 3; ++k) {
+                float along = vec3_dot(d, box->axis[k]);
+                float gap = box->extent[k] - fabsf(along);
+                if (gap < 0.0f) {
+                    face = -1;
+                    break;
+                }
+                if (gap < depth) {
+                    depth = gap;
+                    face = k * 2 + (along > 0.0f);
+                }
+            }
+            if (face < 0) continue;
+
+            ContactPoint* facePoints = points[face];
+            int slot = counts[face];
+            if (slot == TERRAIN_FOOTPRINT_POINTS) {
+                slot = 0;
+                for (int k = 1; k < TERRAIN_FOOTPRINT_POINTS; ++k) {
+                    if (facePoints[k].depth < facePoints[slot].depth) slot = k;
+                }
+                if (facePoints[slot].depth >= depth) continue;
+            } else {
+                counts[face]++;
+            }
+            facePoints[slot].position = p;
+            facePoints[slot].depth = depth;
+            facePoints[slot].feature = TERRAIN_FEATURE_BASE + 8 + index % TERRAIN_SAMPLE_FEATURES;
+        }
+    }
+
+    for (int face = 0; face < 6; ++face) {
+        if (counts[face] == 0) continue;
+        Vec3 faceNormal = vec3_mul_scalar(box->axis[face >> 1], face & 1 ? 1.0f : -1.0f);
+        ContactManifold m;
+        m.a = body;
+        m.b = -1;
+        m.normal = faceNormal;
+        m.pointCount = reduceContacts(points[face], counts[face], faceNormal);
+        for (int k = 0; k < m.pointCount; ++k) {
+            m.points[k] = points[face][k];
+        }
+        *manifoldListPush(out) = m;
+    }
+}
+
+/* Box vertices below the surface become contacts. The manifold normal is the
+ * depth-weighted blend of the surface normals under those vertices, so a cube
+ * resting across a slope sees one consistent contact plane. */
+void collideTerrain(int body, const Obb* box, ManifoldList* out) {
+    const Heightfield* terrain = &g_terrain;
+    ContactPoint points[8];
+    float heightGap[8];
+    Vec3 blended = vec3_create(0.0f, 0.0f, 0.0f);
+    int count = 0;
+    for (int v = 0; v < 8; ++v) {
+        Vec3 p = box->center;
+        for (int k = 0; k < 3; ++k) {
+            float sign = (v >> k) & 1 ? 1.0f : -1.0f;
+            p = vec3_add(p, vec3_mul_scalar(box->axis[k], sign * box->extent[k]));
+        }
+        float height;
+        Vec3 normal;
+        if (!terrainSample(terrain, p.x, p.z, &height, &normal) || p.y >= height) continue;
+        points[count].position = p;
+        points[count].feature = TERRAIN_FEATURE_BASE + v;
+        heightGap[count] = height - p.y;
+        blended = vec3_add(blended, vec3_mul_scalar(normal, heightGap[count]));
+        count++;
+    }
+
+    /* Samples deeper than the vertex contacts' plane are bumps the vertices
+     * stepped over; with no vertex contacts any sample inside the box is one. */
+    Vec3 normal = vec3_create(0.0f, 1.0f, 0.0f);
+    float lowest = -INFINITY;
+    float deepest = 0.0f;
+    if (count > 0) {
+        normal = vec3_normalize(blended);
+        for (int k = 0; k < count; ++k) {
+            points[k].depth = heightGap[k] * normal.y;
+            deepest = fmaxf(deepest, points[k].depth);
+        }
+        sortContactsByDepth(points, count);
+        if (count > MAX_MANIFOLD_POINTS) count = MAX_MANIFOLD_POINTS;
+
+        ContactManifold m;
+        m.a = body;
+        m.b = -1;
+        m.normal = vec3_mul_scalar(normal, -1.0f);
+        m.pointCount = count;
+        for (int k = 0; k < count; ++k) {
+            m.points[k] = points[k];
+        }
+        *manifoldListPush(out) = m;
+
+        lowest = vec3_dot(normal, box->center);
+        for (int k = 0; k < 3; ++k) {
+            lowest -= box->extent[k] * fabsf(vec3_dot(normal, box->axis[k]));
+        }
+    }
+    collideTerrainSamples(body, box, normal, lowest + deepest + PENETRATION_SLOP, out);
+}
+
+/* Each end of the core segment below the plane by more than the radius is a
+ * contact, placed halfway between the shape's surface and the plane. */
+void collideRoundPlane(int body, int plane, const RoundShape* round, ManifoldList* out) {
+    const StaticColliders* statics = &g_statics;
+    Vec3 normal = vec3_create(statics->planeNX[plane], statics->planeNY[plane], statics->planeNZ[plane]);
+    Vec3 ends[2];
+    int count = roundEndpoints(round, ends);
+    ContactManifold m;
+    m.pointCount = 0;
+    for (int k = 0; k < count; ++k) {
+        float distance = vec3_dot(normal, ends[k]) - statics->planeOffset[plane] - round->radius;
+        if (distance >= 0.0f) continue;
+        ContactPoint* point = &m.points[m.pointCount++];
+        point->position = vec3_sub(ends[k], vec3_mul_scalar(normal, round->radius + 0.5f * distance));
+        point->depth = -distance;
+        point->feature = plane * 8 + k;
+    }
+    if (m.pointCount == 0) return;
+    m.a = body;
+    m.b = -1;
+    m.normal = vec3_mul_scalar(normal, -1.0f);
+    *manifoldListPush(out) = m;
+}
+
+void collideRoundBox(int body, int index, const RoundShape* round, ManifoldList* out) {
+    ContactManifold m;
+    if (!roundObbManifold(round, &g_statics.boxes[index], &m)) return;
+    m.a = body;
+    m.b = -1;
+    for (int k = 0; k < m.pointCount; ++k) {
+        m.points[k].feature += STATIC_BOX_FEATURE_BASE + index * STATIC_BOX_FEATURE_STRIDE;
+    }
+    *manifoldListPush(out) = m;
+}
+
+/* Each segment end is tested against the surface at its closest point: starting
+ * under the end, the probe moves to the foot of the perpendicular onto the
+ * tangent plane it samples, so a sphere on a slope touches where the slope
+ * faces it rather than straight below its center. */
+void collideRoundTerrain(int body, const RoundShape* round, ManifoldList* out) {
+    const Heightfield* terrain = &g_terrain;
+    Vec3 ends[2];
+    int count = roundEndpoints(round, ends);
+    Vec3 blended = vec3_create(0.0f, 0.0f, 0.0f);
+    ContactManifold m;
+    m.pointCount = 0;
+    for (int k = 0; k < count; ++k) {
+        float height;
+        Vec3 normal;
+        float probeX = ends[k].x, probeZ = ends[k].z;
+        if (!terrainSample(terrain, probeX, probeZ, &height, &normal)) continue;
+        float distance = 0.0f;
+        bool sampled = true;
+        for (int iteration = 0; ; ++iteration) {
+            distance = vec3_dot(normal, vec3_sub(ends[k], vec3_create(probeX, height, probeZ)));
+            if (iteration == TERRAIN_CLOSEST_POINT_ITERATIONS) break;
+            probeX = ends[k].x - normal.x * distance;
+            probeZ = ends[k].z - normal.z * distance;
+            if (!terrainSample(terrain, probeX, probeZ, &height, &normal)) {
+                sampled = false;
+                break;
+            }
+        }
+        if (!sampled) continue;
+        distance -= round->radius;
+        if (distance >= 0.0f) continue;
+        ContactPoint* point = &m.points[m.pointCount++];
+        point->position = vec3_sub(ends[k], vec3_mul_scalar(normal, round->radius + 0.5f * distance));
+        point->depth = -distance;
+        point->feature = TERRAIN_FEATURE_BASE + k;
+        blended = vec3_add(blended, vec3_mul_scalar(normal, -distance));
+    }
+    if (m.pointCount == 0) return;
+    m.a = body;
+    m.b = -1;
+    m.normal = vec3_mul_scalar(vec3_normalize(blended), -1.0f);
+    *manifoldListPush(out) = m;
+}
+
+/* Terrain files are raw 16-bit little-endian samples in row-major order (rows
+ * along +z). Sample 0 sits on the ground plane and 65535 at --terrain-height
+ * above it; the grid is centered on the origin and spans --terrain-scale in x. */
+void loadTerrain() {
+    Heightfield* terrain = &g_terrain;
+    if (terrain->path == NULL) return;
+
+    FILE* file = fopen(terrain->path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open terrain file '%s'.\n", terrain->path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long bytes = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (terrain->width == 0) {
+        int side = (int)lround(sqrt((double)(bytes / 2)));
+        if ((long)side * side * 2 != bytes || side < 2) {
+            fprintf(stderr, "Error: Terrain file '%s' is not a square grid; pass --terrain-size WxH.\n", terrain->path);
+            exit(1);
+        }
+        terrain->width = side;
+        terrain->depth = side;
+    }
+    size_t samples = (size_t)terrain->width * (size_t)terrain->depth;
+    if ((size_t)bytes < samples * 2) {
+        fprintf(stderr, "Error: Terrain file '%s' holds %ld bytes, %dx%d needs %zu.\n",
+                terrain->path, bytes, terrain->width, terrain->depth, samples * 2);
+        exit(1);
+    }
+
+    unsigned char* raw = (unsigned char*)malloc(samples * 2);
+    terrain->heights = (float*)malloc(sizeof(float) * samples);
+    terrain->normalX = (float*)malloc(sizeof(float) * samples);
+    terrain->normalY = (float*)malloc(sizeof(float) * samples);
+    terrain->normalZ = (float*)malloc(sizeof(float) * samples);
+    if (raw == NULL || terrain->heights == NULL || terrain->normalX == NULL ||
+        terrain->normalY == NULL || terrain->normalZ == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    if (fread(raw, 2, samples, file) != samples) {
+        fprintf(stderr, "Error: Could not read terrain file '%s'.\n", terrain->path);
+        exit(1);
+    }
+    fclose(file);
+
+    if (terrain->horizontalScale <= 0.0f) {
+        float halfWidth = g_statics.arenaHalfWidth > 0.0f ? g_statics.arenaHalfWidth : DEFAULT_ARENA_HALF_WIDTH;
+        terrain->horizontalScale = 2.0f * halfWidth;
+    }
+    terrain->cellSize = terrain->horizontalScale / (float)(terrain->width - 1);
+    terrain->invCellSize = 1.0f / terrain->cellSize;
+    terrain->originX = -0.5f * terrain->cellSize * (float)(terrain->width - 1);
+    terrain->originZ = -0.5f * terrain->cellSize * (float)(terrain->depth - 1);
+
+    float heightPerUnit = terrain->heightScale / 65535.0f;
+    terrain->minY = 3.4e38f;
+    terrain->maxY = -3.4e38f;
+    for (size_t i = 0; i < samples; ++i) {
+        float h = g_statics.groundY + (float)(raw[i * 2] | raw[i * 2 + 1] << 8) * heightPerUnit;
+        terrain->heights[i] = h;
+        terrain->minY = fminf(terrain->minY, h);
+        terrain->maxY = fmaxf(terrain->maxY, h);
+    }
+    free(raw);
+
+    /* Vertex normals from central differences, one-sided on the border. */
+    for (int z = 0; z < terrain->depth; ++z) {
+        int z0 = z > 0 ? z - 1 : z, z1 = z < terrain->depth - 1 ? z + 1 : z;
+        for (int x = 0; x < terrain->width; ++x) {
+            int x0 = x > 0 ? x - 1 : x, x1 = x < terrain->width - 1 ? x + 1 : x;
+            float dx = (terrain->heights[terrainIndex(terrain, x1, z)] - terrain->heights[terrainIndex(terrain, x0, z)]) /
+                       ((float)(x1 - x0) * terrain->cellSize);
+            float dz = (terrain->heights[terrainIndex(terrain, x, z1)] - terrain->heights[terrainIndex(terrain, x, z0)]) /
+                       ((float)(z1 - z0) * terrain->cellSize);
+            Vec3 normal = vec3_normalize(vec3_create(-dx, 1.0f, -dz));
+            int i = terrainIndex(terrain, x, z);
+            terrain->normalX[i] = normal.x;
+            terrain->normalY[i] = normal.y;
+            terrain->normalZ[i] = normal.z;
+        }
+    }
+}
+
+/* Entry time of the segment start + t * motion, t in [0, 1], into the box
+ * [-extent, extent]. Returns 1 when the segment misses the box or starts inside
+ * it; a body that already overlaps is left to the discrete contacts. */
+static float segmentEntryTime(Vec3 start, Vec3 motion, Vec3 extent) {
+    const float s[3] = { start.x, start.y, start.z };
+    const float d[3] = { motion.x, motion.y, motion.z };
+    const float e[3] = { extent.x, extent.y, extent.z };
+    float enter = 0.0f, exit = 1.0f;
+    bool inside = true;
+    for (int k = 0; k < 3; ++k) {
+        if (fabsf(s[k]) > e[k]) inside = false;
+        if (d[k] == 0.0f) {
+            if (fabsf(s[k]) > e[k]) return 1.0f;
+            continue;
+        }
+        float inv = 1.0f / d[k];
+        float t0 = (-e[k] - s[k]) * inv;
+        float t1 = (e[k] - s[k]) * inv;
+        if (t0 > t1) {
+            float swap = t0;
+            t0 = t1;
+            t1 = swap;
+        }
+        enter = fmaxf(enter, t0);
+        exit = fminf(exit, t1);
+        if (enter > exit) return 1.0f;
+    }
+    return inside ? 1.0f : enter;
+}
+
+/* Time of impact of a fast body against static geometry over the step it just
+ * integrated. Each test finds when the body gets CCD_TARGET_PENETRATION of its
+ * half size into a collider, so after clamping the discrete narrowphase sees a
+ * real contact on the next step instead of a body that already passed through. */
+static float staticTimeOfImpact(int i) {
+    World* w = &g_world;
+    const StaticColliders* statics = &g_statics;
+    Vec3 p0 = vec3_create(w->sweepX[i], w->sweepY[i], w->sweepZ[i]);
+    Vec3 p1 = vec3_create(w->posX[i], w->posY[i], w->posZ[i]);
+    Vec3 motion = vec3_sub(p1, p0);
+    float halfSize = w->size[i] * 0.5f;
+    float target = CCD_TARGET_PENETRATION * halfSize;
+    float toi = 1.0f;
+
+    float r[9];
+    bodyRotationMatrix(i, r);
+    RoundShape round;
+    computeBodyRound(i, &round);
+    for (int p = 0; p < statics->planeCount; ++p) {
+        Vec3 n = vec3_create(statics->planeNX[p], statics->planeNY[p], statics->planeNZ[p]);
+        float radius = halfSize * (fabsf(n.x * r[0] + n.y * r[3] + n.z * r[6]) +
+                                   fabsf(n.x * r[1] + n.y * r[4] + n.z * r[7]) +
+                                   fabsf(n.x * r[2] + n.y * r[5] + n.z * r[8]));
+        if (w->shape[i] != SHAPE_BOX) radius = fabsf(vec3_dot(n, round.axis)) * round.half + round.radius;
+        float d0 = vec3_dot(n, p0) - statics->planeOffset[p] - radius + target;
+        float d1 = vec3_dot(n, p1) - statics->planeOffset[p] - radius + target;
+        if (d0 > 0.0f && d1 < 0.0f) toi = fminf(toi, d0 / (d0 - d1));
+    }
+
+    for (int k = 0; k < statics->boxCount; ++k) {
+        const Vec3* e = &statics->boxHalfExtent[k];
+        float core = halfSize - CCD_TARGET_PENETRATION * fminf(halfSize, fminf(e->x, fminf(e->y, e->z)));
+        Vec3 extent = vec3_create(e->x + core, e->y + core, e->z + core);
+        toi = fminf(toi, segmentEntryTime(vec3_sub(p0, statics->boxes[k].center), motion, extent));
+    }
+
+    const Heightfield* terrain = &g_terrain;
+    float height;
+    Vec3 normal;
+    if (terrain->heights != NULL && terrainSample(terrain, p1.x, p1.z, &height, &normal) &&
+        p1.y - halfSize + target < height && terrainSample(terrain, p0.x, p0.z, &height, &normal) &&
+        p0.y - halfSize + target >= height) {
+        float lo = 0.0f, hi = 1.0f;
+        for (int iteration = 0; iteration < CCD_TERRAIN_ITERATIONS; ++iteration) {
+            float mid = 0.5f * (lo + hi);
+            Vec3 p = vec3_add(p0, vec3_mul_scalar(motion, mid));
+            bool above = !terrainSample(terrain, p.x, p.z, &height, &normal) || p.y - halfSize + target >= height;
+            if (above) lo = mid;
+            else hi = mid;
+        }
+        toi = fminf(toi, lo);
+    }
+    return toi;
+}
+
+static inline Aabb sweptBodyAabb(int i) {
+    const World* w = &g_world;
+    float reach = bodyBoundingExtent(i);
+    Aabb box;
+    box.minX = fminf(w->posX[i], w->sweepX[i]) - reach;
+    box.minY = fminf(w->posY[i], w->sweepY[i]) - reach;
+    box.minZ = fminf(w->posZ[i], w->sweepZ[i]) - reach;
+    box.maxX = fmaxf(w->posX[i], w->sweepX[i]) + reach;
+    box.maxY = fmaxf(w->posY[i], w->sweepY[i]) + reach;
+    box.maxZ = fmaxf(w->posZ[i], w->sweepZ[i]) + reach;
+    return box;
+}
+
+static int compareFastBodies(const void* a, const void* b) {
+    const FastBody* fa = (const FastBody*)a;
+    const FastBody* fb = (const FastBody*)b;
+    if (fa->swept.minX != fb->swept.minX) return fa->swept.minX < fb->swept.minX ? -1 : 1;
+    return fa->body - fb->body;
+}
+
+/* Body-body sweeps. Fast bodies are sorted by swept min x; one SIMD pass over
+ * every body rejects those outside the union of the fast sweeps, and the rest
+ * binary-search the sorted list, so the cost is O(N + F log F) rather than N per
+ * fast body. Each fast body keeps the minimum time of impact it sees. */
+static void bodyTimesOfImpact(ContinuousCollision* ccd) {
+    World* w = &g_world;
+    FastBody* fast = ccd->fast;
+    int count = ccd->fastCount;
+    qsort(fast, (size_t)count, sizeof(FastBody), compareFastBodies);
+
+    Aabb bounds = fast[0].swept;
+    float widest = 0.0f;
+    for (int k = 0; k < count; ++k) {
+        const Aabb* b = &fast[k].swept;
+        bounds.minX = fminf(bounds.minX, b->minX);
+        bounds.minY = fminf(bounds.minY, b->minY);
+        bounds.minZ = fminf(bounds.minZ, b->minZ);
+        bounds.maxX = fmaxf(bounds.maxX, b->maxX);
+        bounds.maxY = fmaxf(bounds.maxY, b->maxY);
+        bounds.maxZ = fmaxf(bounds.maxZ, b->maxZ);
+        widest = fmaxf(widest, b->maxX - b->minX);
+    }
+
+    const vfloat loX = vf_set1(bounds.minX), hiX = vf_set1(bounds.maxX);
+    const vfloat loY = vf_set1(bounds.minY), hiY = vf_set1(bounds.maxY);
+    const vfloat loZ = vf_set1(bounds.minZ), hiZ = vf_set1(bounds.maxZ);
+    const vfloat boundingScale = vf_set1(BOUNDING_EXTENT_SCALE);
+    for (int base = 0; base < w->count; base += SIMD_WIDTH) {
+        vfloat px = vf_load(w->posX + base), qx = vf_load(w->sweepX + base);
+        vfloat py = vf_load(w->posY + base), qy = vf_load(w->sweepY + base);
+        vfloat pz = vf_load(w->posZ + base), qz = vf_load(w->sweepZ + base);
+        vfloat extent = vf_mul(vf_load(w->size + base), boundingScale);
+        vmask hit = vf_lt(vf_sub(vf_select(vf_lt(px, qx), px, qx), extent), hiX);
+        hit = vm_and(hit, vf_gt(vf_add(vf_select(vf_gt(px, qx), px, qx), extent), loX));
+        hit = vm_and(hit, vf_lt(vf_sub(vf_select(vf_lt(py, qy), py, qy), extent), hiY));
+        hit = vm_and(hit, vf_gt(vf_add(vf_select(vf_gt(py, qy), py, qy), extent), loY));
+        hit = vm_and(hit, vf_lt(vf_sub(vf_select(vf_lt(pz, qz), pz, qz), extent), hiZ));
+        hit = vm_and(hit, vf_gt(vf_add(vf_select(vf_gt(pz, qz), pz, qz), extent), loZ));
+        int lanes = w->count - base < SIMD_WIDTH ? w->count - base : SIMD_WIDTH;
+        unsigned bits = vm_bits(hit) & (0xffffffffu >> (32 - lanes));
+        while (bits) {
+            int j = base + __builtin_ctz(bits);
+            bits &= bits - 1;
+            Aabb other = sweptBodyAabb(j);
+            int lo = 0, hi = count;
+            while (lo < hi) {
+                int mid = (lo + hi) >> 1;
+                if (fast[mid].swept.minX <= other.maxX) lo = mid + 1;
+                else hi = mid;
+            }
+            float otherHalf = w->size[j] * 0.5f;
+            Vec3 q0 = vec3_create(w->sweepX[j], w->sweepY[j], w->sweepZ[j]);
+            Vec3 otherMotion = vec3_sub(vec3_create(w->posX[j], w->posY[j], w->posZ[j]), q0);
+            for (int k = lo - 1; k >= 0 && fast[k].swept.minX >= other.minX - widest; --k) {
+                int i = fast[k].body;
+                if (i == j || !aabbOverlaps(&fast[k].swept, &other)) continue;
+                float halfSize = w->size[i] * 0.5f;
+                float core = halfSize + otherHalf - CCD_TARGET_PENETRATION * fminf(halfSize, otherHalf);
+                Vec3 p0 = vec3_create(w->sweepX[i], w->sweepY[i], w->sweepZ[i]);
+                Vec3 motion = vec3_sub(vec3_create(w->posX[i], w->posY[i], w->posZ[i]), p0);
+                float toi = segmentEntryTime(vec3_sub(p0, q0), vec3_sub(motion, otherMotion), vec3_create(core, core, core));
+                fast[k].toi = fminf(fast[k].toi, toi);
+            }
+        }
+    }
+}
+
+/* Runs after integration. Bodies that moved more than --ccd times their half
+ * size this step are swept against everything and pulled back to their time of
+ * impact; velocities are kept so the next step's contacts resolve the hit. */
+void continuousCollisionTask(int begin, int end, int slice, void* context) {
+    World* w = &g_world;
+    ContinuousCollision* ccd = &g_ccd;
+    const int* list = awakeStreamList(w);
+    const vfloat threshold = vf_set1(0.5f * g_ccdThreshold);
+
+    ccd->fastCount = 0;
+    for (int base = 0; base < w->awakeCount; base += SIMD_WIDTH) {
+        vfloat dx = vf_sub(streamLoad(w->posX, list, base), streamLoad(w->sweepX, list, base));
+        vfloat dy = vf_sub(streamLoad(w->posY, list, base), streamLoad(w->sweepY, list, base));
+        vfloat dz = vf_sub(streamLoad(w->posZ, list, base), streamLoad(w->sweepZ, list, base));
+        vfloat limit = vf_mul(streamLoad(w->size, list, base), threshold);
+        vfloat distanceSq = vf_fmadd(dx, dx, vf_fmadd(dy, dy, vf_mul(dz, dz)));
+        int lanes = w->awakeCount - base < SIMD_WIDTH ? w->awakeCount - base : SIMD_WIDTH;
+        unsigned bits = vm_bits(vf_gt(distanceSq, vf_mul(limit, limit))) & (0xffffffffu >> (32 - lanes));
+        while (bits) {
+            int lane = __builtin_ctz(bits);
+            bits &= bits - 1;
+            reserveArray((void**)&ccd->fast, sizeof(FastBody), &ccd->fastCapacity, ccd->fastCount + 1);
+            FastBody* entry = &ccd->fast[ccd->fastCount++];
+            entry->body = awakeBody(w, list, base + lane);
+            entry->toi = staticTimeOfImpact(entry->body);
+            entry->swept = sweptBodyAabb(entry->body);
+        }
+    }
+    if (ccd->fastCount == 0) return;
+
+    bodyTimesOfImpact(ccd);
+    for (int k = 0; k < ccd->fastCount; ++k) {
+        int i = ccd->fast[k].body;
+        float toi = ccd->fast[k].toi;
+        if (toi >= 1.0f) continue;
+        w->posX[i] = w->sweepX[i] + (w->posX[i] - w->sweepX[i]) * toi;
+        w->posY[i] = w->sweepY[i] + (w->posY[i] - w->sweepY[i]) * toi;
+        w->posZ[i] = w->sweepZ[i] + (w->posZ[i] - w->sweepZ[i]) * toi;
+        ccd->clampedTotal++;
+    }
+    ccd->fastTotal += ccd->fastCount;
+}
+
+/* Each polygon vertex carries a mask of the two lines it lies on: bits 0-3 are
+ * the incident face's edges, bits 4-7 the reference face's side planes. A
+ * vertex cut from an edge lies on that edge's line and on the clip plane. */
+static int clipPolygonAgainstPlane(const Vec3* in, const uint8_t* inLines, int count, Vec3 normal, float offset,
+                                   int plane, Vec3* out, uint8_t* outLines) {
+    int outCount = 0;
+    for (int k = 0; k < count; ++k) {
+        Vec3 a = in[k];
+        Vec3 b = in[(k + 1) % count];
+        float da = vec3_dot(normal, a) - offset;
+        float db = vec3_dot(normal, b) - offset;
+        if (da <= 0.0f) {
+            outLines[outCount] = inLines[k];
+            out[outCount++] = a;
+        }
+        if ((da < 0.0f && db > 0.0f) || (da > 0.0f && db < 0.0f)) {
+            float t = da / (da - db);
+            uint8_t shared = inLines[k] & inLines[(k + 1) % count];
+            if (shared == 0) shared = inLines[k];
+            outLines[outCount] = (uint8_t)((shared & -shared) | (1u << plane));
+            out[outCount++] = vec3_add(a, vec3_mul_scalar(vec3_sub(b, a), t));
+        }
+    }
+    return outCount;
+}
+
+/* Clips the incident face against the reference face's sides. A point's
+ * feature names the incident face and the two lines it was cut from, so it
+ * keeps its key while the clipping topology holds, whatever the polygon's
+ * vertex order. */
+static int faceContacts(const Obb* ref, const Obb* inc, int refAxis, Vec3 normal, int featureBase, ContactPoint* points) {
+    int incAxis = 0;
+    float best = -1.0f;
+    for (int k = 0; k < 3; ++k) {
+        float d = fabsf(vec3_dot(inc->axis[k], normal));
+        if (d > best) {
+            best = d;
+            incAxis = k;
+        }
+    }
+    float incSign = vec3_dot(inc->axis[incAxis], normal) > 0.0f ? -1.0f : 1.0f;
+    int incFace = incAxis * 2 + (incSign > 0.0f);
+    int u = (incAxis + 1) % 3;
+    int v = (incAxis + 2) % 3;
+    Vec3 faceCenter = vec3_add(inc->center, vec3_mul_scalar(inc->axis[incAxis], incSign * inc->extent[incAxis]));
+    Vec3 du = vec3_mul_scalar(inc->axis[u], inc->extent[u]);
+    Vec3 dv = vec3_mul_scalar(inc->axis[v], inc->extent[v]);
+
+    Vec3 polygon[16];
+    Vec3 clipped[16];
+    uint8_t polygonLines[16];
+    uint8_t clippedLines[16];
+    polygon[0] = vec3_add(vec3_add(faceCenter, du), dv);
+    polygon[1] = vec3_add(vec3_sub(faceCenter, du), dv);
+    polygon[2] = vec3_sub(vec3_sub(faceCenter, du), dv);
+    polygon[3] = vec3_sub(vec3_add(faceCenter, du), dv);
+    int count = 4;
+    for (int k = 0; k < count; ++k) {
+        polygonLines[k] = (uint8_t)((1u << k) | (1u << ((k + 3) % 4)));
+    }
+
+    for (int side = 1; side <= 2 && count > 0; ++side) {
+        int k = (refAxis + side) % 3;
+        Vec3 axis = ref->axis[k];
+        float centerDot = vec3_dot(axis, ref->center);
+        int plane = 4 + (side - 1) * 2;
+        count = clipPolygonAgainstPlane(polygon, polygonLines, count, axis, centerDot + ref->extent[k], plane,
+                                        clipped, clippedLines);
+        count = clipPolygonAgainstPlane(clipped, clippedLines, count, vec3_mul_scalar(axis, -1.0f),
+                                        -centerDot + ref->extent[k], plane + 1, polygon, polygonLines);
+    }
+
+    float refOffset = vec3_dot(normal, ref->center) + fabsf(vec3_dot(normal, ref->axis[refAxis])) * ref->extent[refAxis];
+    int contactCount = 0;
+    for (int k = 0; k < count; ++k) {
+        float depth = refOffset - vec3_dot(normal, polygon[k]);
+        if (depth < 0.0f) continue;
+        points[contactCount].position = vec3_add(polygon[k], vec3_mul_scalar(normal, depth * 0.5f));
+        points[contactCount].depth = depth;
+        points[contactCount].feature = featureBase + (incFace << 8 | polygonLines[k]);
+        contactCount++;
+    }
+    return contactCount;
+}
+
+static void closestPointsOnSegments(Vec3 p1, Vec3 d1, float e1, Vec3 p2, Vec3 d2, float e2, Vec3* c1, Vec3* c2) {
+    Vec3 r = vec3_sub(p1, p2);
+    float b = vec3_dot(d1, d2);
+    float c = vec3_dot(d1, r);
+    float f = vec3_dot(d2, r);
+    float denom = 1.0f - b * b;
+    float s = denom > 1e-6f ? (b * f - c) / denom : 0.0f;
+    s = fmaxf(-e1, fminf(e1, s));
+    float t = b * s + f;
+    t = fmaxf(-e2, fminf(e2, t));
+    s = fmaxf(-e1, fminf(e1, b * t - c));
+    *c1 = vec3_add(p1, vec3_mul_scalar(d1, s));
+    *c2 = vec3_add(p2, vec3_mul_scalar(d2, t));
+}
+
+#define NARROWPHASE_BATCH 16
+#define SAT_AXIS_EPSILON 1e-5f
+/* Edge-edge contacts use features 64 + edge axis; face contacts follow, one
+ * block per reference face holding the incident face and line mask. */
+#define BOX_FACE_FEATURE_BASE 128
+#define BOX_FACE_FEATURES (6 << 8)
+
+typedef struct {
+    float t[3][NARROWPHASE_BATCH];
+    float r[9][NARROWPHASE_BATCH];
+    float ea[3][NARROWPHASE_BATCH];
+    float eb[3][NARROWPHASE_BATCH];
+    float faceDepth[NARROWPHASE_BATCH];
+    int faceAxis[NARROWPHASE_BATCH];
+    float edgeDepth[NARROWPHASE_BATCH];
+    int edgeAxis[NARROWPHASE_BATCH];
+    float minDepth[NARROWPHASE_BATCH];
+} SatBatch;
+
+static void satLoadLane(SatBatch* batch, int lane, const Obb* a, const Obb* b) {
+    Vec3 d = vec3_sub(b->center, a->center);
+    for (int i = 0; i < 3; ++i) {
+        batch->t[i][lane] = vec3_dot(d, a->axis[i]);
+        batch->ea[i][lane] = a->extent[i];
+        batch->eb[i][lane] = b->extent[i];
+        for (int j = 0; j < 3; ++j) {
+            batch->r[i * 3 + j][lane] = vec3_dot(a->axis[i], b->axis[j]);
+        }
+    }
+}
+
+static void satRunBatch(SatBatch* batch, int lanes) {
+    for (int l = 0; l < lanes; ++l) {
+        batch->faceDepth[l] = 3.4e38f;
+        batch->faceAxis[l] = 0;
+        batch->edgeDepth[l] = 3.4e38f;
+        batch->edgeAxis[l] = -1;
+        batch->minDepth[l] = 3.4e38f;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        for (int l = 0; l < lanes; ++l) {
+            float rb = batch->eb[0][l] * (fabsf(batch->r[i * 3 + 0][l]) + SAT_AXIS_EPSILON) +
+                       batch->eb[1][l] * (fabsf(batch->r[i * 3 + 1][l]) + SAT_AXIS_EPSILON) +
+                       batch->eb[2][l] * (fabsf(batch->r[i * 3 + 2][l]) + SAT_AXIS_EPSILON);
+            float depth = batch->ea[i][l] + rb - fabsf(batch->t[i][l]);
+            batch->minDepth[l] = fminf(batch->minDepth[l], depth);
+            bool better = depth < batch->faceDepth[l];
+            batch->faceDepth[l] = better ? depth : batch->faceDepth[l];
+            batch->faceAxis[l] = better ? i : batch->faceAxis[l];
+        }
+    }
+
+    for (int j = 0; j < 3; ++j) {
+        for (int l = 0; l < lanes; ++l) {
+            float ra = batch->ea[0][l] * (fabsf(batch->r[0 * 3 + j][l]) + SAT_AXIS_EPSILON) +
+                       batch->ea[1][l] * (fabsf(batch->r[1 * 3 + j][l]) + SAT_AXIS_EPSILON) +
+                       batch->ea[2][l] * (fabsf(batch->r[2 * 3 + j][l]) + SAT_AXIS_EPSILON);
+            float distance = batch->t[0][l] * batch->r[0 * 3 + j][l] +
+                             batch->t[1][l] * batch->r[1 * 3 + j][l] +
+                             batch->t[2][l] * batch->r[2 * 3 + j][l];
+            float depth = ra + batch->eb[j][l] - fabsf(distance);
+            batch->minDepth[l] = fminf(batch->minDepth[l], depth);
+            bool better = depth < batch->faceDepth[l] * 0.98f - 1e-3f;
+            batch->faceDepth[l] = better ? depth : batch->faceDepth[l];
+            batch->faceAxis[l] = better ? 3 + j : batch->faceAxis[l];
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        int i1 = (i + 1) % 3;
+        int i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j) {
+            int j1 = (j + 1) % 3;
+            int j2 = (j + 2) % 3;
+            for (int l = 0; l < lanes; ++l) {
+                float ri1j = batch->r[i1 * 3 + j][l];
+                float ri2j = batch->r[i2 * 3 + j][l];
+                float length = sqrtf(ri1j * ri1j + ri2j * ri2j);
+                float ra = batch->ea[i1][l] * (fabsf(ri2j) + SAT_AXIS_EPSILON) +
+                           batch->ea[i2][l] * (fabsf(ri1j) + SAT_AXIS_EPSILON);
+                float rb = batch->eb[j1][l] * (fabsf(batch->r[i * 3 + j2][l]) + SAT_AXIS_EPSILON) +
+                           batch->eb[j2][l] * (fabsf(batch->r[i * 3 + j1][l]) + SAT_AXIS_EPSILON);
+                float distance = fabsf(batch->t[i2][l] * ri1j - batch->t[i1][l] * ri2j);
+                float depth = length > 1e-4f ? (ra + rb - distance) / length : 3.4e38f;
+                batch->minDepth[l] = fminf(batch->minDepth[l], depth);
+                bool better = depth < batch->edgeDepth[l];
+                batch->edgeDepth[l] = better ? depth : batch->edgeDepth[l];
+                batch->edgeAxis[l] = better ? i * 3 + j : batch->edgeAxis[l];
+            }
+        }
+    }
+}
+
+static bool satManifold(const Obb* a, const Obb* b, float faceDepth, int faceAxis, float edgeDepth, int edgeAxis, ContactManifold* m) {
+    Vec3 d = vec3_sub(b->center, a->center);
+    ContactPoint points[16];
+    int count;
+
+    if (edgeAxis >= 0 && edgeDepth < faceDepth * 0.95f - 0.01f) {
+        int i = edgeAxis / 3;
+        int j = edgeAxis % 3;
+        Vec3 normal = vec3_normalize(vec3_cross(a->axis[i], b->axis[j]));
+        if (vec3_dot(normal, d) < 0.0f) normal = vec3_mul_scalar(normal, -1.0f);
+
+        Vec3 pa = a->center;
+        Vec3 pb = b->center;
+        for (int k = 0; k < 3; ++k) {
+            if (k != i) {
+                float sign = vec3_dot(a->axis[k], normal) > 0.0f ? 1.0f : -1.0f;
+                pa = vec3_add(pa, vec3_mul_scalar(a->axis[k], sign * a->extent[k]));
+            }
+            if (k != j) {
+                float sign = vec3_dot(b->axis[k], normal) > 0.0f ? -1.0f : 1.0f;
+                pb = vec3_add(pb, vec3_mul_scalar(b->axis[k], sign * b->extent[k]));
+            }
+        }
+        Vec3 ca, cb;
+        closestPointsOnSegments(pa, a->axis[i], a->extent[i], pb, b->axis[j], b->extent[j], &ca, &cb);
+        m->normal = normal;
+        m->pointCount = 1;
+        m->points[0].position = vec3_mul_scalar(vec3_add(ca, cb), 0.5f);
+        m->points[0].depth = edgeDepth;
+        m->points[0].feature = 64 + edgeAxis;
+        return true;
+    }
+
+    if (faceAxis < 3) {
+        Vec3 normal = a->axis[faceAxis];
+        if (vec3_dot(normal, d) < 0.0f) normal = vec3_mul_scalar(normal, -1.0f);
+        count = faceContacts(a, b, faceAxis, normal, BOX_FACE_FEATURE_BASE + faceAxis * BOX_FACE_FEATURES, points);
+        m->normal = normal;
+    } else {
+        Vec3 normal = b->axis[faceAxis - 3];
+        if (vec3_dot(normal, d) > 0.0f) normal = vec3_mul_scalar(normal, -1.0f);
+        count = faceContacts(b, a, faceAxis - 3, normal, BOX_FACE_FEATURE_BASE + faceAxis * BOX_FACE_FEATURES, points);
+        m->normal = vec3_mul_scalar(normal, -1.0f);
+    }
+    if (count == 0) return false;
+
+    count = reduceContacts(points, count, m->normal);
+    m->pointCount = count;
+    for (int k = 0; k < count; ++k) {
+        m->points[k] = points[k];
+    }
+    return true;
+}
+
+bool boxBoxManifold(const Obb* boxA, const Obb* boxB, ContactManifold* m) {
+    SatBatch batch;
+    satLoadLane(&batch, 0, boxA, boxB);
+    satRunBatch(&batch, 1);
+    if (batch.minDepth[0] < 0.0f) return false;
+    return satManifold(boxA, boxB, batch.faceDepth[0], batch.faceAxis[0], batch.edgeDepth[0], batch.edgeAxis[0], m);
+}
+
+static void collideBoxPairs(const PairList* pairs, int begin, int end, ManifoldList* out) {
+    SatBatch batch;
+    Obb boxA[NARROWPHASE_BATCH];
+    Obb boxB[NARROWPHASE_BATCH];
+
+    for (int base = begin; base < end; base += NARROWPHASE_BATCH) {
+        int lanes = end - base < NARROWPHASE_BATCH ? end - base : NARROWPHASE_BATCH;
+        for (int l = 0; l < lanes; ++l) {
+            computeBodyObb(pairs->pairs[base + l].a, &boxA[l]);
+            computeBodyObb(pairs->pairs[base + l].b, &boxB[l]);
+            satLoadLane(&batch, l, &boxA[l], &boxB[l]);
+        }
+        satRunBatch(&batch, lanes);
+
+        for (int l = 0; l < lanes; ++l) {
+            if (batch.minDepth[l] < 0.0f) continue;
+            ContactManifold* m = manifoldListPush(out);
+            if (satManifold(&boxA[l], &boxB[l], batch.faceDepth[l], batch.faceAxis[l],
+                            batch.edgeDepth[l], batch.edgeAxis[l], m)) {
+                m->a = pairs->pairs[base + l].a;
+                m->b = pairs->pairs[base + l].b;
+            } else {
+                out->count--;
+            }
+        }
+    }
+}
+
+/* Box a against round b: roundObbManifold's normal points from b into a, so it
+ * is flipped to run from a to b like every other manifold. */
+static void collideBoxRoundPairs(const PairList* pairs, int begin, int end, ManifoldList* out) {
+    for (int k = begin; k < end; ++k) {
+        const BodyPair* pair = &pairs->pairs[k];
+        Obb box;
+        RoundShape round;
+        ContactManifold m;
+        computeBodyObb(pair->a, &box);
+        computeBodyRound(pair->b, &round);
+        if (!roundObbManifold(&round, &box, &m)) continue;
+        m.a = pair->a;
+        m.b = pair->b;
+        m.normal = vec3_mul_scalar(m.normal, -1.0f);
+        *manifoldListPush(out) = m;
+    }
+}
+
+static inline void pushRoundContact(ManifoldList* out, int a, int b, Vec3 pa, float ra, Vec3 pb, float rb) {
+    Vec3 delta = vec3_sub(pb, pa);
+    float distanceSq = vec3_dot(delta, delta);
+    if (distanceSq >= (ra + rb) * (ra + rb)) return;
+    float distance = sqrtf(distanceSq);
+    Vec3 normal = distance > 1e-6f ? vec3_mul_scalar(delta, 1.0f / distance) : vec3_create(0.0f, 1.0f, 0.0f);
+    float depth = ra + rb - distance;
+    ContactManifold* m = manifoldListPush(out);
+    m->a = a;
+    m->b = b;
+    m->normal = normal;
+    m->pointCount = 1;
+    m->points[0].position = vec3_add(pa, vec3_mul_scalar(normal, ra - 0.5f * depth));
+    m->points[0].depth = depth;
+    m->points[0].feature = 0;
+}
+
+/* Sphere pairs need only centers and sizes: one gathered SIMD distance test per
+ * batch, and only overlapping lanes build a manifold. */
+static void collideSpherePairs(const PairList* pairs, int begin, int end, ManifoldList* out) {
+    World* w = &g_world;
+    const vfloat half = vf_set1(0.5f);
+    int bodyA[SIMD_WIDTH] __attribute__((aligned(SIMD_ALIGNMENT)));
+    int bodyB[SIMD_WIDTH] __attribute__((aligned(SIMD_ALIGNMENT)));
+
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        int lanes = end - base < SIMD_WIDTH ? end - base : SIMD_WIDTH;
+        for (int l = 0; l < SIMD_WIDTH; ++l) {
+            const BodyPair* pair = &pairs->pairs[base + (l < lanes ? l : lanes - 1)];
+            bodyA[l] = pair->a;
+            bodyB[l] = pair->b;
+        }
+        vint ia = vi_load(bodyA);
+        vint ib = vi_load(bodyB);
+        vfloat dx = vf_sub(vf_gather(w->posX, ib), vf_gather(w->posX, ia));
+        vfloat dy = vf_sub(vf_gather(w->posY, ib), vf_gather(w->posY, ia));
+        vfloat dz = vf_sub(vf_gather(w->posZ, ib), vf_gather(w->posZ, ia));
+        vfloat reach = vf_mul(vf_add(vf_gather(w->size, ia), vf_gather(w->size, ib)), half);
+        vfloat distanceSq = vf_fmadd(dx, dx, vf_fmadd(dy, dy, vf_mul(dz, dz)));
+        unsigned bits = vm_bits(vf_lt(distanceSq, vf_mul(reach, reach))) & (0xffffffffu >> (32 - lanes));
+        while (bits) {
+            int l = __builtin_ctz(bits);
+            bits &= bits - 1;
+            int a = bodyA[l], b = bodyB[l];
+            pushRoundContact(out, a, b, vec3_create(w->posX[a], w->posY[a], w->posZ[a]), w->size[a] * 0.5f,
+                             vec3_create(w->posX[b], w->posY[b], w->posZ[b]), w->size[b] * 0.5f);
+        }
+    }
+}
+
+/* Pairs involving a capsule collide the closest points of the core segments. */
+static void collideRoundPairs(const PairList* pairs, int begin, int end, ManifoldList* out) {
+    for (int k = begin; k < end; ++k) {
+        const BodyPair* pair = &pairs->pairs[k];
+        RoundShape a, b;
+        Vec3 pa, pb;
+        computeBodyRound(pair->a, &a);
+        computeBodyRound(pair->b, &b);
+        closestPointsOnSegments(a.center, a.axis, a.half, b.center, b.axis, b.half, &pa, &pb);
+        pushRoundContact(out, pair->a, pair->b, pa, a.radius, pb, b.radius);
+    }
+}
+
+typedef void (*PairKernel)(const PairList* pairs, int begin, int end, ManifoldList* out);
+
+static const PairKernel PAIR_KERNELS[PAIR_KIND_COUNT] = {
+    collideBoxPairs, collideBoxRoundPairs, collideBoxRoundPairs,
+    collideSpherePairs, collideRoundPairs, collideRoundPairs
+};
+
+/* Runs each pair kind's kernel over its part of [begin, end); the pair list was
+ * grouped by kind when it was built. */
+static void collidePairGroups(const PairList* pairs, int begin, int end, ManifoldList* out) {
+    const int* start = g_pairGroups.start;
+    for (int kind = 0; kind < PAIR_KIND_COUNT; ++kind) {
+        int lo = begin > start[kind] ? begin : start[kind];
+        int hi = end < start[kind + 1] ? end : start[kind + 1];
+        if (lo < hi) PAIR_KERNELS[kind](pairs, lo, hi, out);
+    }
+}
+
+void generatePairManifolds(const PairList* pairs, ManifoldList* out) {
+    collidePairGroups(pairs, 0, pairs->count, out);
+}
+
+static inline float bodyInverseMass(int body) {
+    return body >= 0 ? g_world.invMass[body] : 0.0f;
+}
+
+static inline Vec3 bodyCenter(int body) {
+    World* w = &g_world;
+    if (body < 0) return vec3_create(0.0f, 0.0f, 0.0f);
+    return vec3_create(w->posX[body], w->posY[body], w->posZ[body]);
+}
+
+/* Radius the rolling resistance acts through: a round body's radius, or half
+ * a box's edge. */
+static inline float bodyRollingRadius(int body) {
+    if (body < 0) return 0.0f;
+    World* w = &g_world;
+    if (w->shape[body] == SHAPE_CAPSULE) return w->size[body] * CAPSULE_RADIUS_SCALE;
+    return w->size[body] * 0.5f;
+}
+
+static inline bool bodyIsRound(int body) {
+    return body >= 0 && g_world.shape[body] != SHAPE_BOX;
+}
+
+/* Gathers the body's velocities, and its inverse inertia as R * diag * R^T for
+ * the current orientation. */
+static void loadSolverBody(int body) {
+    World* w = &g_world;
+    if (body < 0) return;
+    SolverBody* out = &g_solverBodies.bodies[body];
+    out->velocity = vec3_create(w->velX[body], w->velY[body], w->velZ[body]);
+    out->angularVelocity = vec3_create(w->angVelX[body], w->angVelY[body], w->angVelZ[body]);
+    out->invMass = w->invMass[body];
+
+    float m[9];
+    bodyRotationMatrix(body, m);
+    float d[3] = { w->invInertiaX[body], w->invInertiaY[body], w->invInertiaZ[body] };
+    static const int rows[6] = { 0, 1, 2, 0, 0, 1 };
+    static const int cols[6] = { 0, 1, 2, 1, 2, 2 };
+    for (int e = 0; e < 6; ++e) {
+        const float* r = m + rows[e] * 3;
+        const float* c = m + cols[e] * 3;
+        out->invInertia[e] = r[0] * d[0] * c[0] + r[1] * d[1] * c[1] + r[2] * d[2] * c[2];
+    }
+}
+
+static inline void storeSolverBody(int body) {
+    World* w = &g_world;
+    if (body < 0) return;
+    const SolverBody* in = &g_solverBodies.bodies[body];
+    w->velX[body] = in->velocity.x;
+    w->velY[body] = in->velocity.y;
+    w->velZ[body] = in->velocity.z;
+    w->angVelX[body] = in->angularVelocity.x;
+    w->angVelY[body] = in->angularVelocity.y;
+    w->angVelZ[body] = in->angularVelocity.z;
+}
+
+static inline Vec3 applyInverseInertia(const SolverBody* body, Vec3 v) {
+    const float* I = body->invInertia;
+    return vec3_create(I[0] * v.x + I[3] * v.y + I[4] * v.z,
+                       I[3] * v.x + I[1] * v.y + I[5] * v.z,
+                       I[4] * v.x + I[5] * v.y + I[2] * v.z);
+}
+
+static inline Vec3 bodyAngularVelocity(int body) {
+    if (body < 0) return vec3_create(0.0f, 0.0f, 0.0f);
+    return g_solverBodies.bodies[body].angularVelocity;
+}
+
+/* Velocity of the material point at offset from the body's center. */
+static inline Vec3 bodyPointVelocity(int body, Vec3 offset) {
+    if (body < 0) return vec3_create(0.0f, 0.0f, 0.0f);
+    const SolverBody* b = &g_solverBodies.bodies[body];
+    return vec3_add(b->velocity, vec3_cross(b->angularVelocity, offset));
+}
+
+static inline void applyAngularImpulse(int body, Vec3 impulse) {
+    if (body < 0) return;
+    SolverBody* b = &g_solverBodies.bodies[body];
+    b->angularVelocity = vec3_add(b->angularVelocity, applyInverseInertia(b, impulse));
+}
+
+/* Applies impulse at offset from the body's center, changing both its linear
+ * and angular velocity. */
+static inline void applyImpulse(int body, Vec3 offset, Vec3 impulse) {
+    if (body < 0) return;
+    SolverBody* b = &g_solverBodies.bodies[body];
+    b->velocity = vec3_add(b->velocity, vec3_mul_scalar(impulse, b->invMass));
+    b->angularVelocity = vec3_add(b->angularVelocity, applyInverseInertia(b, vec3_cross(offset, impulse)));
+}
+
+/* Inverse of the two bodies' combined resistance to an impulse along direction
+ * at the constraint's contact point. */
+static float constraintMass(const ContactConstraint* c, Vec3 direction) {
+    float k = bodyInverseMass(c->a) + bodyInverseMass(c->b);
+    if (c->a >= 0) {
+        Vec3 arm = vec3_cross(c->offsetA, direction);
+        k += vec3_dot(arm, applyInverseInertia(&g_solverBodies.bodies[c->a], arm));
+    }
+    if (c->b >= 0) {
+        Vec3 arm = vec3_cross(c->offsetB, direction);
+        k += vec3_dot(arm, applyInverseInertia(&g_solverBodies.bodies[c->b], arm));
+    }
+    return k > 0.0f ? 1.0f / k : 0.0f;
+}
+
+/* Inverse of the two bodies' combined resistance to an angular impulse about
+ * axis. */
+static float angularMass(int a, int b, Vec3 axis) {
+    float k = 0.0f;
+    if (a >= 0) k += vec3_dot(axis, applyInverseInertia(&g_solverBodies.bodies[a], axis));
+    if (b >= 0) k += vec3_dot(axis, applyInverseInertia(&g_solverBodies.bodies[b], axis));
+    return k > 0.0f ? 1.0f / k : 0.0f;
+}
+
+static inline Vec3 constraintRelativeVelocity(const ContactConstraint* c) {
+    return vec3_sub(bodyPointVelocity(c->b, c->offsetB), bodyPointVelocity(c->a, c->offsetA));
+}
+
+static inline void applyConstraintImpulse(const ContactConstraint* c, Vec3 impulse) {
+    applyImpulse(c->a, c->offsetA, vec3_mul_scalar(impulse, -1.0f));
+    applyImpulse(c->b, c->offsetB, impulse);
+}
+
+static void contactTangents(Vec3 n, Vec3* t1, Vec3* t2) {
+    if (fabsf(n.x) >= 0.57735f) {
+        *t1 = vec3_normalize(vec3_create(n.y, -n.x, 0.0f));
+    } else {
+        *t1 = vec3_normalize(vec3_create(0.0f, n.z, -n.y));
+    }
+    *t2 = vec3_cross(n, *t1);
+}
+
+static inline uint64_t contactKey(int a, int b, int feature) {
+    return ((uint64_t)(uint32_t)(a + 1) << 40) | ((uint64_t)(uint32_t)(b + 1) << 16) | (uint64_t)(feature & 0xffff);
+}
+
+/* Orders by key, then by value, so sorting the cache has a single result. */
+static int compareCachedImpulses(const void* x, const void* y) {
+    const CachedImpulse* a = (const CachedImpulse*)x;
+    const CachedImpulse* b = (const CachedImpulse*)y;
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    if (a->normalImpulse != b->normalImpulse) return a->normalImpulse < b->normalImpulse ? -1 : 1;
+    if (a->tangentImpulse1 != b->tangentImpulse1) return a->tangentImpulse1 < b->tangentImpulse1 ? -1 : 1;
+    if (a->tangentImpulse2 != b->tangentImpulse2) return a->tangentImpulse2 < b->tangentImpulse2 ? -1 : 1;
+    return 0;
+}
+
+static const CachedImpulse* findCachedImpulse(const ImpulseCache* cache, uint64_t key) {
+    int lo = 0;
+    int hi = cache->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint64_t k = cache->entries[mid].key;
+        if (k == key) return &cache->entries[mid];
+        if (k < key) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+/* Resists the bodies' relative spin with an angular impulse bounded by the
+ * rolling limit, so spheres roll to a stop and a box balanced on a corner stops
+ * spinning instead of turning forever. */
+static void solveRollingResistance(ContactConstraint* c) {
+    Vec3 spin = vec3_sub(bodyAngularVelocity(c->b), bodyAngularVelocity(c->a));
+    float limit = c->rollingLimit * c->normalImpulse;
+    if (c->rollingAboutNormal) {
+        /* A scalar row along the normal, whose mass is fixed for the step. */
+        float previous = vec3_dot(c->rollingImpulse, c->normal);
+        float accumulated = fmaxf(-limit, fminf(limit, previous - c->spinMass * vec3_dot(spin, c->normal)));
+        c->rollingImpulse = vec3_mul_scalar(c->normal, accumulated);
+        Vec3 delta = vec3_mul_scalar(c->normal, accumulated - previous);
+        applyAngularImpulse(c->a, vec3_mul_scalar(delta, -1.0f));
+        applyAngularImpulse(c->b, delta);
+        return;
+    }
+
+    float speedSq = vec3_dot(spin, spin);
+    if (speedSq < 1e-12f) return;
+    float speed = sqrtf(speedSq);
+    Vec3 axis = vec3_mul_scalar(spin, 1.0f / speed);
+    Vec3 previous = c->rollingImpulse;
+    Vec3 accumulated = vec3_sub(previous, vec3_mul_scalar(axis, speed * angularMass(c->a, c->b, axis)));
+    float lengthSq = vec3_dot(accumulated, accumulated);
+    if (lengthSq > limit * limit) accumulated = vec3_mul_scalar(accumulated, limit / sqrtf(lengthSq));
+    c->rollingImpulse = accumulated;
+    Vec3 delta = vec3_sub(accumulated, previous);
+    applyAngularImpulse(c->a, vec3_mul_scalar(delta, -1.0f));
+    applyAngularImpulse(c->b, delta);
+}
+
+static void solveContactConstraint(ContactConstraint* c) {
+    Vec3 relative = constraintRelativeVelocity(c);
+    float vn = vec3_dot(relative, c->normal);
+    float lambda = -c->normalMass * (vn - c->bias);
+    float previous = c->normalImpulse;
+    c->normalImpulse = fmaxf(previous + lambda, 0.0f);
+    Vec3 impulse = vec3_mul_scalar(c->normal, c->normalImpulse - previous);
+
+    float maxFriction = g_friction * c->normalImpulse;
+    float vt1 = vec3_dot(relative, c->tangent1);
+    float vt2 = vec3_dot(relative, c->tangent2);
+    float previous1 = c->tangentImpulse1;
+    float previous2 = c->tangentImpulse2;
+    c->tangentImpulse1 = fmaxf(-maxFriction, fminf(maxFriction, previous1 - c->tangentMass1 * vt1));
+    c->tangentImpulse2 = fmaxf(-maxFriction, fminf(maxFriction, previous2 - c->tangentMass2 * vt2));
+    impulse = vec3_add(impulse, vec3_mul_scalar(c->tangent1, c->tangentImpulse1 - previous1));
+    impulse = vec3_add(impulse, vec3_mul_scalar(c->tangent2, c->tangentImpulse2 - previous2));
+    applyConstraintImpulse(c, impulse);
+
+    if (c->rollingLimit > 0.0f) solveRollingResistance(c);
+}
+
+static void colorManifolds(const ManifoldList* manifolds) {
+    ConstraintColoring* coloring = &g_coloring;
+    World* w = &g_world;
+    if (coloring->bodyCapacity < w->capacity) {
+        free(coloring->bodyColors);
+        coloring->bodyColors = (uint64_t*)allocAligned(sizeof(uint64_t) * (size_t)w->capacity);
+        coloring->bodyCapacity = w->capacity;
+    }
+    reserveArray((void**)&coloring->manifoldColor, sizeof(int), &coloring->manifoldColorCapacity, manifolds->count);
+    reserveArray((void**)&coloring->order, sizeof(int), &coloring->orderCapacity, manifolds->count);
+
+    for (int m = 0; m < manifolds->count; ++m) {
+        const ContactManifold* manifold = &manifolds->manifolds[m];
+        coloring->bodyColors[manifold->a] = 0;
+        if (manifold->b >= 0) coloring->bodyColors[manifold->b] = 0;
+    }
+
+    int colorCounts[MAX_SOLVER_COLORS + 1] = { 0 };
+    for (int m = 0; m < manifolds->count; ++m) {
+        const ContactManifold* manifold = &manifolds->manifolds[m];
+        uint64_t used = coloring->bodyColors[manifold->a];
+        if (manifold->b >= 0) used |= coloring->bodyColors[manifold->b];
+
+        int color = MAX_SOLVER_COLORS;
+        if (~used != 0) {
+            color = __builtin_ctzll(~used);
+            coloring->bodyColors[manifold->a] |= 1ull << color;
+            if (manifold->b >= 0) coloring->bodyColors[manifold->b] |= 1ull << color;
+        }
+        coloring->manifoldColor[m] = color;
+        colorCounts[color]++;
+    }
+
+    int first = 0;
+    coloring->batchCount = 0;
+    for (int color = 0; color <= MAX_SOLVER_COLORS; ++color) {
+        coloring->batches[color].first = first;
+        coloring->batches[color].count = 0;
+        first += colorCounts[color];
+        if (colorCounts[color] > 0) coloring->batchCount = color + 1;
+    }
+    for (int m = 0; m < manifolds->count; ++m) {
+        SolverBatch* batch = &coloring->batches[coloring->manifoldColor[m]];
+        coloring->order[batch->first + batch->count++] = m;
+    }
+}
+
+/* Colors the manifolds and lays out their constraints, each manifold's run
+ * starting at the prefix sum of the points before it, so the color batches can
+ * fill their runs in parallel (prepareBatchRange). */
+void prepareContacts(const ManifoldList* manifolds, float deltaTime) {
+    ConstraintList* list = &g_constraints;
+    ConstraintColoring* coloring = &g_coloring;
+    ImpulseCache* cache = &g_impulseCache;
+
+    colorManifolds(manifolds);
+    coloring->manifolds = manifolds;
+    reserveArray((void**)&coloring->constraintStart, sizeof(int), &coloring->constraintStartCapacity, manifolds->count + 1);
+    if (g_solverBodies.capacity < g_world.capacity) {
+        free(g_solverBodies.bodies);
+        g_solverBodies.bodies = (SolverBody*)allocAligned(sizeof(SolverBody) * (size_t)g_world.capacity);
+        g_solverBodies.capacity = g_world.capacity;
+    }
+
+    int count = 0;
+    for (int o = 0; o < manifolds->count; ++o) {
+        const ContactManifold* manifold = &manifolds->manifolds[coloring->order[o]];
+        coloring->constraintStart[o] = count;
+        if (bodyInverseMass(manifold->a) + bodyInverseMass(manifold->b) > 0.0f) count += manifold->pointCount;
+    }
+    coloring->constraintStart[manifolds->count] = count;
+    reserveArray((void**)&list->constraints, sizeof(ContactConstraint), &list->capacity, count);
+    list->count = count;
+    list->invDeltaTime = deltaTime > 0.0f ? 1.0f / deltaTime : 0.0f;
+    reserveArray((void**)&cache->entries, sizeof(CachedImpulse), &cache->capacity, count);
+    reserveArray((void**)&cache->scratch, sizeof(CachedImpulse), &cache->scratchCapacity, count);
+}
+
+/* Gathers the batch's bodies and fills its manifolds' constraints. No two
+ * manifolds of a color share a body; a body in several colors is gathered by
+ * each, always with the same value. */
+void prepareBatchRange(int begin, int end, int slice, void* context) {
+    const SolverBatch* batch = (const SolverBatch*)context;
+    const ConstraintColoring* coloring = &g_coloring;
+    const ImpulseCache* cache = &g_impulseCache;
+    float invDeltaTime = g_constraints.invDeltaTime;
+    for (int o = batch->first + begin; o < batch->first + end; ++o) {
+        const ContactManifold* manifold = &coloring->manifolds->manifolds[coloring->order[o]];
+        /* Loaded even when skipped: every manifold's bodies are stored back. */
+        loadSolverBody(manifold->a);
+        loadSolverBody(manifold->b);
+        float invMassSum = bodyInverseMass(manifold->a) + bodyInverseMass(manifold->b);
+        if (invMassSum <= 0.0f) continue;
+
+        Vec3 centerA = bodyCenter(manifold->a);
+        Vec3 centerB = bodyCenter(manifold->b);
+        float rollingLimit = ROLLING_RESISTANCE * fmaxf(bodyRollingRadius(manifold->a), bodyRollingRadius(manifold->b));
+        bool rollingAboutNormal = !bodyIsRound(manifold->a) && !bodyIsRound(manifold->b);
+        float spinMass = angularMass(manifold->a, manifold->b, manifold->normal);
+        Vec3 tangent1, tangent2;
+        contactTangents(manifold->normal, &tangent1, &tangent2);
+
+        ContactConstraint* constraints = &g_constraints.constraints[coloring->constraintStart[o]];
+        for (int k = 0; k < manifold->pointCount; ++k) {
+            const ContactPoint* point = &manifold->points[k];
+            ContactConstraint* c = &constraints[k];
+            c->key = contactKey(manifold->a, manifold->b, point->feature);
+            c->a = manifold->a;
+            c->b = manifold->b;
+            c->normal = manifold->normal;
+            c->tangent1 = tangent1;
+            c->tangent2 = tangent2;
+            c->offsetA = vec3_sub(point->position, centerA);
+            c->offsetB = manifold->b >= 0 ? vec3_sub(point->position, centerB) : vec3_create(0.0f, 0.0f, 0.0f);
+            c->normalMass = constraintMass(c, c->normal);
+            c->tangentMass1 = constraintMass(c, tangent1);
+            c->tangentMass2 = constraintMass(c, tangent2);
+            c->rollingLimit = rollingLimit;
+            c->rollingAboutNormal = rollingAboutNormal;
+            c->spinMass = spinMass;
+            c->rollingImpulse = vec3_create(0.0f, 0.0f, 0.0f);
+
+            float vn = vec3_dot(constraintRelativeVelocity(c), c->normal);
+            float restitutionBias = vn < -RESTITUTION_VELOCITY_THRESHOLD ? -g_restitution * vn : 0.0f;
+            /* Capped so deep overlaps separate at a bounded speed whatever the
+             * substep length, instead of launching bodies at depth / dt. */
+            float penetrationBias = fminf(BAUMGARTE_FACTOR * invDeltaTime * fmaxf(point->depth - PENETRATION_SLOP, 0.0f),
+                                          MAX_PENETRATION_CORRECTION_SPEED);
+            c->bias = fmaxf(restitutionBias, penetrationBias);
+
+            const CachedImpulse* cached = findCachedImpulse(cache, c->key);
+            if (cached != NULL) {
+                c->normalImpulse = cached->normalImpulse;
+                c->tangentImpulse1 = cached->tangentImpulse1;
+                c->tangentImpulse2 = cached->tangentImpulse2;
+            } else {
+                c->normalImpulse = 0.0f;
+                c->tangentImpulse1 = 0.0f;
+                c->tangentImpulse2 = 0.0f;
+            }
+        }
+    }
+}
+
+void warmStartBatchRange(int begin, int end, int slice, void* context) {
+    const SolverBatch* batch = (const SolverBatch*)context;
+    const int* constraintStart = g_coloring.constraintStart;
+    for (int k = constraintStart[batch->first + begin]; k < constraintStart[batch->first + end]; ++k) {
+        ContactConstraint* c = &g_constraints.constraints[k];
+        Vec3 impulse = vec3_mul_scalar(c->normal, c->normalImpulse);
+        impulse = vec3_add(impulse, vec3_mul_scalar(c->tangent1, c->tangentImpulse1));
+        impulse = vec3_add(impulse, vec3_mul_scalar(c->tangent2, c->tangentImpulse2));
+        applyConstraintImpulse(c, impulse);
+    }
+}
+
+void solveBatchRange(int begin, int end, int slice, void* context) {
+    const SolverBatch* batch = (const SolverBatch*)context;
+    const int* constraintStart = g_coloring.constraintStart;
+    for (int k = constraintStart[batch->first + begin]; k < constraintStart[batch->first + end]; ++k) {
+        solveContactConstraint(&g_constraints.constraints[k]);
+    }
+}
+
+/* The last iteration, which also scatters the batch's velocities back to the
+ * world streams. A body in several colors is stored by each in color order, so
+ * the last store carries its final velocity. */
+void solveAndStoreBatchRange(int begin, int end, int slice, void* context) {
+    const SolverBatch* batch = (const SolverBatch*)context;
+    const ConstraintColoring* coloring = &g_coloring;
+    for (int o = batch->first + begin; o < batch->first + end; ++o) {
+        for (int k = coloring->constraintStart[o]; k < coloring->constraintStart[o + 1]; ++k) {
+            solveContactConstraint(&g_constraints.constraints[k]);
+        }
+        const ContactManifold* manifold = &coloring->manifolds->manifolds[coloring->order[o]];
+        storeSolverBody(manifold->a);
+        storeSolverBody(manifold->b);
+    }
+}
+
+/* Kernel of each solver pass: pass -2 fills the constraints, -1 warm starts
+ * them and the iterations follow, the last one storing the velocities. */
+static const ParallelKernel* solverPassKernel(int pass) {
+    static const ParallelKernel kernels[] = { prepareBatchRange, warmStartBatchRange, solveBatchRange, solveAndStoreBatchRange };
+    if (pass < 0) return &kernels[pass + 2];
+    return &kernels[pass == g_solverIterations - 1 ? 3 : 2];
+}
+
+static void solveAllBatchesTask(int begin, int end, int slice, void* context) {
+    ConstraintColoring* coloring = &g_coloring;
+    for (int pass = -2; pass < g_solverIterations; ++pass) {
+        ParallelKernel kernel = *solverPassKernel(pass);
+        for (int color = 0; color < coloring->batchCount; ++color) {
+            SolverBatch* batch = &coloring->batches[color];
+            kernel(0, batch->count, 0, batch);
+        }
+    }
+}
+
+static void solveOverflowBatchTask(int begin, int end, int slice, void* context) {
+    SolverBatch* batch = &g_coloring.batches[MAX_SOLVER_COLORS];
+    (*(const ParallelKernel*)context)(0, batch->count, 0, batch);
+}
+
+/* Appends the constraint fill, the warm start and every solver iteration to the
+ * graph as a chain of color batches, each split across workers; the last
+ * iteration scatters the velocities. Small contact sets are solved by a single
+ * task in the same color order, so results do not depend on the thread count.
+ * Returns the last task, or -1 if there is nothing to solve. */
+int addSolverTasks(TaskGraph* graph, int after) {
+    ConstraintColoring* coloring = &g_coloring;
+    if (g_constraints.count == 0) return after;
+
+    if (g_threadPool.threadCount == 1 || g_manifolds.count < PARALLEL_GRAIN * 2) {
+        int task = taskAdd(graph, solveAllBatchesTask, NULL);
+        if (after >= 0) taskDepend(graph, after, task);
+        return task;
+    }
+
+    int previous = after;
+    for (int pass = -2; pass < g_solverIterations; ++pass) {
+        const ParallelKernel* kernel = solverPassKernel(pass);
+        for (int color = 0; color < coloring->batchCount; ++color) {
+            SolverBatch* batch = &coloring->batches[color];
+            if (batch->count == 0) continue;
+            int task;
+            if (color == MAX_SOLVER_COLORS) {
+                task = taskAdd(graph, solveOverflowBatchTask, (void*)kernel);
+            } else {
+                task = taskAddRange(graph, *kernel, batch, &batch->count);
+            }
+            if (previous >= 0) taskDepend(graph, previous, task);
+            previous = task;
+        }
+    }
+    return previous;
+}
+
+/* Copies a slice of the solved impulses into the cache and sorts it; the merge
+ * task then joins the sorted slices. */
+void storeContactImpulsesRange(int begin, int end, int slice, void* context) {
+    const ContactConstraint* constraints = g_constraints.constraints;
+    CachedImpulse* entries = g_impulseCache.entries;
+    for (int k = begin; k < end; ++k) {
+        entries[k].key = constraints[k].key;
+        entries[k].normalImpulse = constraints[k].normalImpulse;
+        entries[k].tangentImpulse1 = constraints[k].tangentImpulse1;
+        entries[k].tangentImpulse2 = constraints[k].tangentImpulse2;
+    }
+    if (end > begin) qsort(entries + begin, (size_t)(end - begin), sizeof(CachedImpulse), compareCachedImpulses);
+}
+
+/* Merges neighbouring sorted slices pairwise until one run is left. The
+ * comparison orders every entry, so the cache comes out the same whatever the
+ * slicing. */
+void mergeContactImpulsesTask(int begin, int end, int slice, void* context) {
+    ImpulseCache* cache = &g_impulseCache;
+    int count = g_constraints.count;
+    int sliceCount = g_threadPool.sliceCount;
+    cache->count = count;
+
+    int runs = 0;
+    for (; runs < sliceCount; ++runs) {
+        int first, last;
+        parallelSlice(count, runs, sliceCount, &first, &last);
+        if (first == last) break;
+    }
+    for (int width = 1; width < runs; width *= 2) {
+        for (int run = 0; run < runs; run += 2 * width) {
+            int lo, mid, hi, unused;
+            parallelSlice(count, run, sliceCount, &lo, &unused);
+            parallelSlice(count, run + width < runs ? run + width : runs, sliceCount, &mid, &unused);
+            parallelSlice(count, run + 2 * width < runs ? run + 2 * width : runs, sliceCount, &hi, &unused);
+            int i = lo, j = mid, out = lo;
+            while (i < mid && j < hi) {
+                bool right = compareCachedImpulses(&cache->entries[j], &cache->entries[i]) < 0;
+                cache->scratch[out++] = right ? cache->entries[j++] : cache->entries[i++];
+            }
+            while (i < mid) cache->scratch[out++] = cache->entries[i++];
+            while (j < hi) cache->scratch[out++] = cache->entries[j++];
+        }
+        CachedImpulse* entries = cache->entries;
+        int capacity = cache->capacity;
+        cache->entries = cache->scratch;
+        cache->capacity = cache->scratchCapacity;
+        cache->scratch = entries;
+        cache->scratchCapacity = capacity;
+    }
+}
+
+static void awakeListReserve(World* w, int count) {
+    reserveArray((void**)&w->awake, sizeof(int), &w->awakeCapacity, count + SIMD_WIDTH);
+}
+
+static void awakeListPad(World* w) {
+    if (w->awakeCount == 0) return;
+    int last = w->awake[w->awakeCount - 1];
+    for (int k = 0; k < SIMD_WIDTH; ++k) {
+        w->awake[w->awakeCount + k] = last;
+    }
+}
+
+void wakeAllBodies() {
+    World* w = &g_world;
+    awakeListReserve(w, w->count);
+    for (int i = 0; i < w->count; ++i) {
+        w->awake[i] = i;
+        w->resting[i] = 0;
+        w->sleepTimer[i] = 0.0f;
+    }
+    w->awakeCount = w->count;
+    awakeListPad(w);
+    sleepingHashClear(&g_sleepingHash);
+}
+
+void wakeBody(int i) {
+    World* w = &g_world;
+    if (i < 0 || !w->resting[i]) return;
+    sleepingHashRemove(&g_sleepingHash, i);
+    sapWakeBody(i);
+    w->resting[i] = 0;
+    w->sleepTimer[i] = 0.0f;
+    awakeListReserve(w, w->awakeCount + 1);
+    w->awake[w->awakeCount++] = i;
+    awakeListPad(w);
+}
+
+/* A sleeping body touched by an awake one wakes with the toucher's sleep timer,
+ * so a quiet pile brushing against a sleeping one does not restart the joint
+ * island's countdown, while a moving toucher (timer 0) wakes it fully. */
+void wakeTouchedBodies(const ManifoldList* manifolds) {
+    World* w = &g_world;
+    for (int m = 0; m < manifolds->count; ++m) {
+        const ContactManifold* manifold = &manifolds->manifolds[m];
+        if (manifold->b < 0) continue;
+        int sleeper, toucher;
+        if (w->resting[manifold->a] && !w->resting[manifold->b]) {
+            sleeper = manifold->a;
+            toucher = manifold->b;
+        } else if (w->resting[manifold->b] && !w->resting[manifold->a]) {
+            sleeper = manifold->b;
+            toucher = manifold->a;
+        } else {
+            continue;
+        }
+        wakeBody(sleeper);
+        w->sleepTimer[sleeper] = w->sleepTimer[toucher];
+    }
+}
+
+void respawnQueueReserve(RespawnQueue* queue, int count) {
+    if (count * 2 > queue->capacity) {
+        free(queue->body);
+        free(queue->ticket);
+        queue->capacity = count * 2;
+        queue->body = (int*)allocAligned(sizeof(int) * (size_t)queue->capacity);
+        queue->ticket = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)queue->capacity);
+    }
+    if (count > queue->bodyCapacity) {
+        free(queue->bodyTicket);
+        queue->bodyCapacity = count;
+        queue->bodyTicket = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)count);
+    }
+    memset(queue->bodyTicket, 0, sizeof(uint32_t) * (size_t)count);
+    queue->head = 0;
+    queue->count = 0;
+}
+
+/* Called as a body falls asleep. The ring holds twice the body count, so it
+ * only overflows on stale entries; the oldest entry is dropped when it does. */
+static void respawnQueuePush(RespawnQueue* queue, int body) {
+    if (queue->capacity == 0) return;
+    if (queue->count == queue->capacity) {
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    uint32_t ticket = ++queue->nextTicket;
+    if (ticket == 0) ticket = ++queue->nextTicket;
+    int slot = (queue->head + queue->count) % queue->capacity;
+    queue->body[slot] = body;
+    queue->ticket[slot] = ticket;
+    queue->bodyTicket[body] = ticket;
+    queue->count++;
+}
+
+/* Sleeping bodies whose bounds reach any of the given boxes are woken, so what
+ * rested on a recycled body falls instead of hovering. One SIMD pass against the
+ * union of the boxes filters the world before the per-box tests. */
+static void wakeBodiesNear(const Aabb* boxes, int count) {
+    World* w = &g_world;
+    Aabb bounds = boxes[0];
+    for (int k = 1; k < count; ++k) {
+        bounds.minX = fminf(bounds.minX, boxes[k].minX);
+        bounds.minY = fminf(bounds.minY, boxes[k].minY);
+        bounds.minZ = fminf(bounds.minZ, boxes[k].minZ);
+        bounds.maxX = fmaxf(bounds.maxX, boxes[k].maxX);
+        bounds.maxY = fmaxf(bounds.maxY, boxes[k].maxY);
+        bounds.maxZ = fmaxf(bounds.maxZ, boxes[k].maxZ);
+    }
+    const vfloat loX = vf_set1(bounds.minX), hiX = vf_set1(bounds.maxX);
+    const vfloat loY = vf_set1(bounds.minY), hiY = vf_set1(bounds.maxY);
+    const vfloat loZ = vf_set1(bounds.minZ), hiZ = vf_set1(bounds.maxZ);
+    const vfloat boundingScale = vf_set1(BOUNDING_EXTENT_SCALE);
+    for (int base = 0; base < w->count; base += SIMD_WIDTH) {
+        vfloat px = vf_load(w->posX + base);
+        vfloat py = vf_load(w->posY + base);
+        vfloat pz = vf_load(w->posZ + base);
+        vfloat reach = vf_mul(vf_load(w->size + base), boundingScale);
+        vmask hit = vm_and(vf_lt(vf_sub(px, reach), hiX), vf_gt(vf_add(px, reach), loX));
+        hit = vm_and(hit, vm_and(vf_lt(vf_sub(py, reach), hiY), vf_gt(vf_add(py, reach), loY)));
+        hit = vm_and(hit, vm_and(vf_lt(vf_sub(pz, reach), hiZ), vf_gt(vf_add(pz, reach), loZ)));
+        int lanes = w->count - base < SIMD_WIDTH ? w->count - base : SIMD_WIDTH;
+        unsigned bits = vm_bits(hit) & (0xffffffffu >> (32 - lanes));
+        while (bits) {
+            int j = base + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (!w->resting[j]) continue;
+            Aabb box = bodyAabb(j);
+            for (int k = 0; k < count; ++k) {
+                if (aabbOverlaps(&box, &boxes[k])) {
+                    wakeBody(j);
+                    break;
+                }
             }
-        } else if (cube->position.x + halfSize > bound) {
-            cube->position.x = bound - halfSize;
-            Vec3 normal = vec3_create(-1.0f, 0.0f, 0.0f);
-            Vec3 random_perturb = vec3_create(0.0f, rand_float(-0.5f, 0.5f), rand_float(-0.5f, 0.5f));
-            Vec3 bounce_direction = vec3_normalize(vec3_add(normal, random_perturb));
+        }
+    }
+}
+
+/* Streaming respawn: the bodies that have been asleep longest are dropped back
+ * in at --respawn-rate per second, so spawn work is spread evenly instead
+ * of arriving as one reset every RESET_INTERVAL_SECONDS. */
+void recycleRestingBodies(int limit) {
+    World* w = &g_world;
+    RespawnQueue* queue = &g_respawnQueue;
+    Aabb vacated[MAX_RESPAWN_BATCH];
+    int recycled = 0;
+    while (recycled < limit && recycled < MAX_RESPAWN_BATCH && queue->count > 0) {
+        int body = queue->body[queue->head];
+        uint32_t ticket = queue->ticket[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        if (body >= w->count || !w->resting[body] || queue->bodyTicket[body] != ticket) continue;
+
+        queue->bodyTicket[body] = 0;
+        vacated[recycled++] = bodyAabb(body);
+        wakeBody(body);
+        spawnCubes(body, body + 1, ++queue->respawnTotal);
+    }
+    if (recycled > 0) wakeBodiesNear(vacated, recycled);
+}
+
+static int islandFind(int* parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void updateIslandsAndSleep(const ManifoldList* manifolds) {
+    World* w = &g_world;
+    IslandScratch* islands = &g_islands;
+    if (islands->capacity < w->capacity) {
+        free(islands->parent);
+        free(islands->sleepTimer);
+        free(islands->slept);
+        islands->parent = (int*)allocAligned(sizeof(int) * (size_t)w->capacity);
+        islands->sleepTimer = (float*)allocAligned(sizeof(float) * (size_t)w->capacity);
+        islands->slept = (int*)allocAligned(sizeof(int) * (size_t)w->capacity);
+        islands->capacity = w->capacity;
+    }
+    islands->sleptCount = 0;
+
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = w->awake[k];
+        islands->parent[i] = i;
+    }
+    for (int m = 0; m < manifolds->count; ++m) {
+        const ContactManifold* manifold = &manifolds->manifolds[m];
+        if (manifold->b < 0) continue;
+        int ra = islandFind(islands->parent, manifold->a);
+        int rb = islandFind(islands->parent, manifold->b);
+        if (ra == rb) continue;
+        if (ra < rb) islands->parent[rb] = ra;
+        else islands->parent[ra] = rb;
+    }
+
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = w->awake[k];
+        islands->sleepTimer[islandFind(islands->parent, i)] = TIME_TO_SLEEP;
+    }
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = w->awake[k];
+        int root = islandFind(islands->parent, i);
+        islands->sleepTimer[root] = fminf(islands->sleepTimer[root], w->sleepTimer[i]);
+    }
+
+    int kept = 0;
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = w->awake[k];
+        if (islands->sleepTimer[islandFind(islands->parent, i)] >= TIME_TO_SLEEP) {
+            w->resting[i] = 1;
+            g_pool.sleepStep[i] = (uint32_t)g_stepCount;
+            if (g_respawnRate > 0.0f) respawnQueuePush(&g_respawnQueue, i);
+            w->velX[i] = w->velY[i] = w->velZ[i] = 0.0f;
+            w->angVelX[i] = w->angVelY[i] = w->angVelZ[i] = 0.0f;
+            islands->slept[islands->sleptCount++] = i;
+            sleepingHashInsert(&g_sleepingHash, i);
+        } else {
+            w->awake[kept++] = i;
+        }
+    }
+    if (kept < w->awakeCount) sapSleepBodies();
+    w->awakeCount = kept;
+    awakeListPad(w);
+}
+
+/* Bodies that fell asleep in the last step rest where they are from now on:
+ * rendering and the next sweep start from their current pose. */
+void settleSleptBodies() {
+    World* w = &g_world;
+    const IslandScratch* islands = &g_islands;
+    for (int k = 0; k < islands->sleptCount; ++k) {
+        int i = islands->slept[k];
+        w->prevPosX[i] = w->sweepX[i] = w->posX[i];
+        w->prevPosY[i] = w->sweepY[i] = w->posY[i];
+        w->prevPosZ[i] = w->sweepZ[i] = w->posZ[i];
+        w->prevQuatW[i] = w->quatW[i];
+        w->prevQuatX[i] = w->quatX[i];
+        w->prevQuatY[i] = w->quatY[i];
+        w->prevQuatZ[i] = w->quatZ[i];
+    }
+}
+
+static inline BodyHandle makeBodyHandle(int slot, uint32_t generation) {
+    return ((BodyHandle)generation << 32) | (uint32_t)slot;
+}
+
+/* Sizes every per-body structure for the pool capacity once, then hands out the
+ * first count slots in order. Slot generations survive resets, so handles from
+ * before a reset go stale instead of aliasing new bodies. */
+void bodyPoolReset(int count) {
+    World* w = &g_world;
+    BodyPool* pool = &g_pool;
+    int capacity = g_maxCubes;
+    if (capacity > pool->capacity) {
+        free(pool->slotDense);
+        free(pool->slotGeneration);
+        free(pool->denseSlot);
+        free(pool->spawnStep);
+        free(pool->sleepStep);
+        free(pool->doomed);
+        free(pool->despawn);
+        free(pool->remap);
+        free(pool->moveSource);
+        free(pool->moveTarget);
+        free(pool->scratch);
+        free(pool->globalId);
+        free(pool->ghost);
+        pool->slotDense = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+        pool->slotGeneration = (uint32_t*)calloc((size_t)capacity, sizeof(uint32_t));
+        pool->denseSlot = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+        pool->spawnStep = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)capacity);
+        pool->sleepStep = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)capacity);
+        pool->doomed = (uint8_t*)calloc((size_t)capacity, sizeof(uint8_t));
+        pool->despawn = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+        pool->remap = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+        pool->moveSource = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+        pool->moveTarget = (int*)allocAligned(sizeof(int) * (size_t)capacity);
+        pool->scratch = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)capacity);
+        pool->globalId = (uint32_t*)allocAligned(sizeof(uint32_t) * (size_t)capacity);
+        pool->ghost = (uint8_t*)calloc((size_t)capacity, sizeof(uint8_t));
+        if (pool->slotGeneration == NULL || pool->doomed == NULL || pool->ghost == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(1);
+        }
+        pool->capacity = capacity;
+
+        /* Everything that grows with the body count is sized now, so spawning
+         * up to the capacity later never reaches the allocator. */
+        awakeListReserve(w, capacity);
+        spatialHashReserve(&g_spatialHash, capacity);
+        sleepingHashReserve(&g_sleepingHash, capacity);
+        reserveArray((void**)&g_sweepAndPrune.endpoints, sizeof(SapEndpoint), &g_sweepAndPrune.endpointCapacity, capacity * 2);
+        reserveArray((void**)&g_sweepAndPrune.active, sizeof(int), &g_sweepAndPrune.activeCapacity, capacity);
+        reserveArray((void**)&g_sweepAndPrune.activeSlot, sizeof(int), &g_sweepAndPrune.activeSlotCapacity, capacity);
+        reserveArray((void**)&g_sweepAndPrune.sleepers, sizeof(SapEndpoint), &g_sweepAndPrune.sleeperCapacity, capacity);
+        reserveArray((void**)&g_aabbTree.nodes, sizeof(TreeNode), &g_aabbTree.nodeCapacity, capacity * 2);
+        reserveArray((void**)&g_aabbTree.bodyLeaf, sizeof(int), &g_aabbTree.bodyLeafCapacity, capacity);
+    }
+
+    for (int s = 0; s < pool->capacity; ++s) {
+        pool->slotGeneration[s]++;
+        if (pool->slotGeneration[s] == 0) pool->slotGeneration[s] = 1;
+        pool->slotDense[s] = s < count ? s : (s + 1 < pool->capacity ? s + 1 : -1);
+        pool->remap[s] = s;
+    }
+    pool->freeHead = count < pool->capacity ? count : -1;
+    for (int i = 0; i < count; ++i) {
+        pool->denseSlot[i] = i;
+        pool->spawnStep[i] = (uint32_t)g_stepCount;
+        pool->sleepStep[i] = 0;
+        pool->globalId[i] = (uint32_t)i;
+        pool->ghost[i] = 0;
+    }
+    pool->nextGlobalId = (uint32_t)count;
+    pool->despawnCount = 0;
+    pool->sortedCount = count;
+}
+
+BodyHandle bodyHandle(int i) {
+    int slot = g_pool.denseSlot[i];
+    return makeBodyHandle(slot, g_pool.slotGeneration[slot]);
+}
+
+/* Dense index of a live body, or -1 once the handle's body has been despawned. */
+int bodyFromHandle(BodyHandle handle) {
+    const BodyPool* pool = &g_pool;
+    uint32_t slot = (uint32_t)handle;
+    if (slot >= (uint32_t)pool->capacity || pool->slotGeneration[slot] != (uint32_t)(handle >> 32)) return -1;
+    return pool->slotDense[slot];
+}
+
+/* Appends up to count awake bodies of one shape at the end of the dense arrays
+ * and returns how many fit. They are laid out by spawnCubes; callers may then
+ * move them. Until compactBodies sorts them into their shape's batch they are
+ * outside every batch and not yet in the broadphases. */
+int spawnBodies(int count, ShapeType shape, uint32_t step) {
+    World* w = &g_world;
+    BodyPool* pool = &g_pool;
+    if (count > pool->capacity - w->count) count = pool->capacity - w->count;
+    if (count <= 0) return 0;
+
+    int begin = w->count;
+    w->count += count;
+    memset(w->shape + begin, shape, (size_t)count);
+    spawnCubes(begin, w->count, step);
+    for (int i = begin; i < w->count; ++i) {
+        int slot = pool->freeHead;
+        pool->freeHead = pool->slotDense[slot];
+        pool->slotDense[slot] = i;
+        pool->denseSlot[i] = slot;
+        pool->spawnStep[i] = (uint32_t)g_stepCount;
+        pool->sleepStep[i] = 0;
+        pool->globalId[i] = pool->nextGlobalId++;
+        pool->ghost[i] = 0;
+        w->awake[w->awakeCount++] = i;
+    }
+    awakeListPad(w);
+    pool->spawnedTotal += count;
+    return count;
+}
+
+void despawnBody(int i) {
+    BodyPool* pool = &g_pool;
+    if (i < 0 || i >= g_world.count || pool->doomed[i]) return;
+    pool->doomed[i] = 1;
+    pool->despawn[pool->despawnCount++] = i;
+}
+
+/* Gathers every moving element before scattering any, so a body moving into a
+ * slot whose own body is moving out is never overwritten before it is read. */
+static void moveBodyElements(void* stream, size_t elementSize, const BodyPool* pool, int moveCount) {
+    char* elements = (char*)stream;
+    char* scratch = (char*)pool->scratch;
+    for (int k = 0; k < moveCount; ++k) {
+        memcpy(scratch + (size_t)k * elementSize, elements + (size_t)pool->moveSource[k] * elementSize, elementSize);
+    }
+    for (int k = 0; k < moveCount; ++k) {
+        memcpy(elements + (size_t)pool->moveTarget[k] * elementSize, scratch + (size_t)k * elementSize, elementSize);
+    }
+}
+
+static void remapImpulseCache(const BodyPool* pool) {
+    ImpulseCache* cache = &g_impulseCache;
+    int kept = 0;
+    for (int k = 0; k < cache->count; ++k) {
+        CachedImpulse entry = cache->entries[k];
+        int a = pool->remap[(int)(entry.key >> 40) - 1];
+        int b = (int)((entry.key >> 16) & 0xffffffu) - 1;
+        int mappedB = b >= 0 ? pool->remap[b] : b;
+        if (a < 0 || (b >= 0 && mappedB < 0)) continue;
+        entry.key = contactKey(a, mappedB, (int)(entry.key & 0xffffu));
+        cache->entries[kept++] = entry;
+    }
+    cache->count = kept;
+    qsort(cache->entries, (size_t)cache->count, sizeof(CachedImpulse), compareCachedImpulses);
+}
+
+/* Endpoints and sleepers are relabelled in place, keeping the sort, and spawned
+ * bodies are appended for the incremental pass to sort into place; its swaps
+ * then give their overlaps. The overlap list is relabelled and its table
+ * refilled. */
+static void remapSweepAndPrune(const BodyPool* pool, int oldCount) {
+    SweepAndPrune* sap = &g_sweepAndPrune;
+    if (sap->dirty) return;
+    int kept = 0;
+    for (int k = 0; k < sap->endpointCount; ++k) {
+        SapEndpoint endpoint = sap->endpoints[k];
+        int body = pool->remap[endpoint.owner >> 1];
+        if (body < 0) continue;
+        endpoint.owner = ((uint32_t)body << 1) | (endpoint.owner & 1u);
+        sap->endpoints[kept++] = endpoint;
+    }
+    for (int i = pool->sortedCount; i < oldCount; ++i) {
+        int body = pool->remap[i];
+        if (body < 0) continue;
+        sap->endpoints[kept].value = 0.0f;
+        sap->endpoints[kept++].owner = (uint32_t)body << 1;
+        sap->endpoints[kept].value = 0.0f;
+        sap->endpoints[kept++].owner = ((uint32_t)body << 1) | 1u;
+    }
+    sap->endpointCount = kept;
+
+    kept = 0;
+    for (int k = 0; k < sap->sleeperCount; ++k) {
+        int body = pool->remap[sap->sleepers[k].owner >> 1];
+        if (body < 0) continue;
+        sap->sleepers[kept].value = sap->sleepers[k].value;
+        sap->sleepers[kept++].owner = (uint32_t)body << 1;
+    }
+    sap->sleeperCount = kept;
+
+    kept = 0;
+    for (int k = 0; k < sap->overlapCount; ++k) {
+        int a = pool->remap[sap->overlaps[k].a];
+        int b = pool->remap[sap->overlaps[k].b];
+        if (a < 0 || b < 0) continue;
+        sap->overlaps[kept].a = a < b ? a : b;
+        sap->overlaps[kept++].b = a < b ? b : a;
+    }
+    sap->overlapCount = kept;
+    overlapTableRebuild(sap, sap->overlapCount);
+}
+
+static void remapAabbTree(BodyPool* pool, int oldCount, int newCount, int moveCount) {
+    AabbTree* tree = &g_aabbTree;
+    if (tree->dirty || tree->bodyCount != pool->sortedCount) {
+        tree->dirty = true;
+        return;
+    }
+    for (int k = 0; k < pool->despawnCount; ++k) {
+        int leaf = tree->bodyLeaf[pool->despawn[k]];
+        treeRemoveLeaf(tree, leaf);
+        treeFreeNode(tree, leaf);
+    }
+    int* leaves = (int*)pool->scratch;
+    for (int k = 0; k < moveCount; ++k) {
+        leaves[k] = pool->moveSource[k] < pool->sortedCount ? tree->bodyLeaf[pool->moveSource[k]] : -1;
+    }
+    for (int k = 0; k < moveCount; ++k) {
+        if (leaves[k] < 0) continue;
+        tree->bodyLeaf[pool->moveTarget[k]] = leaves[k];
+        tree->nodes[leaves[k]].body = pool->moveTarget[k];
+    }
+    for (int i = pool->sortedCount; i < oldCount; ++i) {
+        int body = pool->remap[i];
+        if (body >= 0) treeInsertBody(tree, body, 1.0f / PHYSICS_HZ);
+    }
+    tree->bodyCount = newCount;
+}
+
+/* Collects, for one shape, the slots of its new batch that do not hold one of
+ * its live bodies (targets) and its live bodies outside the new batch (sources).
+ * Only where the old and new batch differ, the despawned bodies and the bodies
+ * spawned since the last compaction need to be looked at. */
+static int collectShapeMoves(BodyPool* pool, int shape, int lo, int hi, int moveCount) {
+    World* w = &g_world;
+    int oldLo = w->shapeStart[shape];
+    int oldHi = w->shapeStart[shape + 1];
+    int targets = moveCount;
+    int sources = moveCount;
+
+    for (int p = lo; p < hi && p < oldLo; ++p) {
+        if (pool->doomed[p] || w->shape[p] != shape) pool->moveTarget[targets++] = p;
+    }
+    for (int p = lo > oldHi ? lo : oldHi; p < hi; ++p) {
+        if (pool->doomed[p] || w->shape[p] != shape) pool->moveTarget[targets++] = p;
+    }
+    for (int k = 0; k < pool->despawnCount; ++k) {
+        int p = pool->despawn[k];
+        if (p >= lo && p < hi && p >= oldLo && p < oldHi) pool->moveTarget[targets++] = p;
+    }
+
+    for (int p = oldLo; p < oldHi && p < lo; ++p) {
+        if (!pool->doomed[p]) pool->moveSource[sources++] = p;
+    }
+    for (int p = oldLo > hi ? oldLo : hi; p < oldHi; ++p) {
+        if (!pool->doomed[p]) pool->moveSource[sources++] = p;
+    }
+    for (int p = pool->sortedCount; p < w->count; ++p) {
+        if (w->shape[p] == shape && !pool->doomed[p] && (p < lo || p >= hi)) pool->moveSource[sources++] = p;
+    }
+    if (targets != sources) {
+        fprintf(stderr, "Error: Body pool compaction lost track of %s bodies.\n", SHAPE_NAMES[shape]);
+        exit(1);
+    }
+    return targets;
+}
+
+/* Restores the dense layout after a step's despawns and spawns: one batch per
+ * shape, no holes, count live bodies. The new batch boundaries come first; only
+ * bodies outside their new batch move, each once, into the holes inside it,
+ * and everything holding dense indices is remapped in a single pass. */
+void compactBodies() {
+    World* w = &g_world;
+    BodyPool* pool = &g_pool;
+    int oldCount = w->count;
+    if (pool->despawnCount == 0 && pool->sortedCount == oldCount) return;
+
+    int live[SHAPE_COUNT];
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        live[s] = w->shapeStart[s + 1] - w->shapeStart[s];
+    }
+    for (int i = pool->sortedCount; i < oldCount; ++i) {
+        live[w->shape[i]]++;
+    }
+    for (int k = 0; k < pool->despawnCount; ++k) {
+        live[w->shape[pool->despawn[k]]]--;
+    }
+    int newStart[SHAPE_COUNT + 1];
+    newStart[0] = 0;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        newStart[s + 1] = newStart[s] + live[s];
+    }
+    int newCount = newStart[SHAPE_COUNT];
+
+    Aabb vacated[MAX_RESPAWN_BATCH];
+    int vacatedCount = 0;
+    for (int k = 0; k < pool->despawnCount; ++k) {
+        int i = pool->despawn[k];
+        int slot = pool->denseSlot[i];
+        pool->slotGeneration[slot]++;
+        if (pool->slotGeneration[slot] == 0) pool->slotGeneration[slot] = 1;
+        pool->slotDense[slot] = pool->freeHead;
+        pool->freeHead = slot;
+        pool->remap[i] = -1;
+        if (w->resting[i]) {
+            sleepingHashRemove(&g_sleepingHash, i);
+            if (vacatedCount < MAX_RESPAWN_BATCH) vacated[vacatedCount++] = bodyAabb(i);
+        }
+    }
+
+    int moveCount = 0;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        moveCount = collectShapeMoves(pool, s, newStart[s], newStart[s + 1], moveCount);
+    }
+    for (int k = 0; k < moveCount; ++k) {
+        pool->remap[pool->moveSource[k]] = pool->moveTarget[k];
+        if (w->resting[pool->moveSource[k]]) sleepingHashRemove(&g_sleepingHash, pool->moveSource[k]);
+    }
+
+    float** streams[] = { WORLD_FLOAT_STREAMS(w) };
+    for (size_t s = 0; s < sizeof(streams) / sizeof(streams[0]); ++s) {
+        moveBodyElements(*streams[s], sizeof(float), pool, moveCount);
+    }
+    moveBodyElements(w->resting, sizeof(uint8_t), pool, moveCount);
+    moveBodyElements(w->shape, sizeof(uint8_t), pool, moveCount);
+    moveBodyElements(pool->denseSlot, sizeof(int), pool, moveCount);
+    moveBodyElements(pool->spawnStep, sizeof(uint32_t), pool, moveCount);
+    moveBodyElements(pool->sleepStep, sizeof(uint32_t), pool, moveCount);
+    moveBodyElements(pool->globalId, sizeof(uint32_t), pool, moveCount);
+    moveBodyElements(pool->ghost, sizeof(uint8_t), pool, moveCount);
+    for (int k = 0; k < moveCount; ++k) {
+        int target = pool->moveTarget[k];
+        pool->slotDense[pool->denseSlot[target]] = target;
+        if (w->resting[target]) sleepingHashInsert(&g_sleepingHash, target);
+        if (g_respawnQueue.bodyCapacity > 0) g_respawnQueue.bodyTicket[target] = 0;
+    }
+    if (g_respawnQueue.bodyCapacity > 0 && newCount < oldCount) {
+        memset(g_respawnQueue.bodyTicket + newCount, 0, sizeof(uint32_t) * (size_t)(oldCount - newCount));
+    }
+
+    int kept = 0;
+    for (int k = 0; k < w->awakeCount; ++k) {
+        int i = pool->remap[w->awake[k]];
+        if (i >= 0) w->awake[kept++] = i;
+    }
+    w->awakeCount = kept;
+    awakeListPad(w);
+    remapImpulseCache(pool);
+    remapSweepAndPrune(pool, oldCount);
+    remapAabbTree(pool, oldCount, newCount, moveCount);
+
+    for (int k = 0; k < moveCount; ++k) {
+        pool->remap[pool->moveSource[k]] = pool->moveSource[k];
+    }
+    for (int k = 0; k < pool->despawnCount; ++k) {
+        int i = pool->despawn[k];
+        pool->remap[i] = i;
+        pool->doomed[i] = 0;
+    }
+    pool->despawnedTotal += pool->despawnCount;
+    pool->despawnCount = 0;
+    w->count = newCount;
+    pool->sortedCount = newCount;
+    for (int s = 0; s <= SHAPE_COUNT; ++s) {
+        w->shapeStart[s] = newStart[s];
+    }
+    if (vacatedCount > 0) wakeBodiesNear(vacated, vacatedCount);
+}
 
-            float normal_speed = vec3_dot(cube->velocity, normal);
-            Vec3 new_normal_velocity = vec3_mul_scalar(bounce_direction, (-normal_speed * BOUNCE_FACTOR));
-            Vec3 tangential_velocity = vec3_sub(cube->velocity, vec3_mul_scalar(normal, normal_speed));
-            tangential_velocity = vec3_mul_scalar(tangential_velocity, FRICTION_FACTOR);
-            cube->velocity = vec3_add(new_normal_velocity, tangential_velocity);
+/* Lifetime, time asleep and the kill box, checked once per step. Ghosts are
+ * left to the domain that owns them. */
+void applyDespawnRules(float deltaTime) {
+    World* w = &g_world;
+    BodyPool* pool = &g_pool;
+    const DespawnRules* rules = &g_despawn;
+    uint32_t now = (uint32_t)g_stepCount;
+    uint32_t lifetimeSteps = (uint32_t)(rules->lifetime / deltaTime);
+    uint32_t restingSteps = (uint32_t)(rules->restingTime / deltaTime);
+
+    if (rules->lifetime > 0.0f || rules->restingTime > 0.0f) {
+        for (int i = 0; i < w->count; ++i) {
+            if (pool->ghost[i]) continue;
+            bool expired = rules->lifetime > 0.0f && now - pool->spawnStep[i] >= lifetimeSteps;
+            bool settled = rules->restingTime > 0.0f && w->resting[i] && now - pool->sleepStep[i] >= restingSteps;
+            if (expired || settled) despawnBody(i);
+        }
+    }
 
-            if (fabsf(normal_speed) > REST_THRESHOLD) {
-                cube->angularVelocity = vec3_create(rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f));
+    if (rules->boundsHalfWidth > 0.0f) {
+        const vfloat bound = vf_set1(rules->boundsHalfWidth);
+        const vfloat floorY = vf_set1(g_statics.groundY - rules->boundsHalfWidth);
+        for (int base = 0; base < w->count; base += SIMD_WIDTH) {
+            vmask inside = vm_and(vf_lt(vf_abs(vf_load(w->posX + base)), bound), vf_lt(vf_abs(vf_load(w->posZ + base)), bound));
+            inside = vm_and(inside, vf_gt(vf_load(w->posY + base), floorY));
+            int lanes = w->count - base < SIMD_WIDTH ? w->count - base : SIMD_WIDTH;
+            unsigned outside = ~vm_bits(inside) & (0xffffffffu >> (32 - lanes));
+            while (outside) {
+                int i = base + __builtin_ctz(outside);
+                if (!pool->ghost[i]) despawnBody(i);
+                outside &= outside - 1;
             }
         }
+    }
+}
 
-        if (cube->position.z - halfSize < -bound) {
-            cube->position.z = -bound + halfSize;
-            Vec3 normal = vec3_create(0.0f, 0.0f, 1.0f);
-            Vec3 random_perturb = vec3_create(rand_float(-0.5f, 0.5f), rand_float(-0.5f, 0.5f), 0.0f);
-            Vec3 bounce_direction = vec3_normalize(vec3_add(normal, random_perturb));
+/* Each emitter accumulates rate * dt and spawns the whole bodies that are due,
+ * uniformly inside its volume with velocity mean +- spread per axis. */
+void runEmitters(float deltaTime) {
+    World* w = &g_world;
+    EmitterSet* set = &g_emitters;
+    uint32_t step = (uint32_t)g_stepCount;
+    for (int e = 0; e < set->count; ++e) {
+        Emitter* emitter = &set->emitters[e];
+        emitter->credit += emitter->rate * deltaTime;
+        int due = (int)emitter->credit;
+        if (due == 0) continue;
+        emitter->credit -= (float)due;
+
+        int begin = w->count;
+        int spawned = spawnBodies(due, emitter->shape, step);
+        g_pool.droppedTotal += due - spawned;
+        int end = begin + spawned;
+        const Vec3 c = emitter->center, h = emitter->halfExtent, v = emitter->velocity;
+        const float spread = emitter->velocitySpread;
+        random_float_batch(g_spawnSeed, step, RNG_STREAM_EMIT_X, begin, end, c.x - h.x, c.x + h.x, w->posX + begin);
+        random_float_batch(g_spawnSeed, step, RNG_STREAM_EMIT_Y, begin, end, c.y - h.y, c.y + h.y, w->posY + begin);
+        random_float_batch(g_spawnSeed, step, RNG_STREAM_EMIT_Z, begin, end, c.z - h.z, c.z + h.z, w->posZ + begin);
+        random_float_batch(g_spawnSeed, step, RNG_STREAM_EMIT_VX, begin, end, v.x - spread, v.x + spread, w->velX + begin);
+        random_float_batch(g_spawnSeed, step, RNG_STREAM_EMIT_VY, begin, end, v.y - spread, v.y + spread, w->velY + begin);
+        random_float_batch(g_spawnSeed, step, RNG_STREAM_EMIT_VZ, begin, end, v.z - spread, v.z + spread, w->velZ + begin);
+        for (int i = begin; i < end; ++i) {
+            w->prevPosX[i] = w->sweepX[i] = w->posX[i];
+            w->prevPosY[i] = w->sweepY[i] = w->posY[i];
+            w->prevPosZ[i] = w->sweepZ[i] = w->posZ[i];
+        }
+    }
+}
 
-            float normal_speed = vec3_dot(cube->velocity, normal);
-            Vec3 new_normal_velocity = vec3_mul_scalar(bounce_direction, (-normal_speed * BOUNCE_FACTOR));
-            Vec3 tangential_velocity = vec3_sub(cube->velocity, vec3_mul_scalar(normal, normal_speed));
-            tangential_velocity = vec3_mul_scalar(tangential_velocity, FRICTION_FACTOR);
-            cube->velocity = vec3_add(new_normal_velocity, tangential_velocity);
+static void addEmitter(ShapeType shape, Vec3 center, Vec3 halfExtent, float rate, Vec3 velocity, float spread) {
+    EmitterSet* set = &g_emitters;
+    if (set->count >= MAX_EMITTERS) {
+        fprintf(stderr, "Error: Too many emitters (max %d).\n", MAX_EMITTERS);
+        exit(1);
+    }
+    Emitter* emitter = &set->emitters[set->count++];
+    emitter->center = center;
+    emitter->halfExtent = halfExtent;
+    emitter->rate = rate;
+    emitter->velocity = velocity;
+    emitter->velocitySpread = spread;
+    emitter->credit = 0.0f;
+    emitter->shape = shape;
+}
 
-            if (fabsf(normal_speed) > REST_THRESHOLD) {
-                cube->angularVelocity = vec3_create(rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f));
+/* Emitter files hold one emitter per line:
+ *   emitter [box|sphere|capsule] cx cy cz hx hy hz rate [vx vy vz [spread]]
+ * Blank lines and lines starting with '#' are ignored. Emitters spawn boxes
+ * unless a shape is given. */
+static void loadEmitters(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open emitter file '%s'.\n", path);
+        exit(1);
+    }
+    char line[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        float v[11] = { 0.0f };
+        char kind[16];
+        char shapeName[16];
+        if (sscanf(line, "%15s", kind) != 1 || kind[0] == '#') continue;
+        ShapeType shape = SHAPE_BOX;
+        const char* format = "%*s %f %f %f %f %f %f %f %f %f %f %f";
+        if (sscanf(line, "%*s %15s", shapeName) == 1) {
+            for (int s = 0; s < SHAPE_COUNT; ++s) {
+                if (strcmp(shapeName, SHAPE_NAMES[s]) == 0) {
+                    shape = (ShapeType)s;
+                    format = "%*s %*s %f %f %f %f %f %f %f %f %f %f %f";
+                }
             }
-        } else if (cube->position.z + halfSize > bound) {
-            cube->position.z = bound - halfSize;
-            Vec3 normal = vec3_create(0.0f, 0.0f, -1.0f);
-            Vec3 random_perturb = vec3_create(rand_float(-0.5f, 0.5f), rand_float(-0.5f, 0.5f), 0.0f);
-            Vec3 bounce_direction = vec3_normalize(vec3_add(normal, random_perturb));
+        }
+        int fields = sscanf(line, format, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10]);
+        if (strcmp(kind, "emitter") != 0 || (fields != 7 && fields != 10 && fields != 11) || v[6] < 0.0f) {
+            fprintf(stderr, "Error: %s:%d: expected 'emitter [shape] cx cy cz hx hy hz rate [vx vy vz [spread]]'.\n",
+                    path, lineNumber);
+            exit(1);
+        }
+        addEmitter(shape, vec3_create(v[0], v[1], v[2]), vec3_create(fabsf(v[3]), fabsf(v[4]), fabsf(v[5])), v[6],
+                   vec3_create(v[7], v[8], v[9]), fabsf(v[10]));
+    }
+    fclose(file);
+}
+
+/* --emit adds one emitter spanning the arena at the usual drop height; the pool
+ * capacity defaults to the initial cubes plus headroom whenever emitters exist. */
+void buildEmitters() {
+    EmitterSet* set = &g_emitters;
+    set->count = 0;
+    if (set->quickRate > 0.0f) {
+        float halfWidth = (g_statics.arenaHalfWidth > 0.0f ? g_statics.arenaHalfWidth : DEFAULT_ARENA_HALF_WIDTH) * 0.9f;
+        float floorY = g_terrain.heights != NULL ? fmaxf(g_statics.groundY, g_terrain.maxY) : g_statics.groundY;
+        float dropY = floorY + 12.0f;
+        addEmitter(SHAPE_BOX, vec3_create(0.0f, dropY, 0.0f), vec3_create(halfWidth, 1.0f, halfWidth), set->quickRate,
+                   vec3_create(0.0f, 0.0f, 0.0f), 0.0f);
+    }
+    if (set->path != NULL) {
+        loadEmitters(set->path);
+    }
+    int initial = g_numCubes + g_numSpheres + g_numCapsules;
+    if (g_maxCubes == 0) {
+        g_maxCubes = initial + (set->count > 0 ? DEFAULT_EMITTER_HEADROOM : 0);
+        /* A domain may end up owning every body and still hold ghosts. */
+        if (g_domains.count > 1) g_maxCubes += initial;
+        if (g_maxCubes > MAX_NUM_CUBES) g_maxCubes = MAX_NUM_CUBES;
+    }
+    if (g_maxCubes < initial) {
+        fprintf(stderr, "Error: --max-cubes %d is below the %d initial bodies.\n", g_maxCubes, initial);
+        exit(1);
+    }
+    if (g_maxCubes == 0) {
+        fprintf(stderr, "Error: No cubes to simulate; pass --cubes or an emitter.\n");
+        exit(1);
+    }
+}
+
+/* Forks one process per slab after the options are parsed, so every domain
+ * starts from the same seed and spawns the same full set of bodies; each then
+ * keeps the ones inside its slab. Neighbouring slabs share a socket pair. */
+void startDomains() {
+    DomainSet* d = &g_domains;
+    d->minX = -INFINITY;
+    d->maxX = INFINITY;
+    if (d->count <= 1) return;
+
+    if (!g_headless) {
+        fprintf(stderr, "Error: --domains runs headless; add --headless.\n");
+        exit(1);
+    }
+    if (g_headlessSeconds > 0.0) {
+        fprintf(stderr, "Error: --seconds depends on wall-clock time; use --steps with --domains.\n");
+        exit(1);
+    }
+    if (g_emitters.count > 0 || g_respawnRate > 0.0f) {
+        fprintf(stderr, "Error: --domains cannot be combined with emitters or --respawn-rate.\n");
+        exit(1);
+    }
+    if (g_recordPath != NULL || g_replayPath != NULL) {
+        fprintf(stderr, "Error: --domains cannot be combined with --record or --replay.\n");
+        exit(1);
+    }
+
+    float halfWidth = g_statics.arenaHalfWidth > 0.0f ? g_statics.arenaHalfWidth : DEFAULT_ARENA_HALF_WIDTH;
+    float slabWidth = 2.0f * halfWidth / (float)d->count;
+    d->ghostMargin = 2.0f * BOUNDING_EXTENT_SCALE * g_cubeSizeMax + DOMAIN_GHOST_SLACK;
+    if (slabWidth < 2.0f * d->ghostMargin) {
+        fprintf(stderr, "Error: --domains %d leaves slabs %.2f wide, under twice the %.2f ghost band; use fewer domains or a wider --arena.\n",
+                d->count, slabWidth, d->ghostMargin);
+        exit(1);
+    }
+    if (g_threadCount == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        g_threadCount = online > d->count ? (int)(online / d->count) : 1;
+    }
+
+    int pairs[MAX_DOMAINS - 1][2];
+    for (int k = 0; k + 1 < d->count; ++k) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[k]) != 0) {
+            fprintf(stderr, "Error: Could not connect domains: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    fflush(stdout);
+    fflush(stderr);
+    int rank = 0;
+    for (int k = 1; k < d->count; ++k) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Error: Could not start domain %d: %s\n", k, strerror(errno));
+            exit(1);
+        }
+        if (pid == 0) {
+            rank = k;
+            memset(d->children, 0, sizeof(d->children));
+            break;
+        }
+        d->children[k] = pid;
+    }
+
+    /* Pair k joins slab k (end 0) to slab k + 1 (end 1). */
+    d->rank = rank;
+    for (int k = 0; k + 1 < d->count; ++k) {
+        if (k == rank) d->link[1] = pairs[k][0];
+        else close(pairs[k][0]);
+        if (k + 1 == rank) d->link[0] = pairs[k][1];
+        else close(pairs[k][1]);
+    }
+    for (int side = 0; side < 2; ++side) {
+        if (d->link[side] >= 0) fcntl(d->link[side], F_SETFL, fcntl(d->link[side], F_GETFL) | O_NONBLOCK);
+    }
+    if (rank > 0) d->minX = -halfWidth + slabWidth * (float)rank;
+    if (rank + 1 < d->count) d->maxX = -halfWidth + slabWidth * (float)(rank + 1);
+}
+
+/* After a reset every domain holds the whole spawn; global ids are the spawn
+ * indices, and bodies outside the slab are dropped. */
+void claimDomainBodies() {
+    const DomainSet* d = &g_domains;
+    World* w = &g_world;
+    if (d->count <= 1) return;
+    for (int i = 0; i < w->count; ++i) {
+        if (w->posX[i] < d->minX || w->posX[i] >= d->maxX) despawnBody(i);
+    }
+    compactBodies();
+}
+
+/* ghost is 0 for an owned body, else 1 plus the link its owner sits behind.
+ * Kinematic halo ghosts get no mass, so nothing they touch moves them. */
+static void setDomainGhost(int i, uint8_t ghost, bool kinematic) {
+    World* w = &g_world;
+    g_pool.ghost[i] = ghost;
+    if (kinematic) {
+        w->invMass[i] = w->invInertiaX[i] = w->invInertiaY[i] = w->invInertiaZ[i] = 0.0f;
+    } else {
+        computeBodyMass(i);
+    }
+}
 
-            float normal_speed = vec3_dot(cube->velocity, normal);
-            Vec3 new_normal_velocity = vec3_mul_scalar(bounce_direction, (-normal_speed * BOUNCE_FACTOR));
-            Vec3 tangential_velocity = vec3_sub(cube->velocity, vec3_mul_scalar(normal, normal_speed));
-            tangential_velocity = vec3_mul_scalar(tangential_velocity, FRICTION_FACTOR);
-            cube->velocity = vec3_add(new_normal_velocity, tangential_velocity);
+static DomainRecord* domainBufferPush(DomainBuffer* buffer) {
+    reserveArray((void**)&buffer->records, sizeof(DomainRecord), &buffer->capacity, (int)buffer->count + 1);
+    DomainRecord* r = &buffer->records[buffer->count++];
+    memset(r, 0, sizeof(*r));
+    return r;
+}
+
+static void pushDomainRecord(DomainBuffer* buffer, int i, DomainRecordKind kind) {
+    const World* w = &g_world;
+    const BodyPool* pool = &g_pool;
+    DomainRecord* r = domainBufferPush(buffer);
+    r->id = pool->globalId[i];
+    r->age = (uint32_t)g_stepCount - pool->spawnStep[i];
+    r->kind = (uint8_t)kind;
+    r->shape = w->shape[i];
+    r->resting = w->resting[i];
+    r->size = w->size[i];
+    r->color[0] = w->colorR[i];
+    r->color[1] = w->colorG[i];
+    r->color[2] = w->colorB[i];
+    r->position[0] = w->posX[i];
+    r->position[1] = w->posY[i];
+    r->position[2] = w->posZ[i];
+    r->orientation[0] = w->quatW[i];
+    r->orientation[1] = w->quatX[i];
+    r->orientation[2] = w->quatY[i];
+    r->orientation[3] = w->quatZ[i];
+    r->velocity[0] = w->velX[i];
+    r->velocity[1] = w->velY[i];
+    r->velocity[2] = w->velZ[i];
+    r->angularVelocity[0] = w->angVelX[i];
+    r->angularVelocity[1] = w->angVelY[i];
+    r->angularVelocity[2] = w->angVelZ[i];
+    r->sleepTimer = w->sleepTimer[i];
+}
+
+static void loadDomainRecord(const DomainRecord* r, int i) {
+    World* w = &g_world;
+    if (w->resting[i]) {
+        sleepingHashRemove(&g_sleepingHash, i);
+        if (!g_sweepAndPrune.dirty) sapRemoveSleeper(&g_sweepAndPrune, i);
+    }
+    w->size[i] = r->size;
+    w->colorR[i] = r->color[0];
+    w->colorG[i] = r->color[1];
+    w->colorB[i] = r->color[2];
+    w->posX[i] = w->prevPosX[i] = w->sweepX[i] = r->position[0];
+    w->posY[i] = w->prevPosY[i] = w->sweepY[i] = r->position[1];
+    w->posZ[i] = w->prevPosZ[i] = w->sweepZ[i] = r->position[2];
+    w->quatW[i] = w->prevQuatW[i] = r->orientation[0];
+    w->quatX[i] = w->prevQuatX[i] = r->orientation[1];
+    w->quatY[i] = w->prevQuatY[i] = r->orientation[2];
+    w->quatZ[i] = w->prevQuatZ[i] = r->orientation[3];
+    w->velX[i] = r->velocity[0];
+    w->velY[i] = r->velocity[1];
+    w->velZ[i] = r->velocity[2];
+    w->angVelX[i] = r->angularVelocity[0];
+    w->angVelY[i] = r->angularVelocity[1];
+    w->angVelZ[i] = r->angularVelocity[2];
+    w->sleepTimer[i] = r->sleepTimer;
+    if (w->resting[i]) {
+        sleepingHashInsert(&g_sleepingHash, i);
+        if (!g_sweepAndPrune.dirty) sapInsertSleeper(&g_sweepAndPrune, i);
+    }
+    setDomainGhost(i, g_pool.ghost[i], r->kind == DOMAIN_RECORD_HALO);
+}
+
+static void domainLinkFailed(const char* what) {
+    fprintf(stderr, "Error: Domain %d lost its neighbour while %s: %s\n", g_domains.rank, what,
+            errno != 0 ? strerror(errno) : "connection closed");
+    exit(1);
+}
+
+/* Progress on one link's message: a record count, then the records. Returns
+ * false once the socket would block. */
+static bool domainSendSome(int fd, const DomainBuffer* buffer, size_t* sent) {
+    size_t total = sizeof(uint32_t) + sizeof(DomainRecord) * buffer->count;
+    while (*sent < total) {
+        const char* data = *sent < sizeof(uint32_t) ? (const char*)&buffer->count + *sent
+                                                     : (const char*)buffer->records + (*sent - sizeof(uint32_t));
+        size_t length = *sent < sizeof(uint32_t) ? sizeof(uint32_t) - *sent : total - *sent;
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+            if (errno == EINTR) continue;
+            domainLinkFailed("sending");
+        }
+        *sent += (size_t)n;
+    }
+    return true;
+}
+
+static bool domainReceiveSome(int fd, DomainBuffer* buffer, size_t* received) {
+    while (*received < sizeof(uint32_t) || *received < sizeof(uint32_t) + sizeof(DomainRecord) * buffer->count) {
+        char* data;
+        size_t length;
+        if (*received < sizeof(uint32_t)) {
+            data = (char*)&buffer->count + *received;
+            length = sizeof(uint32_t) - *received;
+        } else {
+            data = (char*)buffer->records + (*received - sizeof(uint32_t));
+            length = sizeof(uint32_t) + sizeof(DomainRecord) * buffer->count - *received;
+        }
+        ssize_t n = recv(fd, data, length, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+            if (errno == EINTR) continue;
+            domainLinkFailed("receiving");
+        }
+        if (n == 0) {
+            errno = 0;
+            domainLinkFailed("receiving");
+        }
+        *received += (size_t)n;
+        if (*received == sizeof(uint32_t)) {
+            reserveArray((void**)&buffer->records, sizeof(DomainRecord), &buffer->capacity, (int)buffer->count);
+        }
+    }
+    return true;
+}
 
-            if (fabsf(normal_speed) > REST_THRESHOLD) {
-                cube->angularVelocity = vec3_create(rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f), rand_float(-180.0f, 180.0f));
+/* Sends both outboxes and fills both inboxes at once; neither side blocks on a
+ * full socket while its neighbour is doing the same. */
+static void transferDomainBuffers(DomainSet* d) {
+    size_t sent[2] = { 0, 0 }, received[2] = { 0, 0 };
+    bool sendDone[2], receiveDone[2];
+    for (int side = 0; side < 2; ++side) {
+        sendDone[side] = receiveDone[side] = d->link[side] < 0;
+        d->inbox[side].count = 0;
+    }
+    while (!sendDone[0] || !sendDone[1] || !receiveDone[0] || !receiveDone[1]) {
+        struct pollfd fds[2];
+        int sides[2];
+        int n = 0;
+        for (int side = 0; side < 2; ++side) {
+            if (sendDone[side] && receiveDone[side]) continue;
+            fds[n].fd = d->link[side];
+            fds[n].events = (short)((sendDone[side] ? 0 : POLLOUT) | (receiveDone[side] ? 0 : POLLIN));
+            fds[n].revents = 0;
+            sides[n++] = side;
+        }
+        if (poll(fds, (nfds_t)n, -1) < 0) {
+            if (errno == EINTR) continue;
+            domainLinkFailed("waiting");
+        }
+        for (int k = 0; k < n; ++k) {
+            int side = sides[k];
+            if (!sendDone[side] && (fds[k].revents & (POLLOUT | POLLERR))) {
+                sendDone[side] = domainSendSome(d->link[side], &d->outbox[side], &sent[side]);
+            }
+            if (!receiveDone[side] && (fds[k].revents & (POLLIN | POLLHUP | POLLERR))) {
+                receiveDone[side] = domainReceiveSome(d->link[side], &d->inbox[side], &received[side]);
             }
         }
+    }
+}
+
+static int compareDomainGhosts(const void* a, const void* b) {
+    uint32_t x = ((const DomainGhost*)a)->id, y = ((const DomainGhost*)b)->id;
+    return (x > y) - (x < y);
+}
+
+static DomainGhost* findDomainGhost(DomainSet* d, uint32_t id) {
+    int lo = 0, hi = d->ghostCount;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (d->ghosts[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < d->ghostCount && d->ghosts[lo].id == id ? &d->ghosts[lo] : NULL;
+}
 
-        if (vec3_length(cube->velocity) < REST_THRESHOLD && vec3_length(cube->angularVelocity) < REST_THRESHOLD * 10 && (cube_bottom <= GROUND_Y + REST_THRESHOLD)) {
-            cube->resting = true;
-            cube->velocity = vec3_create(0.0f, 0.0f, 0.0f);
-            cube->angularVelocity = vec3_create(0.0f, 0.0f, 0.0f);
+/* Ghosts found in the lookup are refreshed in place and ticked off; the rest
+ * are spawned. A ghost and its record both asleep are left untouched so a
+ * settled border does not keep waking up. */
+static void applyDomainRecords(DomainSet* d, int side) {
+    World* w = &g_world;
+    BodyPool* pool = &g_pool;
+    const DomainBuffer* inbox = &d->inbox[side];
+    uint32_t now = (uint32_t)g_stepCount;
+    d->recordsReceived += inbox->count;
+    for (uint32_t k = 0; k < inbox->count; ++k) {
+        const DomainRecord* r = &inbox->records[k];
+        DomainGhost* ghost = findDomainGhost(d, r->id);
+        int i;
+        if (ghost != NULL) {
+            i = ghost->body;
+            ghost->body = -1;
         } else {
-            cube->resting = false;
+            i = w->count;
+            if (spawnBodies(1, (ShapeType)r->shape, now) == 0) {
+                pool->droppedTotal++;
+                continue;
+            }
+            pool->globalId[i] = r->id;
+        }
+        pool->ghost[i] = r->kind == DOMAIN_RECORD_MIGRATE ? 0 : (uint8_t)(1 + side);
+        pool->spawnStep[i] = now - r->age;
+        if (r->kind == DOMAIN_RECORD_MIGRATE) d->migratedIn++;
+        else if (ghost != NULL && r->resting && w->resting[i]) continue;
+        if (!r->resting) wakeBody(i);
+        loadDomainRecord(r, i);
+    }
+}
+
+/* One exchange per step, before compaction: owned bodies that left the slab
+ * migrate to the neighbour and stay behind as ghosts, owned bodies within two
+ * margins of a border are mirrored, and ghosts no neighbour reported any more
+ * are dropped. */
+void exchangeDomainBodies() {
+    DomainSet* d = &g_domains;
+    World* w = &g_world;
+    BodyPool* pool = &g_pool;
+    if (d->count <= 1) return;
+
+    d->ghostCount = 0;
+    for (int i = 0; i < w->count; ++i) {
+        if (!pool->ghost[i]) continue;
+        reserveArray((void**)&d->ghosts, sizeof(DomainGhost), &d->ghostCapacity, d->ghostCount + 1);
+        d->ghosts[d->ghostCount].id = pool->globalId[i];
+        d->ghosts[d->ghostCount++].body = i;
+    }
+    qsort(d->ghosts, (size_t)d->ghostCount, sizeof(DomainGhost), compareDomainGhosts);
+
+    d->outbox[0].count = d->outbox[1].count = 0;
+    for (int i = 0; i < w->count; ++i) {
+        if (pool->ghost[i] || pool->doomed[i]) continue;
+        float x = w->posX[i];
+        int leaving = x < d->minX ? 0 : (x >= d->maxX ? 1 : -1);
+        if (leaving >= 0) {
+            pushDomainRecord(&d->outbox[leaving], i, DOMAIN_RECORD_MIGRATE);
+            setDomainGhost(i, (uint8_t)(1 + leaving), false);
+            d->migratedOut++;
+            continue;
+        }
+        float below = x - d->minX, above = d->maxX - x;
+        if (d->link[0] >= 0 && below < 2.0f * d->ghostMargin) {
+            pushDomainRecord(&d->outbox[0], i, below < d->ghostMargin ? DOMAIN_RECORD_GHOST : DOMAIN_RECORD_HALO);
+        }
+        if (d->link[1] >= 0 && above <= 2.0f * d->ghostMargin) {
+            pushDomainRecord(&d->outbox[1], i, above <= d->ghostMargin ? DOMAIN_RECORD_GHOST : DOMAIN_RECORD_HALO);
         }
     }
 
+    transferDomainBuffers(d);
+    applyDomainRecords(d, 0);
+    applyDomainRecords(d, 1);
+    for (int k = 0; k < d->ghostCount; ++k) {
+        if (d->ghosts[k].body >= 0) despawnBody(d->ghosts[k].body);
+    }
 }
 
-void drawCube(const Vec3* position, const Vec3* rotation, const Vec3* color, float size) {
-    glPushMatrix();
+typedef struct {
+    long long owned;
+    long long ghosts;
+    long long awake;
+    long long migrations;
+    double cubeStepsPerSecond;
+} DomainTotals;
+
+static void domainTransferAll(int fd, void* data, size_t bytes, bool sending) {
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = sending ? send(fd, (char*)data + done, bytes - done, MSG_NOSIGNAL)
+                            : recv(fd, (char*)data + done, bytes - done, 0);
+        if (n > 0) {
+            done += (size_t)n;
+            continue;
+        }
+        if (n == 0) {
+            errno = 0;
+            domainLinkFailed("reporting");
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) domainLinkFailed("reporting");
+        struct pollfd pfd = { fd, (short)(sending ? POLLOUT : POLLIN), 0 };
+        poll(&pfd, 1, -1);
+    }
+}
+
+/* Each domain prints its line once the one below has, passing running totals
+ * up the chain; the top domain sends the grand totals back down to domain 0,
+ * which waits for the others to exit and prints them. */
+void reportDomains(double stepsPerSecond) {
+    DomainSet* d = &g_domains;
+    const World* w = &g_world;
+    DomainTotals totals = { 0, 0, 0, 0, 0.0 };
+    if (d->link[0] >= 0) domainTransferAll(d->link[0], &totals, sizeof(totals), false);
+
+    int ghosts = 0;
+    for (int i = 0; i < w->count; ++i) {
+        ghosts += g_pool.ghost[i] != 0;
+    }
+    int owned = w->count - ghosts;
+    printf("Domain %d: x in [%.2f, %.2f), %d owned, %d ghosts, %d awake, migrated %lld in and %lld out, %lld records received, checksum %016llx\n",
+           d->rank, d->minX, d->maxX, owned, ghosts, w->awakeCount, d->migratedIn, d->migratedOut, d->recordsReceived,
+           (unsigned long long)worldChecksum());
+    fflush(stdout);
+    totals.owned += owned;
+    totals.ghosts += ghosts;
+    totals.awake += w->awakeCount;
+    totals.migrations += d->migratedOut;
+    totals.cubeStepsPerSecond += stepsPerSecond * owned;
+
+    if (d->link[1] >= 0) {
+        domainTransferAll(d->link[1], &totals, sizeof(totals), true);
+        domainTransferAll(d->link[1], &totals, sizeof(totals), false);
+    }
+    if (d->link[0] >= 0) domainTransferAll(d->link[0], &totals, sizeof(totals), true);
+    for (int side = 0; side < 2; ++side) {
+        if (d->link[side] >= 0) close(d->link[side]);
+        d->link[side] = -1;
+    }
+    if (d->rank > 0) return;
+
+    bool failed = false;
+    for (int k = 1; k < d->count; ++k) {
+        int status = 0;
+        if (waitpid(d->children[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = true;
+    }
+    printf("Domains: %d processes, %lld bodies owned, %lld ghosts, %lld awake, %lld migrations, %.4g cube-steps/sec\n",
+           d->count, totals.owned, totals.ghosts, totals.awake, totals.migrations, totals.cubeStepsPerSecond);
+    if (failed) {
+        fprintf(stderr, "Error: A domain process failed.\n");
+        exit(1);
+    }
+}
+
+uint64_t worldChecksum() {
+    World* w = &g_world;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    float** streams[] = { WORLD_FLOAT_STREAMS(w) };
+    for (size_t s = 0; s < sizeof(streams) / sizeof(streams[0]); ++s) {
+        const uint32_t* words = (const uint32_t*)*streams[s];
+        for (int i = 0; i < w->count; ++i) {
+            hash = (hash ^ words[i]) * 0x100000001b3ull;
+        }
+    }
+    for (int i = 0; i < w->count; ++i) {
+        hash = (hash ^ w->resting[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static void replayPushCheckpoint(Replay* replay, long step, uint64_t checksum) {
+    reserveArray((void**)&replay->checkpoints, sizeof(ReplayCheckpoint), &replay->capacity, replay->count + 1);
+    replay->checkpoints[replay->count].step = step;
+    replay->checkpoints[replay->count].checksum = checksum;
+    replay->count++;
+}
+
+void loadReplay(const char* path) {
+    Replay* replay = &g_replay;
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open replay '%s'.\n", path);
+        exit(1);
+    }
+
+    char line[256];
+    char key[64];
+    char value[128];
+    int version = 0;
+    if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "fenderz-replay %d", &version) != 1 || version != 1) {
+        fprintf(stderr, "Error: '%s' is not a fenderz replay.\n", path);
+        exit(1);
+    }
+
+    replay->endStep = -1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        long step;
+        unsigned long long checksum;
+        if (sscanf(line, "step %ld %llx", &step, &checksum) == 2) {
+            replayPushCheckpoint(replay, step, checksum);
+        } else if (sscanf(line, "end %ld %llx", &step, &checksum) == 2) {
+            replayPushCheckpoint(replay, step, checksum);
+            replay->endStep = step;
+        } else if (sscanf(line, "%63s %127s", key, value) == 2) {
+            if (strcmp(key, "seed") == 0) g_seed = (uint32_t)parseIntArg(value, "replay seed", 0, 0xffffffffL);
+            else if (strcmp(key, "cubes") == 0) g_numCubes = (int)parseIntArg(value, "replay cubes", 0, MAX_NUM_CUBES);
+            else if (strcmp(key, "spheres") == 0) g_numSpheres = (int)parseIntArg(value, "replay spheres", 0, MAX_NUM_CUBES);
+            else if (strcmp(key, "capsules") == 0) g_numCapsules = (int)parseIntArg(value, "replay capsules", 0, MAX_NUM_CUBES);
+            else if (strcmp(key, "max-cubes") == 0) g_maxCubes = (int)parseIntArg(value, "replay max-cubes", 1, MAX_NUM_CUBES);
+            else if (strcmp(key, "emit") == 0) g_emitters.quickRate = (float)parseFloatArg(value, "replay emit", 0.0, 1e7);
+            else if (strcmp(key, "emitters") == 0) g_emitters.path = strdup(value);
+            else if (strcmp(key, "lifetime") == 0) g_despawn.lifetime = (float)parseFloatArg(value, "replay lifetime", 0.0, 1e9);
+            else if (strcmp(key, "despawn-resting") == 0) g_despawn.restingTime = (float)parseFloatArg(value, "replay despawn-resting", 0.0, 1e9);
+            else if (strcmp(key, "despawn-bounds") == 0) g_despawn.boundsHalfWidth = (float)parseFloatArg(value, "replay despawn-bounds", 0.0, 1e9);
+            else if (strcmp(key, "broadphase") == 0) {
+                g_broadphase = (BroadphaseType)parseEnumArg(value, "replay broadphase", BROADPHASE_NAMES,
+                                                            sizeof(BROADPHASE_NAMES) / sizeof(BROADPHASE_NAMES[0]));
+            }
+            else if (strcmp(key, "size-min") == 0) g_cubeSizeMin = (float)parseFloatArg(value, "replay size-min", 0.01, 8.0);
+            else if (strcmp(key, "size-max") == 0) g_cubeSizeMax = (float)parseFloatArg(value, "replay size-max", 0.01, 8.0);
+            else if (strcmp(key, "iterations") == 0) g_solverIterations = (int)parseIntArg(value, "replay iterations", 1, 256);
+            else if (strcmp(key, "restitution") == 0) g_restitution = (float)parseFloatArg(value, "replay restitution", 0.0, 1.0);
+            else if (strcmp(key, "friction") == 0) g_friction = (float)parseFloatArg(value, "replay friction", 0.0, 10.0);
+            else if (strcmp(key, "ccd") == 0) g_ccdThreshold = (float)parseFloatArg(value, "replay ccd", 0.0, 1e6);
+            else if (strcmp(key, "respawn-rate") == 0) g_respawnRate = (float)parseFloatArg(value, "replay respawn-rate", 0.0, 1e7);
+            else if (strcmp(key, "max-substeps") == 0) g_substeps.maxSubsteps = (int)parseIntArg(value, "replay max-substeps", 1, 64);
+            else if (strcmp(key, "substep-speed") == 0) g_substeps.speedLimit = (float)parseFloatArg(value, "replay substep-speed", 0.0, 1e6);
+            else if (strcmp(key, "substep-contacts") == 0) g_substeps.contactLimit = (int)parseIntArg(value, "replay substep-contacts", 0, 1 << 30);
+            else if (strcmp(key, "arena") == 0) g_statics.arenaHalfWidth = (float)parseFloatArg(value, "replay arena", 0.0, 1e6);
+            else if (strcmp(key, "ground") == 0) g_statics.groundY = (float)parseFloatArg(value, "replay ground", -1e6, 1e6);
+            else if (strcmp(key, "colliders") == 0) g_statics.path = strdup(value);
+            else if (strcmp(key, "terrain") == 0) g_terrain.path = strdup(value);
+            else if (strcmp(key, "terrain-size") == 0) parseTerrainSize(value, "replay terrain-size");
+            else if (strcmp(key, "terrain-scale") == 0) g_terrain.horizontalScale = (float)parseFloatArg(value, "replay terrain-scale", 0.01, 1e6);
+            else if (strcmp(key, "terrain-height") == 0) g_terrain.heightScale = (float)parseFloatArg(value, "replay terrain-height", 0.0, 1e6);
+        }
+    }
+    fclose(file);
+
+    if (replay->endStep < 0) {
+        fprintf(stderr, "Error: Replay '%s' is truncated (no end record).\n", path);
+        exit(1);
+    }
+    g_seedSet = true;
+    g_headless = true;
+    g_headlessSteps = replay->endStep;
+    g_headlessSeconds = 0.0;
+    replay->divergedStep = -1;
+}
+
+void openRecording(const char* path) {
+    Replay* replay = &g_replay;
+    replay->file = fopen(path, "w");
+    if (replay->file == NULL) {
+        fprintf(stderr, "Error: Could not create recording '%s'.\n", path);
+        exit(1);
+    }
+    fprintf(replay->file, "fenderz-replay 1\n");
+    fprintf(replay->file, "seed %u\n", g_seed);
+    fprintf(replay->file, "cubes %d\n", g_numCubes);
+    fprintf(replay->file, "spheres %d\n", g_numSpheres);
+    fprintf(replay->file, "capsules %d\n", g_numCapsules);
+    fprintf(replay->file, "max-cubes %d\n", g_maxCubes);
+    fprintf(replay->file, "emit %a\n", (double)g_emitters.quickRate);
+    if (g_emitters.path != NULL) {
+        fprintf(replay->file, "emitters %s\n", g_emitters.path);
+    }
+    fprintf(replay->file, "lifetime %a\n", (double)g_despawn.lifetime);
+    fprintf(replay->file, "despawn-resting %a\n", (double)g_despawn.restingTime);
+    fprintf(replay->file, "despawn-bounds %a\n", (double)g_despawn.boundsHalfWidth);
+    fprintf(replay->file, "broadphase %s\n", BROADPHASE_NAMES[g_broadphase]);
+    fprintf(replay->file, "size-min %a\n", (double)g_cubeSizeMin);
+    fprintf(replay->file, "size-max %a\n", (double)g_cubeSizeMax);
+    fprintf(replay->file, "iterations %d\n", g_solverIterations);
+    fprintf(replay->file, "restitution %a\n", (double)g_restitution);
+    fprintf(replay->file, "friction %a\n", (double)g_friction);
+    fprintf(replay->file, "ccd %a\n", (double)g_ccdThreshold);
+    fprintf(replay->file, "respawn-rate %a\n", (double)g_respawnRate);
+    fprintf(replay->file, "max-substeps %d\n", g_substeps.maxSubsteps);
+    fprintf(replay->file, "substep-speed %a\n", (double)g_substeps.speedLimit);
+    fprintf(replay->file, "substep-contacts %d\n", g_substeps.contactLimit);
+    fprintf(replay->file, "arena %a\n", (double)g_statics.arenaHalfWidth);
+    fprintf(replay->file, "ground %a\n", (double)g_statics.groundY);
+    if (g_statics.path != NULL) {
+        fprintf(replay->file, "colliders %s\n", g_statics.path);
+    }
+    if (g_terrain.path != NULL) {
+        fprintf(replay->file, "terrain %s\n", g_terrain.path);
+        fprintf(replay->file, "terrain-size %dx%d\n", g_terrain.width, g_terrain.depth);
+        fprintf(replay->file, "terrain-scale %a\n", (double)g_terrain.horizontalScale);
+        fprintf(replay->file, "terrain-height %a\n", (double)g_terrain.heightScale);
+    }
+}
+
+void closeRecording() {
+    Replay* replay = &g_replay;
+    if (replay->file == NULL) return;
+    fprintf(replay->file, "end %ld %016llx\n", g_stepCount, (unsigned long long)worldChecksum());
+    fclose(replay->file);
+    replay->file = NULL;
+}
+
+void replayCheckpoint() {
+    Replay* replay = &g_replay;
+    bool interval = g_stepCount % REPLAY_CHECKPOINT_INTERVAL == 0;
+    bool expected = replay->next < replay->count && replay->checkpoints[replay->next].step == g_stepCount;
+    if (!interval && !expected) return;
+
+    uint64_t checksum = worldChecksum();
+    if (interval && replay->file != NULL) {
+        fprintf(replay->file, "step %ld %016llx\n", g_stepCount, (unsigned long long)checksum);
+    }
+    while (replay->next < replay->count && replay->checkpoints[replay->next].step == g_stepCount) {
+        const ReplayCheckpoint* checkpoint = &replay->checkpoints[replay->next++];
+        if (checkpoint->checksum != checksum && replay->divergedStep < 0) {
+            replay->divergedStep = g_stepCount;
+            replay->expected = checkpoint->checksum;
+            replay->actual = checksum;
+        }
+    }
+}
 
-    glTranslatef(position->x, position->y, position->z);
+void shutdownSimulation() {
+    closeRecording();
+    free(g_replay.checkpoints);
+    g_replay.checkpoints = NULL;
+    g_replay.count = 0;
+    g_replay.capacity = 0;
+
+    spatialHashFree(&g_spatialHash);
+    sleepingHashFree(&g_sleepingHash);
+
+    free(g_pairs.pairs);
+    memset(&g_pairs, 0, sizeof(g_pairs));
+    free(g_manifolds.manifolds);
+    memset(&g_manifolds, 0, sizeof(g_manifolds));
+    free(g_constraints.constraints);
+    memset(&g_constraints, 0, sizeof(g_constraints));
+    free(g_impulseCache.entries);
+    free(g_impulseCache.scratch);
+    memset(&g_impulseCache, 0, sizeof(g_impulseCache));
+    free(g_islands.parent);
+    free(g_islands.sleepTimer);
+    free(g_islands.slept);
+    memset(&g_islands, 0, sizeof(g_islands));
+    BodyPool* pool = &g_pool;
+    free(pool->slotDense);
+    free(pool->slotGeneration);
+    free(pool->denseSlot);
+    free(pool->spawnStep);
+    free(pool->sleepStep);
+    free(pool->doomed);
+    free(pool->despawn);
+    free(pool->remap);
+    free(pool->moveSource);
+    free(pool->moveTarget);
+    free(pool->scratch);
+    free(pool->globalId);
+    free(pool->ghost);
+    memset(pool, 0, sizeof(*pool));
+    DomainSet* domains = &g_domains;
+    for (int side = 0; side < 2; ++side) {
+        free(domains->outbox[side].records);
+        free(domains->inbox[side].records);
+        memset(&domains->outbox[side], 0, sizeof(DomainBuffer));
+        memset(&domains->inbox[side], 0, sizeof(DomainBuffer));
+    }
+    free(domains->ghosts);
+    domains->ghosts = NULL;
+    domains->ghostCapacity = 0;
+    free(g_respawnQueue.body);
+    free(g_respawnQueue.ticket);
+    free(g_respawnQueue.bodyTicket);
+    memset(&g_respawnQueue, 0, sizeof(g_respawnQueue));
+    free(g_coloring.bodyColors);
+    free(g_coloring.manifoldColor);
+    free(g_coloring.order);
+    free(g_coloring.constraintStart);
+    memset(&g_coloring, 0, sizeof(g_coloring));
+
+    AabbTree* tree = &g_aabbTree;
+    free(tree->nodes);
+    free(tree->bodyLeaf);
+    free(tree->stack);
+    memset(tree, 0, sizeof(*tree));
+    tree->root = -1;
+    tree->freeList = -1;
+    tree->dirty = true;
+
+    SweepAndPrune* sap = &g_sweepAndPrune;
+    free(sap->endpoints);
+    free(sap->active);
+    free(sap->activeSlot);
+    free(sap->sleepers);
+    free(sap->overlaps);
+    free(sap->overlapKeys);
+    free(sap->overlapSlots);
+    memset(sap, 0, sizeof(*sap));
+    sap->dirty = true;
+
+    free(g_ccd.fast);
+    memset(&g_ccd, 0, sizeof(g_ccd));
+
+    Heightfield* terrain = &g_terrain;
+    free(terrain->heights);
+    free(terrain->normalX);
+    free(terrain->normalY);
+    free(terrain->normalZ);
+    terrain->heights = NULL;
+    terrain->normalX = NULL;
+    terrain->normalY = NULL;
+    terrain->normalZ = NULL;
+
+    worldFree();
+    threadPoolShutdown();
+}
 
-    glRotatef(rotation->x, 1.0f, 0.0f, 0.0f);
-    glRotatef(rotation->y, 0.0f, 1.0f, 0.0f);
-    glRotatef(rotation->z, 0.0f, 0.0f, 1.0f);
+#ifndef FENDERZ_HEADLESS_ONLY
+void drawCube(const GLfloat* model, const Vec3* color) {
+    glPushMatrix();
 
-    glScalef(size / 2.0f, size / 2.0f, size / 2.0f);
+    glMultMatrixf(model);
 
     glBindTexture(GL_TEXTURE_2D, g_cube_texture_id);
 
@@ -668,7 +7176,163 @@ void drawCube(const Vec3* position, const Vec3* rotation, const Vec3* color, flo
     glPopMatrix();
 }
 
-void display() {
+/* The terrain never changes, so its mesh is compiled once: one vertex array of
+ * positions and normals drawn as a triangle strip per row. */
+void buildTerrainMesh() {
+    const Heightfield* terrain = &g_terrain;
+    if (terrain->heights == NULL) return;
+
+    size_t samples = (size_t)terrain->width * (size_t)terrain->depth;
+    GLfloat* vertices = (GLfloat*)malloc(sizeof(GLfloat) * 6 * samples);
+    GLuint* strip = (GLuint*)malloc(sizeof(GLuint) * 2 * (size_t)terrain->width);
+    if (vertices == NULL || strip == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    for (int z = 0; z < terrain->depth; ++z) {
+        for (int x = 0; x < terrain->width; ++x) {
+            int i = terrainIndex(terrain, x, z);
+            GLfloat* v = vertices + (size_t)i * 6;
+            v[0] = terrain->originX + terrain->cellSize * (float)x;
+            v[1] = terrain->heights[i];
+            v[2] = terrain->originZ + terrain->cellSize * (float)z;
+            v[3] = terrain->normalX[i];
+            v[4] = terrain->normalY[i];
+            v[5] = terrain->normalZ[i];
+        }
+    }
+
+    g_terrainList = glGenLists(1);
+    glNewList(g_terrainList, GL_COMPILE);
+    glDisable(GL_TEXTURE_2D);
+    glColor3f(0.35f, 0.45f, 0.3f);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(GLfloat) * 6, vertices);
+    glNormalPointer(GL_FLOAT, sizeof(GLfloat) * 6, vertices + 3);
+    for (int z = 0; z + 1 < terrain->depth; ++z) {
+        for (int x = 0; x < terrain->width; ++x) {
+            strip[x * 2 + 0] = (GLuint)terrainIndex(terrain, x, z + 1);
+            strip[x * 2 + 1] = (GLuint)terrainIndex(terrain, x, z);
+        }
+        glDrawElements(GL_TRIANGLE_STRIP, terrain->width * 2, GL_UNSIGNED_INT, strip);
+    }
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glEnable(GL_TEXTURE_2D);
+    glEndList();
+
+    free(strip);
+    free(vertices);
+}
+
+/* Round shapes are compiled once in the cube's [-1, 1] model space, so the
+ * per-body matrices scale them like cubes: a sphere of radius 1 and a capsule
+ * along y with radius and half segment 0.5. */
+void buildShapeMeshes() {
+    GLUquadric* quadric = gluNewQuadric();
+    gluQuadricNormals(quadric, GLU_SMOOTH);
+
+    g_shapeLists[SHAPE_SPHERE] = glGenLists(1);
+    glNewList(g_shapeLists[SHAPE_SPHERE], GL_COMPILE);
+    gluSphere(quadric, 1.0, 16, 12);
+    glEndList();
+
+    g_shapeLists[SHAPE_CAPSULE] = glGenLists(1);
+    glNewList(g_shapeLists[SHAPE_CAPSULE], GL_COMPILE);
+    glPushMatrix();
+    glTranslatef(0.0f, -0.5f, 0.0f);
+    glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
+    gluCylinder(quadric, 0.5, 0.5, 1.0, 16, 1);
+    gluSphere(quadric, 0.5, 16, 8);
+    glTranslatef(0.0f, 0.0f, 1.0f);
+    gluSphere(quadric, 0.5, 16, 8);
+    glPopMatrix();
+    glEndList();
+
+    gluDeleteQuadric(quadric);
+}
+
+static inline float lerpAngle(float a, float b, float t) {
+    float delta = fmodf(b - a, 360.0f);
+    if (delta > 180.0f) delta -= 360.0f;
+    else if (delta < -180.0f) delta += 360.0f;
+    return a + delta * t;
+}
+
+void prepareRenderMatrices(int begin, int end, int slice, void* context) {
+    World* w = &g_world;
+    float** m = g_renderMatrices.m;
+    const vfloat alpha = vf_set1(*(const float*)context);
+    const vfloat zero = vf_set1(0.0f);
+    const vfloat one = vf_set1(1.0f);
+    const vfloat half = vf_set1(0.5f);
+    const vfloat two = vf_set1(2.0f);
+
+    for (int base = begin; base < end; base += SIMD_WIDTH) {
+        vfloat px = vf_load(w->prevPosX + base);
+        vfloat py = vf_load(w->prevPosY + base);
+        vfloat pz = vf_load(w->prevPosZ + base);
+        px = vf_fmadd(vf_sub(vf_load(w->posX + base), px), alpha, px);
+        py = vf_fmadd(vf_sub(vf_load(w->posY + base), py), alpha, py);
+        pz = vf_fmadd(vf_sub(vf_load(w->posZ + base), pz), alpha, pz);
+
+        vfloat aw = vf_load(w->prevQuatW + base);
+        vfloat ax = vf_load(w->prevQuatX + base);
+        vfloat ay = vf_load(w->prevQuatY + base);
+        vfloat az = vf_load(w->prevQuatZ + base);
+        vfloat bw = vf_load(w->quatW + base);
+        vfloat bx = vf_load(w->quatX + base);
+        vfloat by = vf_load(w->quatY + base);
+        vfloat bz = vf_load(w->quatZ + base);
+
+        /* nlerp along the shorter arc */
+        vfloat dot = vf_fmadd(aw, bw, vf_fmadd(ax, bx, vf_fmadd(ay, by, vf_mul(az, bz))));
+        vfloat t = vf_select(vf_lt(dot, zero), vf_sub(zero, alpha), alpha);
+        vfloat s0 = vf_sub(one, alpha);
+        vfloat qw = vf_fmadd(bw, t, vf_mul(aw, s0));
+        vfloat qx = vf_fmadd(bx, t, vf_mul(ax, s0));
+        vfloat qy = vf_fmadd(by, t, vf_mul(ay, s0));
+        vfloat qz = vf_fmadd(bz, t, vf_mul(az, s0));
+        vfloat lengthSq = vf_fmadd(qw, qw, vf_fmadd(qx, qx, vf_fmadd(qy, qy, vf_mul(qz, qz))));
+
+        /* Scaling by 2/|q|^2 normalizes the rotation; the half edge is folded in. */
+        vfloat scale = vf_mul(vf_load(w->size + base), half);
+        vfloat k = vf_div(two, lengthSq);
+        vfloat xx = vf_mul(qx, vf_mul(qx, k)), yy = vf_mul(qy, vf_mul(qy, k)), zz = vf_mul(qz, vf_mul(qz, k));
+        vfloat xy = vf_mul(qx, vf_mul(qy, k)), xz = vf_mul(qx, vf_mul(qz, k)), yz = vf_mul(qy, vf_mul(qz, k));
+        vfloat wx = vf_mul(qw, vf_mul(qx, k)), wy = vf_mul(qw, vf_mul(qy, k)), wz = vf_mul(qw, vf_mul(qz, k));
+
+        vf_store(m[0] + base, vf_mul(vf_sub(one, vf_add(yy, zz)), scale));
+        vf_store(m[1] + base, vf_mul(vf_sub(xy, wz), scale));
+        vf_store(m[2] + base, vf_mul(vf_add(xz, wy), scale));
+        vf_store(m[3] + base, px);
+        vf_store(m[4] + base, vf_mul(vf_add(xy, wz), scale));
+        vf_store(m[5] + base, vf_mul(vf_sub(one, vf_add(xx, zz)), scale));
+        vf_store(m[6] + base, vf_mul(vf_sub(yz, wx), scale));
+        vf_store(m[7] + base, py);
+        vf_store(m[8] + base, vf_mul(vf_sub(xz, wy), scale));
+        vf_store(m[9] + base, vf_mul(vf_add(yz, wx), scale));
+        vf_store(m[10] + base, vf_mul(vf_sub(one, vf_add(xx, yy)), scale));
+        vf_store(m[11] + base, pz);
+    }
+}
+
+void reserveRenderMatrices() {
+    World* w = &g_world;
+    RenderMatrices* matrices = &g_renderMatrices;
+    if (matrices->capacity < w->capacity) {
+        for (int e = 0; e < 12; ++e) {
+            free(matrices->m[e]);
+            matrices->m[e] = (float*)allocAligned(sizeof(float) * (size_t)w->capacity);
+        }
+        matrices->capacity = w->capacity;
+    }
+}
+
+/* prepared tells whether a physics step this frame already filled the render
+ * matrices; otherwise they are interpolated here. */
+void display(float alpha, bool prepared) {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
@@ -678,10 +7342,53 @@ void display() {
               0.0, 1.0, 0.0);
 
     glRotatef(rotateX, 1.0f, 0.0f, 0.0f);
-    glRotatef(rotateY, 0.0f, 1.0f, 0.0f);
+    glRotatef(lerpAngle(prevRotateY, rotateY, alpha), 0.0f, 1.0f, 0.0f);
+
+    World* w = &g_world;
+    RenderMatrices* matrices = &g_renderMatrices;
+    if (!prepared) parallelFor(w->count, prepareRenderMatrices, &alpha);
+
+    for (int i = 0; i < w->count; ++i) {
+        const GLfloat model[16] = {
+            matrices->m[0][i], matrices->m[4][i], matrices->m[8][i], 0.0f,
+            matrices->m[1][i], matrices->m[5][i], matrices->m[9][i], 0.0f,
+            matrices->m[2][i], matrices->m[6][i], matrices->m[10][i], 0.0f,
+            matrices->m[3][i], matrices->m[7][i], matrices->m[11][i], 1.0f
+        };
+        Vec3 color = vec3_create(w->colorR[i], w->colorG[i], w->colorB[i]);
+        if (i < w->shapeStart[SHAPE_BOX + 1]) {
+            drawCube(model, &color);
+            continue;
+        }
+        /* Bodies are sorted by shape, so the texture toggles once per batch. */
+        if (i == w->shapeStart[SHAPE_BOX + 1]) glDisable(GL_TEXTURE_2D);
+        glPushMatrix();
+        glMultMatrixf(model);
+        glColor3f(color.x, color.y, color.z);
+        glCallList(g_shapeLists[w->shape[i]]);
+        glPopMatrix();
+    }
+    glEnable(GL_TEXTURE_2D);
+
+    const Vec3 staticColor = vec3_create(0.5f, 0.5f, 0.5f);
+    for (int k = 0; k < g_statics.boxCount; ++k) {
+        const Obb* box = &g_statics.boxes[k];
+        GLfloat model[16];
+        for (int a = 0; a < 3; ++a) {
+            model[a * 4 + 0] = box->axis[a].x * box->extent[a];
+            model[a * 4 + 1] = box->axis[a].y * box->extent[a];
+            model[a * 4 + 2] = box->axis[a].z * box->extent[a];
+            model[a * 4 + 3] = 0.0f;
+        }
+        model[12] = box->center.x;
+        model[13] = box->center.y;
+        model[14] = box->center.z;
+        model[15] = 1.0f;
+        drawCube(model, &staticColor);
+    }
 
-    for (int i = 0; i < NUM_CUBES; ++i) {
-        drawCube(&g_cubes[i].position, &g_cubes[i].rotation, &g_cubes[i].color, g_cubes[i].size);
+    if (g_terrainList != 0) {
+        glCallList(g_terrainList);
     }
 }
 
@@ -695,3 +7402,4 @@ void reshape(int width, int height) {
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 }
+#endif